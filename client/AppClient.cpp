@@ -1,14 +1,30 @@
 #include "AppClient.h"
 #include <iostream>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <cstring>
+#include <chrono>
+#include <cstdio>
 #include <limits> // 用于清理输入缓冲区
 
 using namespace std;
 
 // 构造函数
-AppClient::AppClient() : _sock(-1), _connected(false) {}
+AppClient::AppClient() : _closing(false), _watching(false) {
+    _net.setMessageHandler([this](const NetMsg& msg) { printMessage(msg); });
+    _net.setCloseHandler([this]() {
+        if (!_closing) cout << "\n[Error] Server disconnected." << endl;
+    });
+    _net.setCompression(true); // 大的消息和列表压缩传输，老服务器不支持时自动退回
+    // 服务器重启或网络中断时自动重连，用会话找回断开期间的消息，没收到应答的请求重发
+    _net.setReconnect(true);
+    _net.setReconnectHandler([this](bool restored) {
+        if (restored) {
+            cout << "\n[Info] Reconnected. Your ID: " << _net.clientId() << endl;
+        } else {
+            cout << "\n[Error] Server disconnected, reconnecting..." << endl;
+        }
+        cout << ">>> ";
+        flush(cout);
+    });
+}
 
 // 析构函数
 AppClient::~AppClient() { 
@@ -36,135 +52,87 @@ void AppClient::run() {
         }
         
         handleInput(choice);
-        
-        // 简单延时，防止菜单刷新太快冲掉输出信息
-        std::this_thread::sleep_for(std::chrono::milliseconds(200));
     }
 }
 
 // 连接服务器
 bool AppClient::connectServer(std::string ip, int port) {
-    if (_connected) {
+    if (online()) {
         cout << "[Info] Already connected." << endl;
         return true;
     }
-
-    // 1. 创建 Socket
-    _sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (_sock == -1) {
-        perror("Socket creation failed");
-        return false;
-    }
-
-    // 2. 设置服务器地址
-    sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    if (inet_pton(AF_INET, ip.c_str(), &serverAddr.sin_addr) <= 0) {
-        cout << "[Error] Invalid IP address" << endl;
-        return false;
-    }
-
-    // 3. 连接
-    if (connect(_sock, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+    if (!_net.connect(ip, port)) {
         perror("Connection failed");
         return false;
     }
-
-    _connected = true;
     cout << "[Info] Connected to server successfully!" << endl;
-
-    // 4. 启动接收线程
-    // 使用 std::thread 创建后台线程，专门负责 recv
-    _recvThread = std::thread(&AppClient::recvLoop, this);
-    
     return true;
 }
 
 // 断开连接
 void AppClient::disconnect() {
-    if (_connected) {
-        _connected = false;
-        
-        // 【新增】强制关闭读写通道，这能确保阻塞的 recv 立即返回 0 或 -1
-        shutdown(_sock, SHUT_RDWR); 
-        
-        close(_sock);
-        _sock = -1;
-        
-        // 等待接收线程结束
-        if (_recvThread.joinable()) {
-            _recvThread.join();
-        }
+    if (online()) {
+        _closing = true;
+        _net.close();
+        _closing = false;
         cout << "[Info] Disconnected." << endl;
     }
 }
 
-// 接收线程循环
-// 在 client/AppClient.cpp 中替换 recvLoop 函数
-
-void AppClient::recvLoop() {
-    char buffer[2048];
-    std::string msgBuffer = ""; // 【added】持久化缓冲区
-
-    while (_connected) {
-        memset(buffer, 0, sizeof(buffer));
-        int bytesRead = recv(_sock, buffer, sizeof(buffer) - 1, 0);
-        
-        if (bytesRead <= 0) {
-            if (_connected) { 
-                cout << "\n[Error] Server disconnected." << endl;
-                _connected = false;
-                close(_sock);
-                _sock = -1;
-            }
-            break;
-        }
-
-        // 修改：追加数据并循环切割
-        msgBuffer += buffer;
-
-        size_t pos;
-        while ((pos = msgBuffer.find('\n')) != std::string::npos) {
-            std::string raw = msgBuffer.substr(0, pos);
-            msgBuffer.erase(0, pos + 1);
-
-            NetMsg msg;
-            if (NetMsg::decode(raw, msg)) {
-                // 根据消息类型显示不同内容
-                if (msg.getType() == 'S') {
-                    cout << "\n>>> [New Message] " << msg.getContent() << endl;
-                } else if (msg.getType() == 'L') {
-                    cout << "\n" << msg.getContent() << endl;
-                } else {
-                    cout << "\n>>> [Server Response]: " << msg.getContent() << endl;
-                }
-                cout << ">>> "; 
-                flush(cout);
-            }
+// 显示推送消息：其他客户端的转发、广播、主题消息，以及服务器的错误提示
+void AppClient::printMessage(const NetMsg& msg) {
+    if (msg.getType() == 'S') {
+        cout << "\n>>> [New Message] " << msg.getContent() << endl;
+    } else if (msg.getType() == 'A') {
+        cout << "\n>>> [Broadcast] " << msg.getContent() << endl;
+    } else if (msg.getType() == 'P' && msg.getTargetId() != 0) {
+        // 主题消息：主题|[From 101]: 正文
+        const std::string& content = msg.getContent();
+        size_t sep = content.find(DELIMITER);
+        cout << "\n>>> [Topic " << content.substr(0, sep) << "] "
+             << (sep == std::string::npos ? "" : content.substr(sep + 1)) << endl;
+    } else if (msg.getType() == 'U') {
+        // 在线列表的增量："+版本号 [ID:101 ...]" 或 "-版本号"
+        const std::string& content = msg.getContent();
+        size_t space = content.find(' ');
+        if (!content.empty() && content[0] == '+') {
+            cout << "\n>>> [Client List v" << content.substr(1, space - 1) << "] Online: "
+                 << (space == std::string::npos ? "" : content.substr(space + 1)) << endl;
+        } else {
+            cout << "\n>>> [Client List v" << content.substr(1) << "] Offline: ID " << msg.getTargetId() << endl;
         }
+    } else {
+        cout << "\n>>> [Server Response]: " << msg.getContent() << endl;
     }
+    cout << ">>> ";
+    flush(cout);
 }
-//
 
 void AppClient::showMenu() {
-    if (!_connected) {
+    if (!online()) {
         cout << "\n=== OFFLINE MENU ===" << endl;
         cout << "1. Connect to Server" << endl;
         cout << "6. Exit" << endl;
     } else {
-        cout << "\n=== ONLINE MENU ===" << endl;
+        cout << (_net.connected() ? "\n=== ONLINE MENU ===" : "\n=== ONLINE MENU (reconnecting) ===") << endl;
         cout << "2. Get Server Time" << endl;
         cout << "3. Get Server Name" << endl;
         cout << "4. Get Client List" << endl;
         cout << "5. Send Message" << endl;
         cout << "6. Disconnect & Exit" << endl;
+        cout << "7. Broadcast Message" << endl;
+        cout << "8. Join Topic" << endl;
+        cout << "9. Leave Topic" << endl;
+        cout << "10. Publish to Topic" << endl;
+        cout << "11. Get Client List (Page)" << endl;
+        cout << (_watching ? "12. Stop Watching Client List" : "12. Watch Client List") << endl;
+        cout << "13. Keep Session (resume after reconnect)" << endl;
     }
     cout << "Select: ";
 }
 
 void AppClient::handleInput(int choice) {
-    if (!_connected) {
+    if (!online()) {
         if (choice == 1) {
             string ip;
             int port;
@@ -187,18 +155,6 @@ void AppClient::handleInput(int choice) {
         case 2: // 获取时间
             sendRequest('T');
             break;
-        // case 2: // 获取时间 - 【临时修改用于压力测试】
-        // {
-        //     cout << "Starting Stress Test (100 requests)..." << endl;
-        //     // 循环发送 100 次
-        //     for (int i = 0; i < 100; i++) {
-        //         sendRequest('T');
-        //         // 可选：极短的延时模拟真实高频但非瞬时的请求，或者注释掉测试极限粘包
-        //         // std::this_thread::sleep_for(std::chrono::microseconds(100)); 
-        //     }
-        //     cout << "Sent 100 requests." << endl;
-        //     break;
-        // }
         case 3: // 获取名字
             sendRequest('N');
             break;
@@ -226,21 +182,107 @@ void AppClient::handleInput(int choice) {
             }
             break;
         }
+        case 7: // 广播
+        {
+            string content;
+            cout << "Enter Message: ";
+            getline(cin, content);
+            if (!content.empty()) {
+                sendRequest('A', content);
+            } else {
+                cout << "Message cannot be empty." << endl;
+            }
+            break;
+        }
+        case 8: // 订阅主题
+        case 9: // 退订主题
+        {
+            string topic;
+            cout << "Enter Topic: ";
+            getline(cin, topic);
+            sendRequest(choice == 8 ? 'J' : 'Q', topic);
+            break;
+        }
+        case 10: // 发布到主题
+        {
+            string topic, content;
+            cout << "Enter Topic: ";
+            getline(cin, topic);
+            cout << "Enter Message: ";
+            getline(cin, content);
+            if (!content.empty()) {
+                sendRequest('P', topic + DELIMITER + content);
+            } else {
+                cout << "Message cannot be empty." << endl;
+            }
+            break;
+        }
+        case 11: // 分页获取列表
+        {
+            int afterId, limit;
+            cout << "List clients with ID greater than (0 for first page): ";
+            cin >> afterId;
+            cout << "Page size: ";
+            cin >> limit;
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            sendRequest('L', to_string(afterId) + ":" + to_string(limit));
+            break;
+        }
+        case 12: // 订阅/退订在线列表的增量
+            _watching = !_watching;
+            sendRequest('W', _watching ? "1" : "0");
+            break;
+        case 13: // 建立会话：重连后凭令牌恢复，断开期间的消息离线保存；退出时结束
+            keepSession();
+            break;
         default:
             cout << "Invalid option." << endl;
             break;
     }
 }
 
+// 建立会话。令牌由 NetClient 记下，这里只显示会话 ID
+void AppClient::keepSession() {
+    std::future<NetMsg> reply = _net.request('I', "");
+    if (reply.wait_for(std::chrono::seconds(3)) != std::future_status::ready) {
+        cout << "[Error] No response from server." << endl;
+        return;
+    }
+    try {
+        NetMsg msg = reply.get();
+        if (msg.getTargetId() > 0) {
+            cout << "[Info] Session " << msg.getTargetId() << " kept, messages sent while offline will be delivered."
+                 << endl;
+        } else {
+            cout << "\n>>> [Server Response]: " << msg.getContent() << endl;
+        }
+    } catch (const std::exception& e) {
+        cout << "[Error] Request failed: " << e.what() << endl;
+    }
+}
+
 // 辅助发送函数
 void AppClient::sendRequest(char type, std::string data, int target) {
-    if (!_connected) return;
-    
-    NetMsg msg(type, data, target);
-    std::string packet = msg.encode();
-    
-    int sent = send(_sock, packet.c_str(), packet.length(), 0);
-    if (sent < 0) {
-        perror("Send failed");
+    if (!online()) return;
+
+    std::future<NetMsg> reply = _net.request(type, data, target);
+    if (reply.wait_for(std::chrono::seconds(3)) != std::future_status::ready) {
+        if (_net.reconnecting()) {
+            cout << "[Info] Reconnecting, the request will be sent once the connection is back." << endl;
+        } else {
+            cout << "[Error] No response from server." << endl;
+        }
+        return;
     }
-}
\ No newline at end of file
+    try {
+        NetMsg msg = reply.get();
+        if (msg.getContent().empty()) return; // 没有应答的请求（S/A/P）
+        if (msg.getType() == 'L') {
+            cout << "\n" << msg.getContent() << endl;
+        } else {
+            cout << "\n>>> [Server Response]: " << msg.getContent() << endl;
+        }
+    } catch (const std::exception& e) {
+        cout << "[Error] Request failed: " << e.what() << endl;
+    }
+}
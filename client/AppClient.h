@@ -2,15 +2,14 @@
 #define APP_CLIENT_H
 
 #include <string>
-#include <thread>
 #include <atomic>
-#include "../common/NetMsg.h" // 引入公共协议头文件
+#include "NetClient.h" // 收发和请求/应答匹配都在 NetClient 里，这里只有菜单
 
 class AppClient {
 private:
-    int _sock;                      // Socket 句柄
-    std::atomic<bool> _connected;   // 连接状态 (原子变量，线程安全)
-    std::thread _recvThread;        // 后台接收线程对象
+    NetClient _net;                 // 连接
+    std::atomic<bool> _closing;     // 主动断开中，不提示 "Server disconnected"
+    bool _watching;                 // 已订阅在线列表的增量
 
 public:
     AppClient();
@@ -25,16 +24,22 @@ private:
     
     // 断开连接
     void disconnect();
+
+    // 已连接，或者断开后正在自动重连（请求会在恢复后发出）
+    bool online() const { return _net.connected() || _net.reconnecting(); }
     
-    // 接收线程的工作函数
-    void recvLoop(); 
+    // 显示服务器推送的消息（在 NetClient 的接收线程里调用）
+    void printMessage(const NetMsg& msg);
 
     // UI 相关
     void showMenu();
     void handleInput(int choice);
     
-    // 辅助发送函数
+    // 辅助发送函数：有应答的请求等应答到达后再返回，菜单不会冲掉输出
     void sendRequest(char type, std::string data = "", int target = 0);
+
+    // 菜单 13：建立会话，之后断线重连能恢复，退出时会话随之结束
+    void keepSession();
 };
 
 #endif
\ No newline at end of file
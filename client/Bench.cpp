@@ -0,0 +1,625 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "../common/NetMsg.h"
+#include "../common/MsgBuffer.h"
+#include "../common/Histogram.h"
+
+using namespace std;
+
+// 压测工具：大量并发连接按给定比例发送 T/N/L/S 请求，统计吞吐量和延迟分布
+//
+// 两种模式：
+//   闭环（默认）：每个连接保持 depth 个未完成的请求，收到应答就发下一个，测最大吞吐量
+//   定速（-r）：所有连接合计每秒发 rate 个请求，延迟从计划发送时间算起，
+//              服务器变慢时排队的时间也算进去，不会因为少发请求而低估延迟
+// 服务器按请求顺序应答同一个连接，所以每个连接用一个 FIFO 记录发送时间。
+// 'S' 的目标是连接自己：走完整的查找、编码、转发路径后回到同一个连接。
+//
+// 内存：-i 在压测前另外建立一批只协商、不发请求的空闲连接；配合 -x 指定服务器的统计端口，
+// 会分别在建立空闲连接前后和压测结束后抓取统计，报告每个空闲连接占用的常驻内存
+// 和每个应答对应的内存池 malloc 次数。
+//
+// 压缩：-z 协商压缩，不小于 COMPRESS_MIN_DEFAULT 的请求压缩后发送，服务器发来的 'Z' 帧解压后逐帧处理；
+// --json 把 'S' 的负载换成同样长度的 JSON 文本（默认全是 'x'，压缩率高得不真实）。
+// 结束时报告双方收发的字节数和 CPU 时间（服务器的需要 -x），对比开和关 -z 就能看到 CPU 和带宽的取舍。
+
+#define BENCH_TYPES 4
+#define BENCH_MAX_EVENTS 256
+#define BENCH_DRAIN_MS 2000     // 结束后等待未完成应答的时间
+
+static const char REQ_TYPES[BENCH_TYPES] = {'T', 'N', 'L', 'S'};
+static const char* LIST_TITLE = "=== Online Clients ==="; // 'L' 应答的第一帧，后面每个在线客户端一帧
+
+// 压测参数
+struct BenchConfig {
+    string host;            // 服务器地址
+    int port;               // 服务器端口
+    int conns;              // 并发连接数
+    int threads;            // 压测线程数，每个线程一个 epoll
+    int seconds;            // 压测时长
+    double rate;            // 定速模式下每秒总请求数，0 表示闭环
+    int depth;              // 闭环模式下每个连接的未完成请求数
+    string payload;         // 'S' 的负载（-s 字节）
+    bool binary;            // 使用二进制帧
+    bool compress;          // 协商压缩（-z）
+    bool json;              // 'S' 的负载用 JSON 文本（--json）
+    int weights[BENCH_TYPES]; // T/N/L/S 的比例
+    int idle;               // 额外的空闲连接数
+    int statsPort;          // 服务器的统计端口（与 host 相同的地址），0 表示不抓取
+
+    BenchConfig() : host("127.0.0.1"), port(6241), conns(100), threads(4), seconds(10),
+                    rate(0), depth(1), payload(32, 'x'), binary(true), compress(false), json(false),
+                    idle(0), statsPort(0) {
+        weights[0] = weights[1] = weights[2] = 0;
+        weights[3] = 1;
+    }
+};
+
+// 已发出、等待应答的请求
+struct Pending {
+    int type;               // REQ_TYPES 的下标
+    uint64_t start;         // 发送（定速模式下是计划发送）时间，纳秒
+};
+
+struct BenchConn {
+    int fd;
+    int id;                 // 服务器分配的 ID，来自 'B' 应答
+    bool ready;             // 已收到 'B' 应答
+    bool dead;              // 连接已断开
+    MsgBuffer in;           // 接收缓冲区
+    string out;             // 还没写出的请求
+    size_t outOff;          // out 中已写出的字节数
+    deque<Pending> pending;
+    bool compress;          // 服务器同意了压缩
+    uint64_t bytesIn;       // 从套接字读到的字节
+    uint64_t bytesOut;      // 写进套接字的字节
+
+    BenchConn() : fd(-1), id(0), ready(false), dead(false), outOff(0), compress(false), bytesIn(0), bytesOut(0) {}
+};
+
+// 每个压测线程的状态，结果在结束后汇总
+struct BenchWorker {
+    int epfd;
+    vector<unique_ptr<BenchConn> > conns;
+    Histogram hist[BENCH_TYPES];
+    uint64_t sent;
+    uint64_t received;
+    uint64_t errors;        // 应答类型不符、转发失败、连接断开
+    uint32_t rng;           // xorshift 随机数状态
+    size_t nextConn;        // 定速模式轮流使用的连接
+    std::thread thread;
+
+    BenchWorker() : epfd(-1), sent(0), received(0), errors(0), rng(2463534242u), nextConn(0) {}
+};
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t nextRandom(uint32_t& s) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
+
+// 按比例随机选一种请求
+static int pickType(const BenchConfig& cfg, BenchWorker& w) {
+    int total = 0;
+    for (int i = 0; i < BENCH_TYPES; i++) total += cfg.weights[i];
+    int r = (int)(nextRandom(w.rng) % (uint32_t)total);
+    for (int i = 0; i < BENCH_TYPES; i++) {
+        if (r < cfg.weights[i]) return i;
+        r -= cfg.weights[i];
+    }
+    return BENCH_TYPES - 1;
+}
+
+// 阻塞 connect，成功后设为非阻塞
+static int connectOne(const BenchConfig& cfg) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(cfg.port);
+    if (inet_pton(AF_INET, cfg.host.c_str(), &addr.sin_addr) <= 0 ||
+        connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // 请求很小，不等 Nagle 合并
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// 尽量写出积压的请求，写到 EAGAIN 时等 EPOLLOUT；连接出错返回 false
+static bool flushConn(BenchConn& c) {
+    while (c.outOff < c.out.size()) {
+        ssize_t n = send(c.fd, c.out.data() + c.outOff, c.out.size() - c.outOff, MSG_NOSIGNAL);
+        if (n > 0) {
+            c.outOff += n;
+            c.bytesOut += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        return false;
+    }
+    c.out.clear();
+    c.outOff = 0;
+    return true;
+}
+
+static void markDead(BenchWorker& w, BenchConn& c) {
+    if (c.dead) return;
+    c.dead = true;
+    w.errors++;
+    epoll_ctl(w.epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+    close(c.fd);
+}
+
+// 编码一个请求追加到连接的发送缓冲，start 为计时起点；协商了压缩时大的请求压缩成 'Z' 帧
+static void queueRequest(const BenchConfig& cfg, BenchWorker& w, BenchConn& c, uint64_t start) {
+    static thread_local string packet;
+    int type = pickType(cfg, w);
+    packet.clear();
+    if (REQ_TYPES[type] == 'S') {
+        NetMsg::encodeTo(packet, 'S', c.id, cfg.payload, cfg.binary);
+    } else {
+        NetMsg::encodeTo(packet, REQ_TYPES[type], 0, StrView(), cfg.binary);
+    }
+    if (!c.compress || packet.size() < COMPRESS_MIN_DEFAULT || !NetMsg::compressTo(c.out, packet)) {
+        c.out += packet;
+    }
+    Pending p;
+    p.type = type;
+    p.start = start;
+    c.pending.push_back(p);
+    w.sent++;
+}
+
+// 一个应答：匹配 FIFO 中最早的请求
+static void handleReply(const BenchConfig& cfg, BenchWorker& w, BenchConn& c, const NetMsgView& msg,
+                        uint64_t now, bool closedLoop) {
+    if (msg.type == 'B' && !c.ready) {
+        // 协商应答：拿到自己的 ID 后才开始发请求
+        c.id = msg.targetId;
+        c.ready = true;
+        c.compress = (msg.payload == StrView(PROTO_BINARY_LZ4_CAP));
+        if (closedLoop) {
+            for (int i = 0; i < cfg.depth; i++) queueRequest(cfg, w, c, nowNs());
+        }
+        return;
+    }
+    if (msg.type == 'L' && msg.payload != StrView(LIST_TITLE)) return; // 列表的后续行
+    if (c.pending.empty()) {
+        w.errors++;
+        return;
+    }
+
+    Pending p = c.pending.front();
+    c.pending.pop_front();
+    // 'S' 转发失败时服务器用 targetId 0 回一条错误
+    if (msg.type != REQ_TYPES[p.type] || (msg.type == 'S' && msg.targetId == 0)) {
+        w.errors++;
+    } else {
+        w.hist[p.type].record(now > p.start ? now - p.start : 0);
+        w.received++;
+    }
+    if (closedLoop) queueRequest(cfg, w, c, now);
+}
+
+// 读到 EAGAIN，逐帧匹配 FIFO 中的请求；closedLoop 为 true 时每收到一个应答补发一个请求
+static void handleInput(const BenchConfig& cfg, BenchWorker& w, BenchConn& c, bool sending) {
+    static thread_local string inflated;
+    bool closedLoop = sending && cfg.rate <= 0;
+    while (!c.dead) {
+        ssize_t n = c.in.readFd(c.fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            markDead(w, c);
+            return;
+        }
+        c.bytesIn += n;
+
+        uint64_t now = nowNs();
+        StrView frame;
+        while (c.in.nextFrame(frame)) {
+            NetMsgView msg;
+            if (!NetMsg::decodeView(frame, msg)) {
+                w.errors++;
+            } else if (msg.type != MSG_COMPRESSED) {
+                handleReply(cfg, w, c, msg, now, closedLoop);
+            } else if (!NetMsg::decompress(msg.payload, inflated) ||
+                       !NetMsg::forEachFrame(inflated, [&](const NetMsgView& m) {
+                           handleReply(cfg, w, c, m, now, closedLoop);
+                       })) {
+                w.errors++;
+            }
+        }
+        if (c.in.bad()) {
+            markDead(w, c);
+            return;
+        }
+    }
+    if (!c.dead && !flushConn(c)) markDead(w, c);
+}
+
+static void runWorker(const BenchConfig& cfg, BenchWorker* w, uint64_t startNs, uint64_t endNs) {
+    epoll_event events[BENCH_MAX_EVENTS];
+    // 定速模式：每个线程分担 rate / threads，请求在计划时间点发出
+    double perThread = cfg.rate / cfg.threads;
+    uint64_t interval = perThread > 0 ? (uint64_t)(1e9 / perThread) : 0;
+    uint64_t nextSend = startNs;
+    uint64_t drainEnd = endNs + BENCH_DRAIN_MS * 1000000ULL;
+
+    while (true) {
+        uint64_t now = nowNs();
+        bool sending = now < endNs;
+        if (!sending) {
+            // 停止发送，等未完成的应答
+            bool idle = true;
+            for (size_t i = 0; i < w->conns.size() && idle; i++) {
+                if (!w->conns[i]->dead && !w->conns[i]->pending.empty()) idle = false;
+            }
+            if (idle || now >= drainEnd) break;
+        }
+
+        if (sending && interval > 0) {
+            while (nextSend <= now) {
+                // 轮流找一个就绪的连接
+                BenchConn* c = nullptr;
+                for (size_t tries = 0; tries < w->conns.size() && !c; tries++) {
+                    BenchConn* cand = w->conns[w->nextConn++ % w->conns.size()].get();
+                    if (cand->ready && !cand->dead) c = cand;
+                }
+                if (!c) break;
+                queueRequest(cfg, *w, *c, nextSend);
+                if (!flushConn(*c)) markDead(*w, *c);
+                nextSend += interval;
+            }
+            if (nextSend <= now) nextSend = now + interval; // 还没有就绪的连接
+        }
+
+        int timeoutMs = 100;
+        if (sending && interval > 0) {
+            uint64_t wait = nextSend > now ? nextSend - now : 0;
+            timeoutMs = (int)(wait / 1000000);
+        }
+        int n = epoll_wait(w->epfd, events, BENCH_MAX_EVENTS, timeoutMs);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            BenchConn& c = *(BenchConn*)events[i].data.ptr;
+            if (c.dead) continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                handleInput(cfg, *w, c, sending);
+            }
+            if (!c.dead && (events[i].events & EPOLLOUT) && !flushConn(c)) {
+                markDead(*w, c);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < w->conns.size(); i++) {
+        BenchConn& c = *w->conns[i];
+        if (!c.dead) close(c.fd);
+    }
+    close(w->epfd);
+}
+
+// 建立空闲连接：协商帧格式并等到应答（服务器已经登记了连接），之后一直不发请求
+static int openIdle(const BenchConfig& cfg, vector<int>& fds) {
+    string hello;
+    NetMsg::encodeTo(hello, 'B', 0, PROTO_BINARY_CAP, false);
+    for (int i = 0; i < cfg.idle; i++) {
+        int fd = connectOne(cfg);
+        if (fd < 0) {
+            perror("Idle connect failed");
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+        if (send(fd, hello.data(), hello.size(), MSG_NOSIGNAL) != (ssize_t)hello.size()) {
+            close(fd);
+            break;
+        }
+        fds.push_back(fd);
+    }
+    for (size_t i = 0; i < fds.size(); i++) {
+        char buf[256];
+        if (recv(fds[i], buf, sizeof(buf), 0) <= 0) return (int)i;
+    }
+    return (int)fds.size();
+}
+
+// 抓取服务器的统计（HTTP GET，读到对端关闭）
+static bool fetchStats(const BenchConfig& cfg, string& body) {
+    BenchConfig statsCfg = cfg;
+    statsCfg.port = cfg.statsPort;
+    int fd = connectOne(statsCfg);
+    if (fd < 0) return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    const char* req = "GET /metrics HTTP/1.0\r\n\r\n";
+    body.clear();
+    if (send(fd, req, strlen(req), MSG_NOSIGNAL) > 0) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) body.append(buf, n);
+    }
+    close(fd);
+    return !body.empty();
+}
+
+// 取出一项统计的值，没有时返回 -1
+static double statValue(const string& body, const char* name) {
+    string key = string("\n") + name + " ";
+    size_t pos = body.find(key);
+    if (pos == string::npos) return -1;
+    return atof(body.c_str() + pos + key.size());
+}
+
+// 本进程用掉的 CPU 时间（用户 + 系统），秒
+static double cpuSeconds() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// 长度为 n 的 JSON 文本：一串聊天记录对象，字段名重复、字段值随机，接近真实消息的压缩率
+static string jsonPayload(size_t n) {
+    static const char* WORDS[] = {"hello", "world", "meeting", "tomorrow", "lunch", "ok", "see", "you",
+                                  "thanks", "deploy", "done", "review", "please", "the", "build", "is", "green"};
+    uint32_t rng = 88172645u;
+    string out = "[";
+    while (out.size() < n) {
+        char head[96];
+        snprintf(head, sizeof(head), "{\"id\":%u,\"from\":%u,\"ts\":%u,\"text\":\"",
+                 nextRandom(rng) % 1000000, 100 + nextRandom(rng) % 900, 1700000000u + nextRandom(rng) % 10000000);
+        out += head;
+        int words = 3 + nextRandom(rng) % 10;
+        for (int i = 0; i < words; i++) {
+            if (i) out += ' ';
+            out += WORDS[nextRandom(rng) % (sizeof(WORDS) / sizeof(WORDS[0]))];
+        }
+        out += "\"},";
+    }
+    out.resize(n);
+    return out;
+}
+
+// "T:1,N:1,L:0,S:8" -> weights
+static bool parseMix(const char* s, int weights[BENCH_TYPES]) {
+    for (int i = 0; i < BENCH_TYPES; i++) weights[i] = 0;
+    int total = 0;
+    while (*s) {
+        const char* type = (const char*)memchr(REQ_TYPES, *s, BENCH_TYPES);
+        if (type == NULL || s[1] != ':') return false;
+        char* end;
+        long v = strtol(s + 2, &end, 10);
+        if (end == s + 2 || v < 0) return false;
+        weights[type - REQ_TYPES] = (int)v;
+        total += (int)v;
+        s = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') return false;
+    }
+    return total > 0;
+}
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [-h host] [-p port] [-c conns] [-t threads] [-d seconds]"
+         << " [-r totalRate] [-q depth] [-m T:w,N:w,L:w,S:w] [-s payloadBytes] [--text]"
+         << " [-i idleConns] [-x statsPort] [-z] [--json]" << endl
+         << "  closed-loop by default (each connection keeps <depth> requests in flight);" << endl
+         << "  -r sends at a fixed total rate and measures latency from the scheduled send time;" << endl
+         << "  -i holds extra idle connections, -x reports server memory per idle connection" << endl
+         << "  and buffer pool mallocs per answered request from the stats endpoint;" << endl
+         << "  -z negotiates compression, --json fills 'S' payloads with JSON text instead of 'x'." << endl;
+}
+
+static void printRow(const char* name, const Histogram& h, double seconds) {
+    printf("%-5s %10llu %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+           (unsigned long long)h.count(), h.count() / seconds, h.mean() / 1000.0,
+           h.percentile(50) / 1000.0, h.percentile(99) / 1000.0,
+           h.percentile(99.9) / 1000.0, h.max() / 1000.0);
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig cfg;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-h" && hasValue) cfg.host = argv[++i];
+        else if (arg == "-p" && hasValue) cfg.port = atoi(argv[++i]);
+        else if (arg == "-c" && hasValue) cfg.conns = atoi(argv[++i]);
+        else if (arg == "-t" && hasValue) cfg.threads = atoi(argv[++i]);
+        else if (arg == "-d" && hasValue) cfg.seconds = atoi(argv[++i]);
+        else if (arg == "-r" && hasValue) cfg.rate = atof(argv[++i]);
+        else if (arg == "-q" && hasValue) cfg.depth = atoi(argv[++i]);
+        else if (arg == "-s" && hasValue) cfg.payload.assign(strtoul(argv[++i], NULL, 10), 'x');
+        else if (arg == "-i" && hasValue) cfg.idle = atoi(argv[++i]);
+        else if (arg == "-x" && hasValue) cfg.statsPort = atoi(argv[++i]);
+        else if (arg == "-m" && hasValue) {
+            if (!parseMix(argv[++i], cfg.weights)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--text") cfg.binary = false;
+        else if (arg == "-z") cfg.compress = true;
+        else if (arg == "--json") cfg.json = true;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.conns <= 0 || cfg.threads <= 0 || cfg.seconds <= 0 || cfg.depth <= 0 || cfg.idle < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.threads > cfg.conns) cfg.threads = cfg.conns;
+    if (cfg.compress && !cfg.binary) {
+        cerr << "[Bench] -z needs binary frames" << endl;
+        return 1;
+    }
+    if (cfg.json) cfg.payload = jsonPayload(cfg.payload.size());
+
+    // 几千个连接通常会超过默认的 1024 个文件描述符
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // 空闲连接：建立前后各抓一次统计，差值就是它们在服务器上占用的内存
+    string statsBefore, statsIdle, statsAfter;
+    bool stats = cfg.statsPort > 0 && fetchStats(cfg, statsBefore);
+    if (cfg.statsPort > 0 && !stats) cerr << "[Bench] Stats port " << cfg.statsPort << " unavailable" << endl;
+    vector<int> idleFds;
+    if (cfg.idle > 0) {
+        int idle = openIdle(cfg, idleFds);
+        if (stats) {
+            usleep(200 * 1000); // 等服务器处理完最后几个连接的协商
+            stats = fetchStats(cfg, statsIdle);
+        }
+        printf("[Bench] %d idle connection(s)", idle);
+        if (stats && idle > 0) {
+            double rss = statValue(statsIdle, "process_resident_memory_bytes") -
+                         statValue(statsBefore, "process_resident_memory_bytes");
+            printf(": server RSS %+.0f KB, %.0f bytes per connection", rss / 1024, rss / idle);
+        }
+        printf("\n");
+    } else if (stats) {
+        statsIdle = statsBefore;
+    }
+
+    vector<unique_ptr<BenchWorker> > workers;
+    for (int i = 0; i < cfg.threads; i++) {
+        unique_ptr<BenchWorker> w(new BenchWorker());
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+        w->rng += i * 7919;
+        workers.push_back(std::move(w));
+    }
+
+    // 建立连接并发送协商请求：二进制模式协商 BIN1，文本模式发一个不认识的能力，只为拿到自己的 ID
+    int connected = 0;
+    for (int i = 0; i < cfg.conns; i++) {
+        int fd = connectOne(cfg);
+        if (fd < 0) {
+            perror("Connect failed");
+            break;
+        }
+        BenchWorker& w = *workers[i % cfg.threads];
+        unique_ptr<BenchConn> c(new BenchConn());
+        c->fd = fd;
+        const char* cap = cfg.compress ? PROTO_BINARY_LZ4_CAP : cfg.binary ? PROTO_BINARY_CAP : "TEXT";
+        NetMsg::encodeTo(c->out, 'B', 0, cap, false);
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c.get();
+        epoll_ctl(w.epfd, EPOLL_CTL_ADD, fd, &ev);
+        w.conns.push_back(std::move(c));
+        connected++;
+    }
+    if (connected == 0) return 1;
+
+    printf("[Bench] %d connection(s), %d thread(s), %s, %s frames%s, %d s\n", connected, cfg.threads,
+           cfg.rate > 0 ? "fixed rate" : "closed loop", cfg.binary ? "binary" : "text",
+           cfg.compress ? " (compressed)" : "", cfg.seconds);
+
+    double cpuStart = cpuSeconds();
+    uint64_t startNs = nowNs();
+    uint64_t endNs = startNs + (uint64_t)cfg.seconds * 1000000000ULL;
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread(runWorker, std::cref(cfg), workers[i].get(), startNs, endNs);
+    }
+
+    Histogram total;
+    Histogram byType[BENCH_TYPES];
+    uint64_t sent = 0, received = 0, errors = 0, dead = 0, bytesIn = 0, bytesOut = 0, compressed = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        BenchWorker& w = *workers[i];
+        w.thread.join();
+        for (int t = 0; t < BENCH_TYPES; t++) {
+            byType[t].merge(w.hist[t]);
+            total.merge(w.hist[t]);
+        }
+        sent += w.sent;
+        received += w.received;
+        errors += w.errors;
+        for (size_t j = 0; j < w.conns.size(); j++) {
+            BenchConn& c = *w.conns[j];
+            dead += c.dead ? 1 : 0;
+            bytesIn += c.bytesIn;
+            bytesOut += c.bytesOut;
+            compressed += c.compress ? 1 : 0;
+        }
+    }
+    double cpu = cpuSeconds() - cpuStart;
+
+    printf("%-5s %10s %10s %10s %10s %10s %10s %10s\n", "type", "count", "req/s",
+           "mean(us)", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    for (int t = 0; t < BENCH_TYPES; t++) {
+        if (byType[t].count() == 0) continue;
+        char name[2] = {REQ_TYPES[t], '\0'};
+        printRow(name, byType[t], cfg.seconds);
+    }
+    printRow("all", total, cfg.seconds);
+    printf("sent %llu, answered %llu, unanswered %llu, errors %llu, dropped connections %llu\n",
+           (unsigned long long)sent, (unsigned long long)received,
+           (unsigned long long)(sent > received + errors ? sent - received - errors : 0),
+           (unsigned long long)errors, (unsigned long long)dead);
+    if (cfg.compress && compressed < (uint64_t)connected) {
+        printf("[Bench] server refused compression on %llu connection(s)\n",
+               (unsigned long long)(connected - compressed));
+    }
+    double perReq = received > 0 ? (double)received : 1;
+    printf("client: sent %.1f MB (%.0f B/req), received %.1f MB (%.0f B/req), CPU %.2f s (%.1f us/req)\n",
+           bytesOut / 1e6, bytesOut / perReq, bytesIn / 1e6, bytesIn / perReq, cpu, cpu * 1e6 / perReq);
+
+    if (stats && fetchStats(cfg, statsAfter)) {
+        double mallocs = statValue(statsAfter, "chat_buffer_pool_mallocs_total") -
+                         statValue(statsIdle, "chat_buffer_pool_mallocs_total");
+        printf("server: RSS %.1f MB, buffer pool %.1f MB, pool mallocs %.0f (%.4f per answered request)\n",
+               statValue(statsAfter, "process_resident_memory_bytes") / (1024 * 1024),
+               statValue(statsAfter, "chat_buffer_pool_reserved_bytes") / (1024 * 1024),
+               mallocs, received > 0 ? mallocs / received : 0.0);
+        double serverCpu = statValue(statsAfter, "process_cpu_seconds_total") -
+                           statValue(statsIdle, "process_cpu_seconds_total");
+        double serverOut = statValue(statsAfter, "chat_sent_bytes_total") - statValue(statsIdle, "chat_sent_bytes_total");
+        double zIn = statValue(statsAfter, "chat_compress_input_bytes_total") -
+                     statValue(statsIdle, "chat_compress_input_bytes_total");
+        double zOut = statValue(statsAfter, "chat_compress_output_bytes_total") -
+                      statValue(statsIdle, "chat_compress_output_bytes_total");
+        printf("server: CPU %.2f s (%.1f us/req), sent %.1f MB (%.0f B/req)", serverCpu, serverCpu * 1e6 / perReq,
+               serverOut / 1e6, serverOut / perReq);
+        if (zIn > 0) printf(", compressed %.1f MB -> %.1f MB (%.1f%%)", zIn / 1e6, zOut / 1e6, zOut * 100 / zIn);
+        printf("\n");
+    }
+    for (size_t i = 0; i < idleFds.size(); i++) close(idleFds[i]);
+    return 0;
+}
@@ -0,0 +1,489 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "../common/NetMsg.h"
+#include "../common/MsgBuffer.h"
+#include "../common/BufferPool.h"
+
+using namespace std;
+
+// 协议编解码的微基准、分帧压力测试和模糊测试，不连服务器，改动 NetMsg/MsgBuffer/Lz4 之后用它同时验证正确性和速度
+//
+//   ./msgbench [-n 次数] [-s 大小,大小,...]
+//       微基准：各种负载大小下 encodeTo/encode/decodeView/decodeFrame/decode/compressTo/decompress 的 ns/op 和
+//       allocs/op（operator new 加内存池向 malloc 要内存的次数），以及 MsgBuffer 切分流水线包的吞吐量
+//   ./msgbench --split [-n 消息数] [--seed N]
+//       压力测试：随机消息（文本/二进制帧、带不带关联 ID、几个帧压缩成的 'Z' 帧）编码成一条流，按随机长度切开
+//       逐段喂给 MsgBuffer（模拟 recv 在任意位置截断），逐条核对解出的消息
+//   ./msgbench --fuzz [-n 次数] [--seed N]
+//       模糊测试：对合法的帧随机改字节、截断、插入、删除后交给 peekFrame/decodeView/decode/decompress/MsgBuffer，
+//       要求不崩溃、不越界、结果自洽。用 make SAN=1 编译（ASan + UBSan）才能发现越界读写
+// 出错时打印种子，用 --seed 复现。
+//
+// 有 clang 时也可以直接用 libFuzzer 跑同样的检查（入口在文件末尾）：
+//   clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DMSGBENCH_LIBFUZZER -I../common MsgBench.cpp
+
+#define BENCH_TARGET_BYTES (64 * 1024 * 1024) // 微基准默认每项处理的数据量，次数按负载大小折算
+#define SPLIT_MAX_CHUNK 70000                  // 压力测试每段最大长度，超过最大的内存池档
+#define FUZZ_MAX_PAYLOAD 2048
+
+static volatile uint64_t g_sink; // 让编译器不能把被测的调用优化掉
+
+// ---------- 模糊测试的检查（libFuzzer 入口和 --fuzz 共用） ----------
+
+// 对一段任意数据做所有解析，检查结果自洽。数据非法时返回 false 没关系，不能崩溃或越界
+static void fuzzOne(const char* data, size_t len) {
+    StrView input(data, len);
+
+    long frameLen = NetMsg::peekFrame(data, len);
+    if (frameLen > (long)len) abort();
+
+    NetMsgView v;
+    if (NetMsg::decodeView(input, v)) {
+        // 负载必须落在帧内
+        if (v.payload.len > len || v.payload.data < data || v.payload.data + v.payload.len > data + len) abort();
+        // 二进制帧：重新编码再解析，字段不变
+        if (len > 0 && (unsigned char)data[0] == BIN_MAGIC) {
+            string again;
+            NetMsg::encodeTo(again, v.type, v.targetId, v.payload, true, v.corrId);
+            NetMsgView w;
+            if (!NetMsg::decodeView(again, w) || w.type != v.type || w.targetId != v.targetId ||
+                w.corrId != v.corrId || w.payload != v.payload) {
+                abort();
+            }
+        }
+        if (v.type == MSG_COMPRESSED) {
+            string inflated;
+            if (NetMsg::decompress(v.payload, inflated)) {
+                NetMsg::forEachFrame(inflated, [](const NetMsgView& inner) { g_sink += inner.payload.len; });
+            }
+        }
+    }
+
+    NetMsg msg;
+    NetMsg::decodeFrame(data, len, msg);
+    NetMsg::decode(string(data, len), msg);
+
+    string inflated;
+    if (NetMsg::decompress(input, inflated)) g_sink += inflated.size();
+
+    // 整段当作流：逐帧切分直到没有完整帧或数据非法
+    MsgBuffer buffer;
+    buffer.append(data, len);
+    StrView frame;
+    size_t total = 0;
+    while (buffer.nextFrame(frame)) {
+        total += frame.len;
+        NetMsg::decodeView(frame, v);
+    }
+    if (total > len) abort();
+}
+
+#ifdef MSGBENCH_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    fuzzOne((const char*)data, size);
+    return 0;
+}
+
+#else
+
+// ---------- 分配计数：全局 operator new，加上内存池向 malloc 要内存的次数 ----------
+
+static uint64_t g_news = 0;
+
+void* operator new(size_t n) {
+    g_news++;
+    void* p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static uint64_t allocCount() {
+    PoolStats stats;
+    BufferPool::stats(stats);
+    return g_news + stats.mallocs;
+}
+
+static uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t nextRandom(uint32_t& s) {
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
+
+// ---------- 随机消息 ----------
+
+struct TestMsg {
+    char type;
+    int targetId;
+    uint32_t corrId;
+    string payload;
+};
+
+// 文本帧的负载不能有 \n；二进制帧可以是任意字节
+static TestMsg randomMsg(uint32_t& rng, bool binary, size_t maxPayload) {
+    static const char TYPES[] = "TNLSABJQPHIWUD";
+    TestMsg m;
+    m.type = TYPES[nextRandom(rng) % (sizeof(TYPES) - 1)];
+    m.targetId = (int)nextRandom(rng);
+    if (nextRandom(rng) % 4) m.targetId %= 100000;
+    m.corrId = nextRandom(rng) % 3 ? 0 : nextRandom(rng) | 1;
+    size_t len = nextRandom(rng) % 8 == 0 ? nextRandom(rng) % (maxPayload + 1) : nextRandom(rng) % 64;
+    m.payload.resize(len);
+    for (size_t i = 0; i < len; i++) {
+        char c = (char)nextRandom(rng);
+        if (!binary && c == '\n') c = ' ';
+        if (nextRandom(rng) % 4 == 0 && i > 0) c = m.payload[i - 1]; // 一部分重复，'Z' 才能压得动
+        m.payload[i] = c;
+    }
+    return m;
+}
+
+static void encodeMsg(string& out, const TestMsg& m, bool binary) {
+    NetMsg::encodeTo(out, m.type, m.targetId, m.payload, binary, m.corrId);
+}
+
+static bool sameMsg(const TestMsg& m, const NetMsgView& v) {
+    return m.type == v.type && m.targetId == v.targetId && m.corrId == v.corrId &&
+           StrView(m.payload) == v.payload;
+}
+
+// ---------- 微基准 ----------
+
+// JSON 风格的负载，压缩率接近真实的聊天消息
+static string jsonPayload(size_t n) {
+    static const char* WORDS[] = {"hello", "world", "meeting", "tomorrow", "lunch", "ok", "see", "you",
+                                  "thanks", "deploy", "done", "review", "please", "the", "build", "is", "green"};
+    uint32_t rng = 88172645u;
+    string out = "[";
+    while (out.size() < n) {
+        char head[96];
+        snprintf(head, sizeof(head), "{\"id\":%u,\"from\":%u,\"text\":\"", nextRandom(rng) % 1000000,
+                 100 + nextRandom(rng) % 900);
+        out += head;
+        int words = 3 + nextRandom(rng) % 10;
+        for (int i = 0; i < words; i++) {
+            if (i) out += ' ';
+            out += WORDS[nextRandom(rng) % (sizeof(WORDS) / sizeof(WORDS[0]))];
+        }
+        out += "\"},";
+    }
+    out.resize(n);
+    return out;
+}
+
+// 跑 iters 次 fn，打印每次的耗时、分配次数和按 bytes 折算的吞吐量
+template <typename F>
+static void measure(const char* name, size_t size, size_t bytes, long iters, F fn) {
+    fn(); // 预热：线程缓存、复用缓冲区的容量
+    uint64_t allocs = allocCount();
+    uint64_t start = nowNs();
+    for (long i = 0; i < iters; i++) fn();
+    uint64_t ns = nowNs() - start;
+    allocs = allocCount() - allocs;
+    double perOp = (double)ns / iters;
+    printf("%-22s %8zu %10.1f %10.3f %10.1f\n", name, size, perOp, (double)allocs / iters,
+           bytes ? bytes / perOp * 1e9 / (1024 * 1024) : 0.0);
+}
+
+static void runBench(long itersOverride, const vector<size_t>& sizes) {
+    printf("%-22s %8s %10s %10s %10s\n", "op", "payload", "ns/op", "allocs/op", "MB/s");
+    for (size_t si = 0; si < sizes.size(); si++) {
+        size_t size = sizes[si];
+        long iters = itersOverride > 0 ? itersOverride : (long)max((size_t)20000, BENCH_TARGET_BYTES / (size + 64));
+        string payload = jsonPayload(size);
+        for (size_t i = 0; i < payload.size(); i++) {
+            if (payload[i] == '\n') payload[i] = ' ';
+        }
+
+        string text, binary, out;
+        NetMsg::encodeTo(text, 'S', 12345, payload, false, 42);
+        NetMsg::encodeTo(binary, 'S', 12345, payload, true, 42);
+        NetMsg msg;
+
+        measure("encodeTo text", size, text.size(), iters, [&]() {
+            out.clear();
+            NetMsg::encodeTo(out, 'S', 12345, payload, false, 42);
+            g_sink += out.size();
+        });
+        measure("encodeTo binary", size, binary.size(), iters, [&]() {
+            out.clear();
+            NetMsg::encodeTo(out, 'S', 12345, payload, true, 42);
+            g_sink += out.size();
+        });
+        NetMsg owned('S', payload, 12345);
+        measure("encode (new string)", size, text.size(), iters, [&]() { g_sink += owned.encode().size(); });
+        measure("decodeView text", size, text.size(), iters, [&]() {
+            NetMsgView v;
+            g_sink += NetMsg::decodeView(text, v) ? v.payload.len : 0;
+        });
+        measure("decodeView binary", size, binary.size(), iters, [&]() {
+            NetMsgView v;
+            g_sink += NetMsg::decodeView(binary, v) ? v.payload.len : 0;
+        });
+        measure("decodeFrame binary", size, binary.size(), iters, [&]() {
+            g_sink += NetMsg::decodeFrame(binary.data(), binary.size(), msg) ? msg.getContent().size() : 0;
+        });
+        string textNoNl = text.substr(0, text.size() - 1);
+        measure("decode text", size, text.size(), iters, [&]() {
+            g_sink += NetMsg::decode(textNoNl, msg) ? msg.getContent().size() : 0;
+        });
+
+        // 分帧：一次 recv 收到很多个流水线请求，切出每一帧并解析成视图（ns/op 是每帧）
+        const size_t batch = max((size_t)1, (size_t)65536 / binary.size());
+        string stream;
+        for (size_t i = 0; i < batch; i++) stream += (i % 2) ? binary : text;
+        MsgBuffer buffer;
+        long splitIters = max(1L, iters / (long)batch);
+        uint64_t allocs = allocCount();
+        uint64_t start = nowNs();
+        for (long it = 0; it < splitIters; it++) {
+            for (size_t off = 0; off < stream.size(); off += 4096) {
+                buffer.append(stream.data() + off, min((size_t)4096, stream.size() - off));
+                StrView frame;
+                while (buffer.nextFrame(frame)) {
+                    NetMsgView v;
+                    g_sink += NetMsg::decodeView(frame, v) ? v.payload.len : 0;
+                }
+            }
+        }
+        double perFrame = (double)(nowNs() - start) / (splitIters * batch);
+        printf("%-22s %8zu %10.1f %10.3f %10.1f\n", "MsgBuffer split", size, perFrame,
+               (double)(allocCount() - allocs) / (splitIters * batch),
+               stream.size() / (double)batch / perFrame * 1e9 / (1024 * 1024));
+
+        if (size >= 64) {
+            string z;
+            measure("compressTo", size, binary.size(), max(1L, iters / 4), [&]() {
+                z.clear();
+                g_sink += NetMsg::compressTo(z, binary);
+            });
+            NetMsgView zv;
+            NetMsg::decodeView(z, zv);
+            measure("decompress", size, binary.size(), max(1L, iters / 4), [&]() {
+                g_sink += NetMsg::decompress(zv.payload, out) ? out.size() : 0;
+            });
+            printf("%-22s %8zu %9.1f%%\n", "  compressed size", size, 100.0 * z.size() / binary.size());
+        }
+    }
+}
+
+// ---------- 分帧压力测试 ----------
+
+static bool runSplit(long count, uint32_t seed) {
+    uint32_t rng = seed;
+    vector<TestMsg> expected;
+    string stream;
+    string batch;
+    expected.reserve(count);
+
+    // 编码：文本帧、二进制帧，偶尔把连续几个二进制帧压缩成一个 'Z' 帧
+    while ((long)expected.size() < count) {
+        uint32_t kind = nextRandom(rng) % 10;
+        if (kind < 4) {
+            expected.push_back(randomMsg(rng, false, 4096));
+            encodeMsg(stream, expected.back(), false);
+        } else if (kind < 9) {
+            expected.push_back(randomMsg(rng, true, 100000));
+            encodeMsg(stream, expected.back(), true);
+        } else {
+            batch.clear();
+            int n = 1 + nextRandom(rng) % 8;
+            for (int i = 0; i < n; i++) {
+                expected.push_back(randomMsg(rng, true, 4096));
+                encodeMsg(batch, expected.back(), true);
+            }
+            if (!NetMsg::compressTo(stream, batch)) stream += batch; // 压不动时照原样发
+        }
+    }
+
+    // 按随机长度切段喂给 MsgBuffer，每段之后取出所有完整的帧
+    MsgBuffer buffer;
+    string inflated;
+    size_t next = 0;
+    size_t off = 0;
+    bool ok = true;
+    uint64_t start = nowNs();
+    auto check = [&](const NetMsgView& v) {
+        if (next >= expected.size() || !sameMsg(expected[next], v)) {
+            if (ok) fprintf(stderr, "[Split] message %zu mismatch (type %c)\n", next, v.type);
+            ok = false;
+        }
+        next++;
+    };
+    while (off < stream.size() && ok) {
+        size_t chunk;
+        switch (nextRandom(rng) % 4) {
+            case 0: chunk = 1 + nextRandom(rng) % 16; break;
+            case 1: chunk = 1 + nextRandom(rng) % 1500; break;
+            case 2: chunk = 1 + nextRandom(rng) % 16384; break;
+            default: chunk = 1 + nextRandom(rng) % SPLIT_MAX_CHUNK; break;
+        }
+        chunk = min(chunk, stream.size() - off);
+        buffer.append(stream.data() + off, chunk);
+        off += chunk;
+
+        StrView frame;
+        while (ok && buffer.nextFrame(frame)) {
+            NetMsgView v;
+            if (!NetMsg::decodeView(frame, v)) {
+                fprintf(stderr, "[Split] frame at message %zu does not decode\n", next);
+                ok = false;
+            } else if (v.type != MSG_COMPRESSED) {
+                check(v);
+            } else if (!NetMsg::decompress(v.payload, inflated) || !NetMsg::forEachFrame(inflated, check)) {
+                fprintf(stderr, "[Split] compressed frame at message %zu is corrupt\n", next);
+                ok = false;
+            }
+        }
+        if (buffer.bad()) {
+            fprintf(stderr, "[Split] framing lost at message %zu\n", next);
+            ok = false;
+        }
+        buffer.release(); // 和服务器一样，读空了就把缓冲区还回去
+    }
+    if (ok && (next != expected.size() || buffer.readable() != 0)) {
+        fprintf(stderr, "[Split] decoded %zu of %zu message(s), %zu byte(s) left\n", next, expected.size(),
+                buffer.readable());
+        ok = false;
+    }
+    double sec = (nowNs() - start) / 1e9;
+    printf("[Split] seed %u: %zu message(s), %.1f MB, %.0f MB/s, %s\n", seed, expected.size(), stream.size() / 1e6,
+           stream.size() / 1e6 / sec, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// ---------- 模糊测试 ----------
+
+// 一个变异后的输入：从合法的帧出发，改字节、截断、插入、删除，或把长度字段改成边界值
+static void mutate(uint32_t& rng, string& data) {
+    int rounds = 1 + nextRandom(rng) % 4;
+    for (int r = 0; r < rounds && !data.empty(); r++) {
+        size_t pos = nextRandom(rng) % data.size();
+        switch (nextRandom(rng) % 6) {
+            case 0: data[pos] ^= (char)(1 << (nextRandom(rng) % 8)); break;
+            case 1: data[pos] = (char)nextRandom(rng); break;
+            case 2: data.resize(pos); break;
+            case 3: data.insert(pos, 1 + nextRandom(rng) % 8, (char)nextRandom(rng)); break;
+            case 4: data.erase(pos, 1 + nextRandom(rng) % 8); break;
+            default: {
+                // 改长度字段（二进制帧头的 8..11 字节、'Z' 负载的原始长度）为边界值
+                static const uint32_t EDGES[] = {0, 1, 3, 4, 0xFFFFFFFFu, MAX_PAYLOAD_LEN, MAX_PAYLOAD_LEN + 1};
+                uint32_t v = EDGES[nextRandom(rng) % (sizeof(EDGES) / sizeof(EDGES[0]))];
+                size_t at = nextRandom(rng) % 2 ? 8 : BIN_HEADER_LEN;
+                if (data.size() >= at + 4) {
+                    for (int i = 0; i < 4; i++) data[at + i] = (char)(v >> (24 - 8 * i));
+                }
+                break;
+            }
+        }
+    }
+}
+
+static bool runFuzz(long count, uint32_t seed) {
+    uint32_t rng = seed;
+    string data;
+    string batch;
+    uint64_t start = nowNs();
+    for (long i = 0; i < count; i++) {
+        data.clear();
+        switch (nextRandom(rng) % 4) {
+            case 0: encodeMsg(data, randomMsg(rng, false, FUZZ_MAX_PAYLOAD), false); break;
+            case 1: encodeMsg(data, randomMsg(rng, true, FUZZ_MAX_PAYLOAD), true); break;
+            case 2: {
+                batch.clear();
+                int n = 1 + nextRandom(rng) % 4;
+                for (int k = 0; k < n; k++) encodeMsg(batch, randomMsg(rng, true, FUZZ_MAX_PAYLOAD), true);
+                if (!NetMsg::compressTo(data, batch)) data = batch;
+                break;
+            }
+            default: {
+                size_t n = nextRandom(rng) % 64;
+                for (size_t k = 0; k < n; k++) data += (char)nextRandom(rng);
+                break;
+            }
+        }
+        if (i % 8 != 0) mutate(rng, data); // 留一部分合法输入，保证正常路径也被覆盖
+        fuzzOne(data.data(), data.size());
+    }
+    printf("[Fuzz] seed %u: %ld input(s) in %.1f s, ok\n", seed, count, (nowNs() - start) / 1e9);
+    return true;
+}
+
+static void usage(const char* prog) {
+    cerr << "Usage: " << prog << " [-n iterations] [-s size,size,...]" << endl
+         << "       " << prog << " --split [-n messages] [--seed N]" << endl
+         << "       " << prog << " --fuzz [-n inputs] [--seed N]" << endl
+         << "  default: encode/decode ns/op and allocs/op per payload size;" << endl
+         << "  --split: stream random pipelined frames cut at random recv boundaries and verify every message;" << endl
+         << "  --fuzz: feed mutated frames to every parser (build with make SAN=1)." << endl;
+}
+
+static bool parseSizes(const char* s, vector<size_t>& sizes) {
+    sizes.clear();
+    while (*s) {
+        char* end;
+        unsigned long v = strtoul(s, &end, 10);
+        if (end == s || v > MAX_PAYLOAD_LEN / 2) return false;
+        sizes.push_back(v);
+        if (*end != ',' && *end != '\0') return false;
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return !sizes.empty();
+}
+
+int main(int argc, char* argv[]) {
+    enum { MODE_BENCH, MODE_SPLIT, MODE_FUZZ } mode = MODE_BENCH;
+    long count = 0;
+    uint32_t seed = (uint32_t)time(NULL) | 1;
+    vector<size_t> sizes;
+    sizes.push_back(0);
+    sizes.push_back(32);
+    sizes.push_back(256);
+    sizes.push_back(4096);
+    sizes.push_back(65536);
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--split") mode = MODE_SPLIT;
+        else if (arg == "--fuzz") mode = MODE_FUZZ;
+        else if (arg == "-n" && hasValue) count = atol(argv[++i]);
+        else if (arg == "--seed" && hasValue) seed = (uint32_t)strtoul(argv[++i], NULL, 10) | 1;
+        else if (arg == "-s" && hasValue) {
+            if (!parseSizes(argv[++i], sizes)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    switch (mode) {
+        case MODE_SPLIT:
+            return runSplit(count > 0 ? count : 200000, seed) ? 0 : 1;
+        case MODE_FUZZ:
+            return runFuzz(count > 0 ? count : 1000000, seed) ? 0 : 1;
+        default:
+            runBench(count, sizes);
+            return 0;
+    }
+}
+
+#endif
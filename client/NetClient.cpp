@@ -0,0 +1,569 @@
+#include "NetClient.h"
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include "../common/MsgBuffer.h"
+
+using namespace std;
+
+NetClient::NetClient()
+    : _sock(-1), _connected(false), _binary(false), _wantCompress(false), _compress(false), _clientId(0), _corrIds(false),
+      _reconnect(false), _backoffMinMs(RECONNECT_MIN_MS), _backoffMaxMs(RECONNECT_MAX_MS), _port(0), _closing(false),
+      _resuming(false), _backoffMs(RECONNECT_MIN_MS), _jitter((uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)this),
+      _resumeRetry(-1), _nextId(1), _watching(false), _listRemaining(0), _listCorr(0) {
+    if (_jitter == 0) _jitter = 1;
+}
+
+NetClient::~NetClient() {
+    close();
+}
+
+// 服务器只对这些请求应答
+bool NetClient::expectsReply(char type) {
+    return strchr("TNLBJQWHI", type) != NULL && type != '\0';
+}
+
+void NetClient::setReconnect(bool on, int minMs, int maxMs) {
+    _reconnect = on;
+    _backoffMinMs = max(minMs, 1);
+    _backoffMaxMs = max(maxMs, _backoffMinMs);
+}
+
+// 建立 TCP 连接，失败时返回 -1，errno 为原因
+int NetClient::openSocket(const std::string& ip, int port) {
+    sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip.c_str(), &serverAddr.sin_addr) <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    if (::connect(sock, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+        int err = errno;
+        ::close(sock);
+        errno = err;
+        return -1;
+    }
+    // 流水线请求一个接一个地发，不等 Nagle 合并
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+bool NetClient::connect(const std::string& ip, int port) {
+    if (_connected) return true;
+    close(); // 回收上一次连接（或者正在重连）的接收线程和套接字
+
+    int sock = openSocket(ip, port);
+    if (sock < 0) return false;
+    _ip = ip;
+    _port = port;
+    _closing = false;
+    _backoffMs = _backoffMinMs;
+    attach(sock);
+    _recvThread = std::thread(&NetClient::recvLoop, this);
+
+    negotiate(_wantCompress ? PROTO_BINARY_LZ4_CAP : PROTO_BINARY_CAP);
+    return true;
+}
+
+// 换上新连接，协商状态从头开始。close() 已经调用时关掉它并返回 false
+bool NetClient::attach(int sock) {
+    lock_guard<mutex> sendLock(_sendMtx);
+    lock_guard<mutex> sockLock(_sockMtx);
+    if (_closing) {
+        ::close(sock);
+        return false;
+    }
+    _sock = sock;
+    _binary = false;
+    _compress = false;
+    _clientId = 0;
+    _corrIds = false;
+    _listRemaining = 0;
+    _connected = true;
+    return true;
+}
+
+// 协商二进制帧：应答前的请求仍用文本帧，老服务器不应答则一直用文本
+// 应答带回了关联 ID 说明服务器支持，之后不再记录发送顺序
+// 要求压缩时服务器回复空内容，说明它不认识 "BIN1,LZ4"，再单独协商一次二进制帧
+// 重连后的协商完成时接着恢复会话
+void NetClient::negotiate(const char* cap) {
+    bool lz4 = strcmp(cap, PROTO_BINARY_LZ4_CAP) == 0;
+    submit('B', cap, 0, [this, lz4](bool ok, const NetMsg& reply) {
+        if (!ok) return;
+        _clientId = reply.getTargetId();
+        if (reply.getCorrId() != 0) {
+            _corrIds = true;
+            lock_guard<mutex> lock(_pendMtx);
+            _order.clear();
+        }
+        const std::string& accepted = reply.getContent();
+        if (lz4 && accepted.empty()) {
+            negotiate(PROTO_BINARY_CAP);
+            return;
+        }
+        _binary = (accepted == PROTO_BINARY_CAP || accepted == PROTO_BINARY_LZ4_CAP);
+        _compress = (accepted == PROTO_BINARY_LZ4_CAP);
+        if (_resuming) resumeSession(0);
+    }, true);
+}
+
+void NetClient::close() {
+    // 主动退出：服务器结束绑定的会话（没有会话时忽略），之后发给这个 ID 的消息不再离线保存
+    if (_connected && !_closing) submit('D', "", 0, ReplyCallback(), true);
+    {
+        lock_guard<mutex> lock(_waitMtx);
+        _closing = true;
+    }
+    _waitCv.notify_all(); // 打断重连的退避等待
+    if (_recvThread.joinable() && std::this_thread::get_id() == _recvThread.get_id()) {
+        // 在回调里调用：只能关闭读写通道，接收线程返回后由下一次 close/析构回收
+        shutdownSock();
+        return;
+    }
+    if (_recvThread.joinable()) {
+        // 强制关闭读写通道，阻塞的 recv 立即返回
+        shutdownSock();
+        _recvThread.join();
+    }
+    if (_sock >= 0) {
+        ::close(_sock);
+        _sock = -1;
+    }
+}
+
+// 接收线程可能正在换连接，shutdown 和换连接互斥
+void NetClient::shutdownSock() {
+    lock_guard<mutex> lock(_sockMtx);
+    if (_sock >= 0) shutdown(_sock, SHUT_RDWR);
+}
+
+size_t NetClient::inflight() {
+    lock_guard<mutex> lock(_pendMtx);
+    return _pending.size();
+}
+
+// 写完整个数据包（send 可能只写一部分）
+bool NetClient::sendAll(const std::string& packet) {
+    size_t off = 0;
+    while (off < packet.size()) {
+        ssize_t n = send(_sock, packet.data() + off, packet.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false; // 连接已断开，由接收线程结束未完成的请求
+        off += n;
+    }
+    return true;
+}
+
+uint32_t NetClient::request(char type, const std::string& data, int target, ReplyCallback cb) {
+    return submit(type, data, target, cb, false);
+}
+
+// internal 为 true 是库自己发的握手和恢复订阅的请求：重连期间照样立即发送，断开后不重发
+uint32_t NetClient::submit(char type, const std::string& data, int target, ReplyCallback cb, bool internal) {
+    bool reply = expectsReply(type);
+    uint32_t id;
+    {
+        lock_guard<mutex> sendLock(_sendMtx);
+        bool hold = _resuming && !internal; // 重连中：先积压，恢复会话之后按顺序发
+        if (!_connected && !hold) return 0;
+        if (hold && _held.size() + inflight() >= RECONNECT_MAX_HELD) return 0;
+        id = nextIdLocked();
+        if (!internal) trackLocked(type, data);
+        if (reply) registerLocked(id, type, data, target, cb, internal, !hold); // 先登记再发送，应答不会比登记早到
+
+        bool sent = !hold && sendLocked(type, data, target, id);
+        if (!sent && !reply && _reconnect && !internal) {
+            // 积压的，或者连接已断开、没写出去的：重连后再发，那时再调用回调
+            HeldReq held;
+            held.id = id;
+            held.type = type;
+            held.data = data;
+            held.target = target;
+            held.cb = cb;
+            _held.push_back(std::move(held));
+            return id;
+        }
+    }
+    if (!reply && cb) cb(true, NetMsg(type));
+    return id;
+}
+
+// 调用方持有 _sendMtx
+uint32_t NetClient::nextIdLocked() {
+    uint32_t id = _nextId++;
+    if (_nextId == 0) _nextId = 1; // 0 表示没有关联 ID
+    return id;
+}
+
+// 登记等待应答的请求。开启自动重连时记下内容以便重发。调用方持有 _sendMtx
+void NetClient::registerLocked(uint32_t id, char type, const std::string& data, int target, ReplyCallback cb,
+                               bool internal, bool sent) {
+    PendingReq req;
+    req.type = type;
+    req.cb = cb;
+    req.replay = _reconnect && !internal;
+    if (req.replay) {
+        req.data = data;
+        req.target = target;
+    }
+    lock_guard<mutex> pendLock(_pendMtx);
+    _pending[id] = std::move(req);
+    if (sent && !_corrIds) _order.push_back(id);
+}
+
+// 编码（够大且服务器同意时压缩）并写进套接字，连接已断开时返回 false。调用方持有 _sendMtx
+bool NetClient::sendLocked(char type, const std::string& data, int target, uint32_t id) {
+    _outBuf.clear();
+    NetMsg::encodeTo(_outBuf, type, target, data, _binary, id);
+    const std::string* packet = &_outBuf;
+    if (_compress && _outBuf.size() >= COMPRESS_MIN_DEFAULT) {
+        _zBuf.clear();
+        if (NetMsg::compressTo(_zBuf, _outBuf)) packet = &_zBuf;
+    }
+    return sendAll(*packet);
+}
+
+// 记下主题和在线列表的订阅，重连后服务器那边已经清掉了，要重新订阅。调用方持有 _sendMtx
+void NetClient::trackLocked(char type, const std::string& data) {
+    if (type == 'J' || type == 'Q') {
+        std::vector<std::string>::iterator it = std::find(_topics.begin(), _topics.end(), data);
+        if (type == 'J' && it == _topics.end()) _topics.push_back(data);
+        if (type == 'Q' && it != _topics.end()) _topics.erase(it);
+    } else if (type == 'W') {
+        _watching = (data != "0");
+    }
+}
+
+std::future<NetMsg> NetClient::request(char type, const std::string& data, int target) {
+    std::shared_ptr<std::promise<NetMsg> > promise = std::make_shared<std::promise<NetMsg> >();
+    std::future<NetMsg> result = promise->get_future();
+    uint32_t id = request(type, data, target, [promise](bool ok, const NetMsg& reply) {
+        if (ok) {
+            promise->set_value(reply);
+        } else {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error("connection closed")));
+        }
+    });
+    if (id == 0) {
+        promise->set_exception(std::make_exception_ptr(std::runtime_error("not connected")));
+    }
+    return result;
+}
+
+// 接收线程：切帧后分发给等待的请求或 MessageHandler，连接断开后按需重连
+void NetClient::recvLoop() {
+    MsgBuffer buffer;
+    std::string inflated; // 解压出的帧
+    while (true) {
+        readFrames(buffer, inflated);
+
+        bool again;
+        {
+            lock_guard<mutex> sendLock(_sendMtx); // 之后的 request 直接失败，或者积压到重连之后
+            _connected = false;
+            again = _reconnect && !_closing;
+            _resuming = again;
+        }
+        if (!again) break;
+        dropConnection();
+        if (_onReconnect) _onReconnect(false);
+        buffer.clear();
+        buffer.release();
+        if (!reconnect()) break;
+    }
+
+    {
+        lock_guard<mutex> sendLock(_sendMtx);
+        _resuming = false;
+    }
+    failAll();
+    if (_onClose) _onClose();
+}
+
+// 读到连接断开或收到非法数据为止。安排了恢复会话的重试时边读边计时，到点在这里发出
+void NetClient::readFrames(MsgBuffer& buffer, std::string& inflated) {
+    bool bad = false;
+    while (!bad) {
+        if (_resumeRetry >= 0) {
+            int ms = (int)chrono::duration_cast<chrono::milliseconds>(_resumeAt - chrono::steady_clock::now()).count();
+            struct pollfd pfd = {_sock, POLLIN, 0};
+            int r = ms > 0 ? poll(&pfd, 1, ms) : 0;
+            if (r < 0 && errno == EINTR) continue;
+            if (r == 0) {
+                int tries = _resumeRetry;
+                _resumeRetry = -1;
+                resumeSession(tries);
+                continue;
+            }
+        }
+        ssize_t n = buffer.readFd(_sock);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        StrView frame;
+        while (!bad && buffer.nextFrame(frame)) {
+            NetMsgView msg;
+            if (!NetMsg::decodeView(frame, msg)) continue;
+            if (msg.type != MSG_COMPRESSED) {
+                dispatch(msg);
+            } else if (!NetMsg::decompress(msg.payload, inflated) ||
+                       !NetMsg::forEachFrame(inflated, [this](const NetMsgView& m) { dispatch(m); })) {
+                bad = true; // 解压失败，之后的数据也不可信
+            }
+        }
+        if (buffer.bad()) bad = true; // 非法数据，帧边界已无法恢复
+    }
+}
+
+// 意外断开、准备重连：关掉旧连接，结束不重发的请求（握手和恢复订阅的，新连接上会重新发）
+void NetClient::dropConnection() {
+    {
+        lock_guard<mutex> sendLock(_sendMtx);
+        lock_guard<mutex> sockLock(_sockMtx);
+        ::close(_sock);
+        _sock = -1;
+    }
+    _listRemaining = 0; // 合并到一半的列表作废，请求本身会重发
+    _resumeRetry = -1;  // 新连接协商完会从头恢复会话
+
+    std::vector<ReplyCallback> dropped;
+    {
+        lock_guard<mutex> lock(_pendMtx);
+        for (std::unordered_map<uint32_t, PendingReq>::iterator it = _pending.begin(); it != _pending.end();) {
+            if (it->second.replay) {
+                ++it;
+                continue;
+            }
+            dropped.push_back(std::move(it->second.cb));
+            it = _pending.erase(it);
+        }
+        _order.clear(); // 重发时按新的发送顺序重建
+    }
+    NetMsg empty;
+    for (size_t i = 0; i < dropped.size(); i++) {
+        if (dropped[i]) dropped[i](false, empty);
+    }
+}
+
+// 带抖动的指数退避，直到连上或者 close()。连上后发出协商，之后的握手在应答的回调里继续
+bool NetClient::reconnect() {
+    while (true) {
+        // 在上限的一半到全部之间随机，服务器重启后大量客户端不会在同一时刻涌进来
+        _jitter ^= _jitter << 13;
+        _jitter ^= _jitter >> 17;
+        _jitter ^= _jitter << 5;
+        int delay = _backoffMs / 2 + (int)(_jitter % (uint32_t)(_backoffMs - _backoffMs / 2 + 1));
+        _backoffMs = min(_backoffMs * 2, _backoffMaxMs); // 连上后马上又断也继续翻倍，恢复成功才回到初值
+        if (!waitOrClosed(delay)) return false;
+
+        int sock = openSocket(_ip, _port);
+        if (sock < 0) continue;
+        if (!attach(sock)) return false;
+        negotiate(_wantCompress ? PROTO_BINARY_LZ4_CAP : PROTO_BINARY_CAP);
+        return true;
+    }
+}
+
+// 等待 ms 毫秒，期间调用了 close() 时返回 false
+bool NetClient::waitOrClosed(int ms) {
+    std::unique_lock<mutex> lock(_waitMtx);
+    return !_waitCv.wait_for(lock, std::chrono::milliseconds(ms), [this]() { return _closing.load(); });
+}
+
+// 用断开前的令牌恢复会话。会话还挂在旧连接上（服务器还没发现它断开）时服务器会断开旧连接并让我们稍后重试。
+// 回调在接收线程里，不能在里面等：只记下重试的时间，由 readFrames 到点再发，期间照常收帧、回应心跳
+void NetClient::resumeSession(int tries) {
+    if (_sessionToken.empty()) {
+        finishResume();
+        return;
+    }
+    submit('I', _sessionToken, 0, [this, tries](bool ok, const NetMsg& reply) {
+        if (!ok) return; // 又断开了，下一次重连时再恢复
+        if (reply.getTargetId() <= 0) {
+            if (reply.getContent().find(SESSION_RETRY_HINT) != std::string::npos && tries < RESUME_RETRIES) {
+                _resumeRetry = tries + 1;
+                _resumeAt = chrono::steady_clock::now() + chrono::milliseconds(_backoffMinMs << tries);
+                return;
+            }
+            _sessionToken.clear(); // 会话已经不存在：用新分配的 ID 继续
+        }
+        finishResume();
+    }, true);
+}
+
+// 重新订阅，然后按原来的顺序重发没收到应答的请求和积压的请求，之后的请求照常发送
+void NetClient::finishResume() {
+    std::deque<HeldReq> flushed;
+    {
+        lock_guard<mutex> sendLock(_sendMtx);
+        if (!_connected || _closing) return; // 恢复途中又断开了
+
+        for (size_t i = 0; i < _topics.size(); i++) {
+            uint32_t id = nextIdLocked();
+            registerLocked(id, 'J', _topics[i], 0, ReplyCallback(), true, true);
+            sendLocked('J', _topics[i], 0, id);
+        }
+        if (_watching) {
+            uint32_t id = nextIdLocked();
+            registerLocked(id, 'W', "1", 0, ReplyCallback(), true, true);
+            sendLocked('W', "1", 0, id);
+        }
+
+        // 等待应答的请求和积压的请求合在一起按请求 ID（即原来的顺序）重发。只有本线程会取出 _pending 里的请求，
+        // 登记新请求需要 _sendMtx，所以下面的指针一直有效
+        struct Replay {
+            uint32_t id;
+            char type;
+            const std::string* data;
+            int target;
+        };
+        std::vector<Replay> replays;
+        {
+            lock_guard<mutex> pendLock(_pendMtx);
+            for (std::unordered_map<uint32_t, PendingReq>::iterator it = _pending.begin(); it != _pending.end(); ++it) {
+                if (!it->second.replay) continue;
+                Replay r = {it->first, it->second.type, &it->second.data, it->second.target};
+                replays.push_back(r);
+            }
+        }
+        size_t replied = replays.size();
+        for (size_t i = 0; i < _held.size(); i++) {
+            Replay r = {_held[i].id, _held[i].type, &_held[i].data, _held[i].target};
+            replays.push_back(r);
+        }
+        std::sort(replays.begin(), replays.end(), [](const Replay& a, const Replay& b) { return a.id < b.id; });
+        if (!_corrIds && replied > 0) {
+            lock_guard<mutex> pendLock(_pendMtx);
+            for (size_t i = 0; i < replays.size(); i++) {
+                if (expectsReply(replays[i].type)) _order.push_back(replays[i].id);
+            }
+        }
+        for (size_t i = 0; i < replays.size(); i++) {
+            sendLocked(replays[i].type, *replays[i].data, replays[i].target, replays[i].id);
+        }
+
+        flushed.swap(_held);
+        _resuming = false;
+        _backoffMs = _backoffMinMs;
+    }
+    for (size_t i = 0; i < flushed.size(); i++) {
+        if (flushed[i].cb) flushed[i].cb(true, NetMsg(flushed[i].type));
+    }
+    if (_onReconnect) _onReconnect(true);
+}
+
+void NetClient::dispatch(const NetMsgView& msg) {
+    if (msg.type == 'H' && msg.payload == StrView(HEARTBEAT_PING)) {
+        replyPing();
+        return;
+    }
+
+    if (msg.type == 'L' && _listRemaining > 0) {
+        // 列表的后续行
+        _listText += '\n';
+        _listText.append(msg.payload.data, msg.payload.len);
+        if (--_listRemaining == 0) {
+            NetMsg list('L', _listText, 0);
+            list.setCorrId(_listCorr);
+            complete(list);
+        }
+        return;
+    }
+
+    if (!expectsReply(msg.type)) {
+        // 服务器主动推送
+        if (_onMessage) _onMessage(NetMsg(msg));
+        return;
+    }
+
+    if (msg.type == 'I' && msg.targetId > 0) {
+        // 绑定了会话，之后用会话 ID；记下令牌，重连后用它恢复
+        _clientId = msg.targetId;
+        _sessionToken.assign(msg.payload.data, msg.payload.len);
+    }
+
+    if (msg.type == 'L' && msg.targetId > 0) {
+        // 标题帧，targetId 为后面的行数
+        _listText.assign(msg.payload.data, msg.payload.len);
+        _listRemaining = msg.targetId;
+        _listCorr = msg.corrId;
+        return;
+    }
+    complete(NetMsg(msg));
+}
+
+// 服务器的心跳：回一个 pong。有线程正在发送时不等它（可能正被服务器背压），
+// 正在写的请求本身就让服务器知道连接还活着
+void NetClient::replyPing() {
+    std::unique_lock<mutex> sendLock(_sendMtx, std::try_to_lock);
+    if (!sendLock.owns_lock() || !_connected) return;
+    _outBuf.clear();
+    NetMsg::encodeTo(_outBuf, 'H', 0, HEARTBEAT_PONG, _binary);
+    sendAll(_outBuf);
+}
+
+// 按关联 ID 取出等待的请求；应答不带 ID 时取最早发出的请求。调用方持有 _pendMtx
+bool NetClient::takePending(uint32_t corrId, PendingReq& req) {
+    if (corrId == 0) {
+        // 跳过已经按 ID 完成的请求
+        while (!_order.empty() && _pending.find(_order.front()) == _pending.end()) _order.pop_front();
+        if (_order.empty()) return false;
+        corrId = _order.front();
+        _order.pop_front();
+    }
+    std::unordered_map<uint32_t, PendingReq>::iterator it = _pending.find(corrId);
+    if (it == _pending.end()) return false;
+    req = std::move(it->second);
+    _pending.erase(it);
+    return true;
+}
+
+// 应答交给对应的请求
+void NetClient::complete(const NetMsg& reply) {
+    PendingReq req;
+    bool found;
+    {
+        lock_guard<mutex> lock(_pendMtx);
+        found = takePending(reply.getCorrId(), req);
+    }
+    if (found) {
+        if (req.cb) req.cb(true, reply);
+    } else if (_onMessage) {
+        _onMessage(reply); // 没有对应的请求（比如老服务器的列表行），当作推送
+    }
+}
+
+void NetClient::failAll() {
+    std::unordered_map<uint32_t, PendingReq> failed;
+    std::deque<HeldReq> held;
+    {
+        lock_guard<mutex> sendLock(_sendMtx);
+        held.swap(_held);
+    }
+    {
+        lock_guard<mutex> lock(_pendMtx);
+        failed.swap(_pending);
+        _order.clear();
+    }
+    NetMsg empty;
+    for (std::unordered_map<uint32_t, PendingReq>::iterator it = failed.begin(); it != failed.end(); ++it) {
+        if (it->second.cb) it->second.cb(false, empty);
+    }
+    for (size_t i = 0; i < held.size(); i++) {
+        if (held[i].cb) held[i].cb(false, empty);
+    }
+}
@@ -0,0 +1,192 @@
+#ifndef NET_CLIENT_H
+#define NET_CLIENT_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <stdint.h>
+#include "../common/NetMsg.h"
+
+#define RECONNECT_MIN_MS 100        // 第一次重连前的等待（毫秒），之后每次翻倍
+#define RECONNECT_MAX_MS 10000      // 重连等待的上限
+#define RECONNECT_MAX_HELD 10000    // 重连期间最多积压的请求，超过后 request 直接失败
+#define RESUME_RETRIES 5            // 会话还挂在旧连接上时重试恢复的次数
+#define SESSION_RETRY_HINT "retry later" // 服务器可以重试的会话错误里带的字样
+
+class MsgBuffer;
+
+// 非交互的客户端库：只负责连接、收发和请求/应答匹配，没有任何 UI 依赖，可以嵌入其他程序
+//
+// 请求可以流水线发送：不必等上一个应答就能继续发，同一个连接上可以有任意多个未完成的请求。
+// 每个请求有一个递增的请求 ID，作为关联 ID 随请求发出，服务器在应答里带回，应答可以乱序到达。
+// 老服务器不带回关联 ID（协商 'B' 时就能看出来），这时按发送顺序把应答交给最早的请求。
+//
+// 有应答的请求：T N L B J Q W H I。L 的应答是标题帧（targetId 为行数）加每个在线客户端一帧，
+// 库会把它们合并成一条消息，内容按行用 \n 连接；L 带 "afterId:limit" 时只返回一页。
+// W 订阅在线列表的增量，之后的上线/下线以 'U' 推送，和其他推送一样交给 MessageHandler。
+// H 是心跳，应答为 "pong"；服务器发来的心跳由库自动回应，不交给 MessageHandler。
+// I 新建（空内容）或恢复（内容为令牌）会话，成功后 clientId() 变成会话 ID，断开期间发给它的消息随后推送过来。
+// D 主动退出，结束绑定的会话（close() 会自动发）。
+// 没有应答的请求：S A P D。发出后回调立即以 ok = true 调用；转发失败等错误由服务器主动推送
+// （targetId 为 0），和其他客户端发来的消息一样交给 MessageHandler。
+//
+// 开启自动重连（setReconnect）后，连接意外断开时接收线程按带抖动的指数退避重新连接，重新协商，用断开前
+// 拿到的会话令牌恢复会话（服务器随后补发断开期间的消息），恢复主题和在线列表的订阅，再按原来的顺序重发
+// 没收到应答的请求。重连期间的新请求先积压，恢复后接着发，回调不会因为断开而以 ok = false 结束。
+// 没有应答的请求（S A P D）写进了套接字就算送出，断开前已经写出但服务器没来得及处理的会丢失，不重发，
+// 免得重复投递；没写出去的会重发。
+//
+// 回调和 MessageHandler 都在接收线程里调用：不能在里面阻塞等待本连接的应答，也不能调用 close()。
+class NetClient {
+public:
+    // ok 为 false 表示连接在收到应答之前断开
+    typedef std::function<void(bool ok, const NetMsg& reply)> ReplyCallback;
+    // 服务器主动推送的消息：转发、广播、主题消息和错误
+    typedef std::function<void(const NetMsg& msg)> MessageHandler;
+    // 连接断开（对端关闭、出错或调用 close()）；开启自动重连时只有 close() 才会走到这里
+    typedef std::function<void()> CloseHandler;
+    // 自动重连：restored 为 false 表示连接断开、开始重连，为 true 表示已经恢复（会话、订阅和积压的请求都已重发）
+    typedef std::function<void(bool restored)> ReconnectHandler;
+
+    NetClient();
+    ~NetClient();
+
+    // 处理函数在 connect 之前设置
+    void setMessageHandler(MessageHandler handler) { _onMessage = handler; }
+    void setCloseHandler(CloseHandler handler) { _onClose = handler; }
+    void setReconnectHandler(ReconnectHandler handler) { _onReconnect = handler; }
+
+    // 在 connect 之前调用：意外断开后自动重连，等待时间从 minMs 开始翻倍到 maxMs，每次在一半到全部之间随机
+    void setReconnect(bool on, int minMs = RECONNECT_MIN_MS, int maxMs = RECONNECT_MAX_MS);
+
+    // 在 connect 之前调用：协商二进制帧时同时要求压缩。服务器同意后，不小于 COMPRESS_MIN_DEFAULT 字节的请求
+    // 压缩成 'Z' 帧发送，服务器发来的 'Z' 帧由库解压后照常分发，调用方看不出区别
+    void setCompression(bool on) { _wantCompress = on; }
+
+    // 连接服务器并启动接收线程，随后自动协商二进制帧
+    bool connect(const std::string& ip, int port);
+
+    // 断开连接（也停止自动重连），未完成的请求以 ok = false 结束。先发 'D'，绑定的会话随之结束，不能再恢复
+    void close();
+
+    bool connected() const { return _connected; }
+    bool reconnecting() const { return _resuming; } // 断开后正在重连或恢复会话，请求会先积压
+    bool binary() const { return _binary; }
+    bool compression() const { return _compress; } // 服务器同意了压缩
+    bool corrIds() const { return _corrIds; }   // 服务器支持关联 ID
+    int clientId() const { return _clientId; }   // 服务器分配的 ID（绑定会话后为会话 ID），协商完成前为 0
+    size_t inflight();                           // 未完成的请求数
+
+    // 异步请求，应答到达时调用 cb。返回请求 ID（即关联 ID），未连接（重连期间积压已满）时返回 0 且不调用 cb
+    uint32_t request(char type, const std::string& data, int target, ReplyCallback cb);
+
+    // 同上，以 future 的形式返回应答；连接断开时 get() 抛出 std::runtime_error
+    std::future<NetMsg> request(char type, const std::string& data = "", int target = 0);
+
+private:
+    // 等待应答的请求。开启自动重连时带着请求内容，重连后重发
+    struct PendingReq {
+        char type;
+        ReplyCallback cb;
+        std::string data;
+        int target;
+        bool replay;    // 重连后重发；握手和恢复订阅的请求不重发，在新连接上另外再发
+
+        PendingReq() : type(0), target(0), replay(false) {}
+    };
+
+    // 重连期间积压（或者没写出去）的没有应答的请求
+    struct HeldReq {
+        uint32_t id;
+        char type;
+        std::string data;
+        int target;
+        ReplyCallback cb;
+    };
+
+    static bool expectsReply(char type);
+    static int openSocket(const std::string& ip, int port);
+
+    uint32_t submit(char type, const std::string& data, int target, ReplyCallback cb, bool internal);
+    uint32_t nextIdLocked();
+    void registerLocked(uint32_t id, char type, const std::string& data, int target, ReplyCallback cb, bool internal,
+                        bool sent);
+    bool sendLocked(char type, const std::string& data, int target, uint32_t id);
+    void trackLocked(char type, const std::string& data);
+
+    bool attach(int sock);
+    void shutdownSock();
+    void negotiate(const char* cap);
+    void recvLoop();
+    void readFrames(MsgBuffer& buffer, std::string& inflated);
+    void dropConnection();
+    bool reconnect();
+    bool waitOrClosed(int ms);
+    void resumeSession(int tries);
+    void finishResume();
+    void dispatch(const NetMsgView& msg);
+    void complete(const NetMsg& reply);
+    bool takePending(uint32_t corrId, PendingReq& req);
+    void failAll();
+    void replyPing();
+    bool sendAll(const std::string& packet);
+
+    int _sock;                      // 接收线程换连接时同时持有 _sendMtx 和 _sockMtx
+    std::mutex _sockMtx;            // close() 只用它保护 shutdown，不会被阻塞在 send 里的线程卡住
+    std::atomic<bool> _connected;
+    std::atomic<bool> _binary;      // 服务器已确认二进制帧，之后的请求用二进制编码
+    bool _wantCompress;             // 协商时要求压缩
+    std::atomic<bool> _compress;    // 服务器已确认压缩
+    std::atomic<int> _clientId;
+    std::atomic<bool> _corrIds;     // 'B' 应答带回了关联 ID
+    std::thread _recvThread;
+
+    // 自动重连，设置和地址只在 connect 时写
+    bool _reconnect;
+    int _backoffMinMs;
+    int _backoffMaxMs;
+    std::string _ip;
+    int _port;
+    std::atomic<bool> _closing;     // close() 已调用，不再重连
+    std::atomic<bool> _resuming;    // 断开后到重发完积压的请求之前，由 _sendMtx 保护写入
+    std::mutex _waitMtx;
+    std::condition_variable _waitCv; // 退避等待，close() 时立即唤醒
+    int _backoffMs;                 // 下一次重连的等待上限，恢复成功后回到 _backoffMinMs；只由接收线程访问
+    uint32_t _jitter;               // 抖动用的随机数状态，只由接收线程访问
+    std::string _sessionToken;      // 最近一次 'I' 应答的令牌，只由接收线程访问
+    int _resumeRetry;               // 服务器让稍后重试恢复会话时，下一次尝试的序号，-1 表示没有；只由接收线程访问
+    std::chrono::steady_clock::time_point _resumeAt; // 下一次尝试的时间，接收线程边读边计时
+
+    std::mutex _sendMtx;            // 串行化发送：编码、登记、写套接字按同一顺序
+    std::string _outBuf;            // 复用的编码缓冲区，由 _sendMtx 保护
+    std::string _zBuf;              // 复用的压缩缓冲区，由 _sendMtx 保护
+    uint32_t _nextId;               // 由 _sendMtx 保护，跳过 0
+    std::deque<HeldReq> _held;      // 由 _sendMtx 保护
+    std::vector<std::string> _topics; // 订阅的主题，重连后重新订阅；由 _sendMtx 保护
+    bool _watching;                 // 订阅了在线列表的增量；由 _sendMtx 保护
+
+    // 未完成的请求（按关联 ID），发送线程登记、接收线程取出
+    // 和 _sendMtx 分开：发送阻塞（服务器暂停读取我们）时接收线程仍能取应答，不会互相卡死
+    std::mutex _pendMtx;
+    std::unordered_map<uint32_t, PendingReq> _pending;
+    std::deque<uint32_t> _order;    // 确认支持关联 ID 之前的发送顺序，用于匹配不带 ID 的应答
+
+    // 正在合并的 'L' 应答，只由接收线程访问
+    std::string _listText;
+    int _listRemaining;
+    uint32_t _listCorr;
+
+    MessageHandler _onMessage;
+    CloseHandler _onClose;
+    ReconnectHandler _onReconnect;
+};
+
+#endif
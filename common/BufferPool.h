@@ -0,0 +1,351 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include "StrView.h"
+
+#define POOL_MIN_SHIFT 6                // 最小的档 64 字节
+#define POOL_CLASSES 11                 // 64B、128B ... 64KB，每档翻倍
+#define POOL_MAX_BLOCK ((size_t)1 << (POOL_MIN_SHIFT + POOL_CLASSES - 1))
+#define POOL_SLAB_MAX_BLOCK 4096        // 不超过它的档从整块 slab 里切，更大的档逐块 malloc
+#define POOL_SLAB_SIZE (64 * 1024)      // 一块 slab 的大小
+#define POOL_CACHE_BYTES (128 * 1024)   // 每个线程每档最多缓存的空闲字节（至少 4 块）
+#define POOL_DEPOT_LARGE_BYTES (16 * 1024 * 1024) // 全局每个大档最多保留的空闲字节，多出来的还给 malloc
+
+// 内存池的统计（只在慢路径上更新）
+struct PoolStats {
+    uint64_t mallocs;       // 向 malloc 要内存的次数：切 slab、大档的块、超过最大档的缓冲区
+    uint64_t reservedBytes; // 从 malloc 拿到、还没还回去的字节（使用中 + 空闲）
+};
+
+// I/O 缓冲区和消息帧的内存池（服务器和客户端共用）
+//
+// 按大小分档，每档的块大小是 2 的幂。每个线程有自己的空闲链表，分配和释放都不加锁；
+// 本线程缓存太多时把一半还给全局仓库，缓存空了再从仓库成批取，仓库也空了才向 malloc 要。
+// 一个线程分配、另一个线程释放（跨 Reactor 投递的任务）也没问题，块会经过仓库流回分配多的线程。
+// 小档从 64KB 的 slab 里切，不产生碎片，slab 不归还；大档逐块 malloc，仓库里超过上限的直接 free，
+// 一阵突发之后不会一直占着内存。超过最大档的请求直接走 malloc。
+// 释放时须给出分配时的大小（或 roundUp 之后的容量），池不记录块的大小。
+class BufferPool {
+public:
+    // 实际分配的容量
+    static size_t roundUp(size_t n) {
+        return n > POOL_MAX_BLOCK ? n : blockSize(classIndex(n));
+    }
+
+    static void* alloc(size_t n) {
+        if (n > POOL_MAX_BLOCK) return rawAlloc(n);
+        size_t c = classIndex(n);
+        ThreadCache* tc = localCache();
+        if (tc && !tc->free[c].empty()) {
+            void* p = tc->free[c].back();
+            tc->free[c].pop_back();
+            return p;
+        }
+        return refill(tc, c);
+    }
+
+    static void free(void* p, size_t n) {
+        if (!p) return;
+        if (n > POOL_MAX_BLOCK) {
+            rawFree(p, n);
+            return;
+        }
+        size_t c = classIndex(n);
+        ThreadCache* tc = localCache();
+        if (!tc) {
+            giveBackOne(c, p);
+            return;
+        }
+        std::vector<void*>& list = tc->free[c];
+        reserveCache(list, c);
+        list.push_back(p);
+        if (list.size() > cacheLimit(c)) giveBack(c, list, list.size() / 2);
+    }
+
+    // 本线程不用线程缓存，直接和仓库打交道（每次加锁）
+    // 线程模式下工作线程和连接一样多，每个线程各缓存一批块会把内存分散在几千个线程里谁也用不上
+    static void disableThreadCache() {
+        int& state = cacheState();
+        if (state == CACHE_NONE) state = CACHE_OFF;
+    }
+
+    static void stats(PoolStats& out) {
+        Depot& d = depot();
+        out.mallocs = d.mallocs.load(std::memory_order_relaxed);
+        out.reservedBytes = d.reserved.load(std::memory_order_relaxed);
+    }
+
+private:
+    // 每个线程的空闲链表
+    struct ThreadCache {
+        std::vector<void*> free[POOL_CLASSES];
+
+        ~ThreadCache() {
+            cacheState() = CACHE_DEAD;
+            for (size_t c = 0; c < POOL_CLASSES; c++) giveBack(c, free[c], 0);
+        }
+    };
+
+    // 全局仓库。故意不析构：线程和进程退出时仍可能有块还回来
+    struct Depot {
+        std::mutex mtx[POOL_CLASSES];
+        std::vector<void*> free[POOL_CLASSES];
+        size_t carved[POOL_CLASSES];        // 小档从 slab 切出的块数，仓库里的块不会比这更多；由 mtx[c] 保护
+        std::atomic<uint64_t> mallocs;
+        std::atomic<uint64_t> reserved;
+
+        Depot() : mallocs(0), reserved(0) {
+            for (size_t c = 0; c < POOL_CLASSES; c++) carved[c] = 0;
+        }
+    };
+
+    enum { CACHE_NONE = 0, CACHE_LIVE = 1, CACHE_DEAD = 2, CACHE_OFF = 3 };
+
+    static size_t classIndex(size_t n) {
+        if (n <= ((size_t)1 << POOL_MIN_SHIFT)) return 0;
+        return (size_t)(64 - __builtin_clzll((unsigned long long)(n - 1))) - POOL_MIN_SHIFT;
+    }
+
+    static size_t blockSize(size_t c) { return (size_t)1 << (c + POOL_MIN_SHIFT); }
+
+    static size_t cacheLimit(size_t c) {
+        size_t n = POOL_CACHE_BYTES / blockSize(c);
+        return n < 4 ? 4 : n;
+    }
+
+    // 线程缓存的链表第一次用到时一次预留到上限：否则块在线程之间流动时容量要过很久才长到顶，
+    // 稳定运行中仍会偶尔扩容（分配内存）
+    static void reserveCache(std::vector<void*>& list, size_t c) {
+        if (list.capacity() == 0) list.reserve(cacheLimit(c) + 1);
+    }
+
+    static Depot& depot() {
+        static Depot* d = new Depot();
+        return *d;
+    }
+
+    // 本线程的缓存状态（POD，线程退出时不析构，缓存析构之后仍然可以读）
+    static int& cacheState() {
+        static thread_local int state = CACHE_NONE;
+        return state;
+    }
+
+    // 线程退出、缓存已经析构或不用线程缓存时返回 nullptr，这时直接和仓库打交道
+    static ThreadCache* localCache() {
+        int& state = cacheState();
+        if (state == CACHE_DEAD || state == CACHE_OFF) return nullptr;
+        static thread_local ThreadCache cache;
+        state = CACHE_LIVE;
+        return &cache;
+    }
+
+    static void* rawAlloc(size_t n) {
+        void* p = ::malloc(n);
+        if (!p) throw std::bad_alloc();
+        Depot& d = depot();
+        d.mallocs.fetch_add(1, std::memory_order_relaxed);
+        d.reserved.fetch_add(n, std::memory_order_relaxed);
+        return p;
+    }
+
+    static void rawFree(void* p, size_t n) {
+        depot().reserved.fetch_sub(n, std::memory_order_relaxed);
+        ::free(p);
+    }
+
+    // 把 list 里从 keep 开始的块还给仓库；大档超过仓库上限的部分还给 malloc
+    static void giveBack(size_t c, std::vector<void*>& list, size_t keep) {
+        Depot& d = depot();
+        size_t size = blockSize(c);
+        size_t i = keep;
+        {
+            std::lock_guard<std::mutex> lock(d.mtx[c]);
+            std::vector<void*>& pool = d.free[c];
+            size_t room = (size_t)-1;
+            if (size > POOL_SLAB_MAX_BLOCK) {
+                size_t most = POOL_DEPOT_LARGE_BYTES / size;
+                if (pool.capacity() < most) pool.reserve(most); // 一次预留到上限，之后归还不再扩容
+                room = pool.size() < most ? most - pool.size() : 0;
+            }
+            for (; i < list.size() && room > 0; i++, room--) pool.push_back(list[i]);
+        }
+        for (; i < list.size(); i++) rawFree(list[i], size);
+        list.resize(keep);
+    }
+
+    // 没有线程缓存时释放一块
+    static void giveBackOne(size_t c, void* p) {
+        Depot& d = depot();
+        size_t size = blockSize(c);
+        {
+            std::lock_guard<std::mutex> lock(d.mtx[c]);
+            if (size > POOL_SLAB_MAX_BLOCK && d.free[c].capacity() < POOL_DEPOT_LARGE_BYTES / size) {
+                d.free[c].reserve(POOL_DEPOT_LARGE_BYTES / size);
+            }
+            if (size <= POOL_SLAB_MAX_BLOCK || d.free[c].size() < POOL_DEPOT_LARGE_BYTES / size) {
+                d.free[c].push_back(p);
+                return;
+            }
+        }
+        rawFree(p, size);
+    }
+
+    // 本线程缓存空了：从仓库取一批，仓库也空了就切一块新的 slab（小档）或 malloc 一块（大档）
+    static void* refill(ThreadCache* tc, size_t c) {
+        Depot& d = depot();
+        size_t size = blockSize(c);
+        size_t want = tc ? cacheLimit(c) / 2 : 0;
+        {
+            std::lock_guard<std::mutex> lock(d.mtx[c]);
+            std::vector<void*>& pool = d.free[c];
+            if (!pool.empty()) {
+                if (tc) reserveCache(tc->free[c], c);
+                void* p = pool.back();
+                pool.pop_back();
+                while (want > 0 && !pool.empty()) {
+                    tc->free[c].push_back(pool.back());
+                    pool.pop_back();
+                    want--;
+                }
+                return p;
+            }
+        }
+        if (size > POOL_SLAB_MAX_BLOCK) return rawAlloc(size);
+
+        char* slab = (char*)rawAlloc(POOL_SLAB_SIZE);
+        size_t count = POOL_SLAB_SIZE / size;
+        {
+            // 仓库的容量跟着切出的块数一起长：块在线程之间来回流动时归还给仓库不会扩容
+            std::lock_guard<std::mutex> lock(d.mtx[c]);
+            d.carved[c] += count;
+            std::vector<void*>& pool = d.free[c];
+            if (pool.capacity() < d.carved[c]) pool.reserve(std::max(d.carved[c], pool.capacity() * 2));
+        }
+        if (tc) {
+            reserveCache(tc->free[c], c);
+            for (size_t i = 1; i < count; i++) tc->free[c].push_back(slab + i * size);
+        } else {
+            std::vector<void*> rest;
+            for (size_t i = 1; i < count; i++) rest.push_back(slab + i * size);
+            giveBack(c, rest, 0);
+        }
+        return slab;
+    }
+};
+
+// 给标准容器和 allocate_shared 用的分配器
+template <typename T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() {}
+    template <typename U> PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) { return (T*)BufferPool::alloc(n * sizeof(T)); }
+    void deallocate(T* p, size_t n) { BufferPool::free(p, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+// 从内存池分配的字节缓冲区，只能移动不能拷贝
+// clear 保留容量，release 把块还给内存池
+class PooledBuf {
+public:
+    PooledBuf() : _data(nullptr), _size(0), _cap(0) {}
+    explicit PooledBuf(StrView s) : _data(nullptr), _size(0), _cap(0) { assign(s); }
+    PooledBuf(PooledBuf&& o) : _data(o._data), _size(o._size), _cap(o._cap) {
+        o._data = nullptr;
+        o._size = o._cap = 0;
+    }
+    PooledBuf& operator=(PooledBuf&& o) {
+        if (this != &o) {
+            release();
+            swap(o);
+        }
+        return *this;
+    }
+    ~PooledBuf() { release(); }
+
+    const char* data() const { return _data; }
+    char* data() { return _data; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _cap; }
+    bool empty() const { return _size == 0; }
+    StrView view() const { return StrView(_data ? _data : "", _size); }
+
+    // 保证容量至少为 n，已有内容保留
+    void reserve(size_t n) {
+        if (n <= _cap) return;
+        size_t cap = BufferPool::roundUp(n);
+        char* p = (char*)BufferPool::alloc(cap);
+        if (_size > 0) memcpy(p, _data, _size);
+        BufferPool::free(_data, _cap);
+        _data = p;
+        _cap = cap;
+    }
+
+    void append(StrView s) {
+        if (s.len == 0) return;
+        if (_size + s.len > _cap) reserve(std::max(_size + s.len, _cap * 2));
+        memcpy(_data + _size, s.data, s.len);
+        _size += s.len;
+    }
+
+    void assign(StrView s) {
+        _size = 0;
+        append(s);
+    }
+
+    void clear() { _size = 0; }
+
+    // 长度改为 n，容量不够时扩容；多出的部分不初始化（不像 std::string 那样先清零），由调用方写入
+    void resize(size_t n) {
+        reserve(n);
+        _size = n;
+    }
+
+    void release() {
+        BufferPool::free(_data, _cap);
+        _data = nullptr;
+        _size = _cap = 0;
+    }
+
+    void swap(PooledBuf& o) {
+        std::swap(_data, o._data);
+        std::swap(_size, o._size);
+        std::swap(_cap, o._cap);
+    }
+
+private:
+    PooledBuf(const PooledBuf&);
+    PooledBuf& operator=(const PooledBuf&);
+
+    char* _data;
+    size_t _size;
+    size_t _cap;
+};
+
+// 多个连接共享的只读缓冲区：控制块和 PooledBuf 本身也从内存池分配
+typedef std::shared_ptr<const PooledBuf> SharedBuf;
+
+inline SharedBuf makeSharedBuf(StrView data) {
+    return std::allocate_shared<PooledBuf>(PoolAllocator<PooledBuf>(), data);
+}
+
+inline SharedBuf makeSharedBuf(PooledBuf&& buf) {
+    return std::allocate_shared<PooledBuf>(PoolAllocator<PooledBuf>(), std::move(buf));
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <vector>
+#include <stdint.h>
+
+// HDR 风格的直方图（压测用）
+//
+// 小于 2^HIST_SUB_BITS 的值每个值一个桶；更大的值按 2 的幂分段，每段再线性分成 2^(HIST_SUB_BITS-1) 个桶，
+// 所以任意值的相对误差不超过 1/2^(HIST_SUB_BITS-1)（HIST_SUB_BITS 为 8 时小于 1%）。
+// 桶数固定，record 只是一次位运算加一次自增，不分配内存；两个直方图可以直接逐桶相加合并。
+#define HIST_SUB_BITS 8
+
+class Histogram {
+public:
+    Histogram() : _counts(bucketCount(), 0), _total(0), _min(UINT64_MAX), _max(0), _sum(0) {}
+
+    void record(uint64_t value) {
+        _counts[indexOf(value)]++;
+        _total++;
+        _sum += value;
+        if (value < _min) _min = value;
+        if (value > _max) _max = value;
+    }
+
+    // 合并另一个直方图（比如各线程各自记录，最后汇总）
+    void merge(const Histogram& other) {
+        for (size_t i = 0; i < _counts.size(); i++) _counts[i] += other._counts[i];
+        _total += other._total;
+        _sum += other._sum;
+        if (other._min < _min) _min = other._min;
+        if (other._max > _max) _max = other._max;
+    }
+
+    void reset() {
+        for (size_t i = 0; i < _counts.size(); i++) _counts[i] = 0;
+        _total = 0;
+        _sum = 0;
+        _min = UINT64_MAX;
+        _max = 0;
+    }
+
+    uint64_t count() const { return _total; }
+    uint64_t min() const { return _total ? _min : 0; }
+    uint64_t max() const { return _max; }
+    double mean() const { return _total ? (double)_sum / _total : 0.0; }
+
+    // 百分位数（p 取 0~100），返回所在桶的上界，不超过实际最大值
+    uint64_t percentile(double p) const {
+        if (_total == 0) return 0;
+        uint64_t rank = (uint64_t)(p / 100.0 * _total + 0.5);
+        if (rank < 1) rank = 1;
+        if (rank > _total) rank = _total;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); i++) {
+            seen += _counts[i];
+            if (seen >= rank) {
+                uint64_t upper = upperBound(i);
+                return upper < _max ? upper : _max;
+            }
+        }
+        return _max;
+    }
+
+private:
+    static const uint64_t SUB_COUNT = 1ULL << HIST_SUB_BITS;   // 线性区的桶数
+    static const uint64_t HALF_COUNT = SUB_COUNT / 2;          // 之后每段的桶数
+
+    static size_t bucketCount() {
+        return SUB_COUNT + (64 - HIST_SUB_BITS) * HALF_COUNT;
+    }
+
+    static int msb(uint64_t v) { return 63 - __builtin_clzll(v); }
+
+    static size_t indexOf(uint64_t v) {
+        if (v < SUB_COUNT) return (size_t)v;
+        int shift = msb(v) - HIST_SUB_BITS + 1;         // 只保留最高的 HIST_SUB_BITS 位
+        uint64_t sub = v >> shift;                      // 落在 [HALF_COUNT, SUB_COUNT)
+        return (size_t)(SUB_COUNT + (shift - 1) * HALF_COUNT + (sub - HALF_COUNT));
+    }
+
+    // 桶内的最大值
+    static uint64_t upperBound(size_t idx) {
+        if (idx < SUB_COUNT) return idx;
+        uint64_t shift = (idx - SUB_COUNT) / HALF_COUNT + 1;
+        uint64_t sub = (idx - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> _counts;
+    uint64_t _total;
+    uint64_t _min;
+    uint64_t _max;
+    uint64_t _sum;
+};
+
+#endif
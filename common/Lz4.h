@@ -0,0 +1,175 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+// LZ4 块格式的压缩/解压（与 liblz4 的 LZ4_compress_default / LZ4_decompress_safe 输出互通），不依赖外部库
+//
+// 块由若干序列组成：token（高 4 位字面量长度，低 4 位匹配长度 - 4）| 字面量 | 偏移(2 字节小端) | ...，
+// 长度为 15 时后面跟若干字节继续累加（255 表示还有下一个字节）。最后一个序列只有字面量。
+// 压缩用贪心匹配 + 4096 项哈希表，速度优先；解压对每个长度和偏移做边界检查，可以直接处理网络上收到的数据。
+
+#define LZ4_HASH_BITS 12
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_LAST_LITERALS 5     // 块的最后 5 个字节必须是字面量
+#define LZ4_MF_LIMIT 12         // 最后一个匹配至少在块结束前 12 字节开始
+
+class Lz4 {
+public:
+    // 压缩 n 字节最多需要的输出空间
+    static size_t bound(size_t n) { return n + n / 255 + 16; }
+
+    // n 字节的压缩数据最多能解压出的长度：每个长度字节 255 最多多出 255 字节，再加上最后的字面量
+    // 声明的原始长度超过它时数据一定非法，不必先分配再解压
+    static size_t maxInflated(size_t n) { return n * 255 + 16; }
+
+    // 压缩 src[0..n) 到 dst（至少 bound(n) 字节），返回压缩后的长度
+    static size_t compress(const char* src, size_t n, char* dst) {
+        const uint8_t* base = (const uint8_t*)src;
+        const uint8_t* ip = base;
+        const uint8_t* anchor = base;
+        const uint8_t* end = base + n;
+        uint8_t* op = (uint8_t*)dst;
+
+        if (n > LZ4_MF_LIMIT) {
+            uint32_t table[1 << LZ4_HASH_BITS];
+            memset(table, 0, sizeof(table));
+            const uint8_t* mfLimit = end - LZ4_MF_LIMIT;
+            const uint8_t* matchLimit = end - LZ4_LAST_LITERALS;
+
+            while (ip < mfLimit) {
+                uint32_t seq = read32(ip);
+                uint32_t h = hash(seq);
+                const uint8_t* ref = base + table[h];
+                table[h] = (uint32_t)(ip - base);
+                if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(ref) != seq) {
+                    ip += 1 + ((ip - anchor) >> 6); // 长时间找不到匹配时加大步长
+                    continue;
+                }
+                // 向前扩展（和上一段字面量的末尾重合的部分），再向后扩展
+                while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+                const uint8_t* p = ip + LZ4_MIN_MATCH;
+                const uint8_t* q = ref + LZ4_MIN_MATCH;
+                while (p < matchLimit && *p == *q) {
+                    p++;
+                    q++;
+                }
+                op = emit(op, anchor, ip - anchor, (uint32_t)(ip - ref), p - ip - LZ4_MIN_MATCH);
+                ip = p;
+                anchor = ip;
+                if (ip - 2 >= base && ip < mfLimit) table[hash(read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+            }
+        }
+
+        // 剩下的都是字面量
+        size_t lit = end - anchor;
+        uint8_t* token = op++;
+        op = putLength(op, token, lit, 4);
+        memcpy(op, anchor, lit);
+        op += lit;
+        return op - (uint8_t*)dst;
+    }
+
+    // 解压到 dst（容量 cap），返回解压后的长度；数据非法或超出 cap 时返回 -1
+    static long decompress(const char* src, size_t n, char* dst, size_t cap) {
+        const uint8_t* ip = (const uint8_t*)src;
+        const uint8_t* iend = ip + n;
+        uint8_t* op = (uint8_t*)dst;
+        uint8_t* oend = op + cap;
+
+        while (ip < iend) {
+            unsigned token = *ip++;
+            size_t lit = token >> 4;
+            if (lit == 15 && !readLength(ip, iend, lit)) return -1;
+            if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return -1;
+            if (lit <= 16 && iend - ip >= 16 && oend - op >= 16) {
+                memcpy(op, ip, 16); // 短字面量：多复制几个字节换掉变长的 memcpy，多出的部分随后被覆盖
+            } else {
+                memcpy(op, ip, lit);
+            }
+            op += lit;
+            ip += lit;
+            if (ip == iend) break; // 最后一个序列没有匹配
+
+            if (iend - ip < 2) return -1;
+            size_t offset = ip[0] | ((size_t)ip[1] << 8);
+            ip += 2;
+            if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst)) return -1;
+            size_t len = token & 15;
+            if (len == 15 && !readLength(ip, iend, len)) return -1;
+            len += LZ4_MIN_MATCH;
+            if (len > (size_t)(oend - op)) return -1;
+
+            const uint8_t* match = op - offset;
+            uint8_t* mend = op + len;
+            if (offset >= 8 && (size_t)(oend - op) >= len + 8) {
+                // 每次 8 字节，偏移不小于 8 时源和目标不会在同一次复制里重叠；最多越过 mend 7 个字节
+                while (op < mend) {
+                    memcpy(op, match, 8);
+                    op += 8;
+                    match += 8;
+                }
+                op = mend;
+            } else {
+                while (op < mend) *op++ = *match++; // 和输出重叠（重复的短串）或接近末尾，逐字节复制
+            }
+        }
+        return (long)(op - (uint8_t*)dst);
+    }
+
+private:
+    static uint32_t read32(const uint8_t* p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t hash(uint32_t seq) {
+        return (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+    }
+
+    // 长度写进 token 的 4 位（shift 为 4 表示高 4 位），超过 14 的部分跟在后面
+    static uint8_t* putLength(uint8_t* op, uint8_t* token, size_t len, int shift) {
+        if (len < 15) {
+            *token = (uint8_t)(shift ? len << 4 : (*token | len));
+            return op;
+        }
+        *token = (uint8_t)(shift ? 15 << 4 : (*token | 15));
+        len -= 15;
+        while (len >= 255) {
+            *op++ = 255;
+            len -= 255;
+        }
+        *op++ = (uint8_t)len;
+        return op;
+    }
+
+    static bool readLength(const uint8_t*& ip, const uint8_t* iend, size_t& len) {
+        unsigned b;
+        do {
+            if (ip >= iend) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    }
+
+    // 一个序列：lit 字节字面量 + 偏移 offset、长度 matchLen + 4 的匹配
+    static uint8_t* emit(uint8_t* op, const uint8_t* lit, size_t litLen, uint32_t offset, size_t matchLen) {
+        uint8_t* token = op++;
+        op = putLength(op, token, litLen, 4);
+        memcpy(op, lit, litLen);
+        op += litLen;
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        return putLength(op, token, matchLen, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef MSG_BUFFER_H
+#define MSG_BUFFER_H
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "StrView.h"
+#include "BufferPool.h"
+#include "NetMsg.h"
+
+// 接收缓冲区 + 流式分帧器（服务器和客户端共用）
+//
+//   | 已消费 | 可读数据 (readable) | 可写空间 (writable) |
+//   0      _readPos             _writePos             capacity
+//
+// recv 直接写进可写空间；nextFrame 在可读数据里切出完整帧，只移动 _readPos，
+// 不做 substr/erase。可读数据被取完时两个下标归零；空间不够时先把剩余数据挪到头部，仍不够再扩容。
+// 所以每个字节最多被搬动一次，一次 recv 收到很多个包也是线性时间。
+// 内存从 BufferPool 分配，第一次写入时才分配；空闲时 release 把它还回去，空闲连接不占缓冲区。
+class MsgBuffer {
+private:
+    char* _buf;
+    size_t _cap;
+    size_t _readPos;    // 下一帧的起点
+    size_t _writePos;   // 可写空间的起点
+    size_t _scanned;    // 文本帧已经确认没有 \n 的长度，避免半包反复从头查找
+    bool _bad;          // 遇到非法数据，帧边界已经无法恢复
+
+    MsgBuffer(const MsgBuffer&);
+    MsgBuffer& operator=(const MsgBuffer&);
+
+public:
+    MsgBuffer() : _buf(nullptr), _cap(0), _readPos(0), _writePos(0), _scanned(0), _bad(false) {}
+    ~MsgBuffer() { BufferPool::free(_buf, _cap); }
+
+    size_t readable() const { return _writePos - _readPos; }
+    size_t writable() const { return _cap - _writePos; }
+    const char* peek() const { return _buf + _readPos; }
+    char* writePtr() { return _buf + _writePos; }
+    size_t capacity() const { return _cap; }
+    bool bad() const { return _bad; }
+
+    // 保证至少有 n 字节可写空间
+    void ensureWritable(size_t n) {
+        if (writable() >= n) return;
+        size_t used = readable();
+        if (used + n <= _cap) {
+            // 先把未处理的半包挪到头部
+            if (used > 0) memmove(_buf, peek(), used);
+        } else {
+            // 扩容：换一块更大的，顺便把半包搬到头部
+            size_t cap = BufferPool::roundUp(std::max(used + n, _cap * 2));
+            char* bigger = (char*)BufferPool::alloc(cap);
+            if (used > 0) memcpy(bigger, peek(), used);
+            BufferPool::free(_buf, _cap);
+            _buf = bigger;
+            _cap = cap;
+        }
+        _readPos = 0;
+        _writePos = used;
+    }
+
+    // 没有未处理的数据时把内存还给内存池，下次写入时再分配。返回是否已释放
+    bool release() {
+        if (readable() > 0 || _buf == nullptr) return false;
+        BufferPool::free(_buf, _cap);
+        _buf = nullptr;
+        _cap = 0;
+        _readPos = _writePos = 0;
+        _scanned = 0;
+        return true;
+    }
+
+    // 外部直接写入 writePtr() 之后调用
+    void hasWritten(size_t n) { _writePos += n; }
+
+    // 追加一段数据
+    void append(const char* data, size_t n) {
+        if (n == 0) return; // 还没分配时 writePtr() 是空指针
+        ensureWritable(n);
+        memcpy(writePtr(), data, n);
+        hasWritten(n);
+    }
+
+    // 丢弃头部 n 字节
+    void retrieve(size_t n) {
+        if (n >= readable()) {
+            clear();
+            return;
+        }
+        _readPos += n;
+        _scanned = 0;
+    }
+
+    void clear() {
+        _readPos = _writePos = 0;
+        _scanned = 0;
+        _bad = false;
+    }
+
+    // 从套接字读一次，直接写进缓冲区；返回值同 recv
+    ssize_t readFd(int fd, size_t chunk = 4096) {
+        ensureWritable(chunk);
+        ssize_t n = recv(fd, writePtr(), writable(), 0);
+        if (n > 0) hasWritten(n);
+        return n;
+    }
+
+    // 切出下一个完整帧（文本帧含结尾 \n），frame 指向缓冲区内部，不拷贝
+    // 视图在下一次写入缓冲区之前有效。没有完整帧或遇到非法数据时返回 false（后者 bad() 为 true）
+    bool nextFrame(StrView& frame) {
+        if (_bad) return false;
+        size_t avail = readable();
+        if (avail == 0) return false;
+
+        const char* p = peek();
+        long frameLen;
+        if ((unsigned char)p[0] == BIN_MAGIC) {
+            frameLen = NetMsg::peekFrame(p, avail);
+        } else {
+            // 文本帧：只在新到的数据里找 \n
+            const char* nl = (const char*)memchr(p + _scanned, '\n', avail - _scanned);
+            if (nl == NULL) {
+                _scanned = avail;
+                frameLen = avail > MAX_PAYLOAD_LEN ? -1 : 0;
+            } else {
+                frameLen = (long)(nl - p) + 1;
+            }
+        }
+
+        if (frameLen < 0) {
+            _bad = true;
+            return false;
+        }
+        if (frameLen == 0) return false;
+
+        frame = StrView(p, (size_t)frameLen);
+        _readPos += frameLen;
+        _scanned = 0;
+        if (_readPos == _writePos) {
+            // 全部取完，下标归零；frame 仍指向原位置，直到下一次写入
+            _readPos = _writePos = 0;
+        }
+        return true;
+    }
+};
+
+#endif
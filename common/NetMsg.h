@@ -5,81 +5,409 @@
 #include <iostream>
 #include <vector>
 #include <sstream>
+#include <cstring>
+#include <stdint.h>
+#include "StrView.h"
+#include "Lz4.h"
 
 
 // 协议格式：HEAD | type | targetId | payload
 // 例如：LAB_PROTO|T|0|
+// type 后面可以带关联 ID：LAB_PROTO|T:42|0|，服务器的应答带上同一个 ID，客户端据此匹配乱序到达的应答。
+// 老的解析只取 type 字段的第一个字符，会忽略关联 ID
 #define MSG_HEAD "LAB_PROTO"
 #define DELIMITER "|"
 
+// 二进制帧格式（定长头 + 原始负载，负载可以包含任意字节）：
+// | magic(1) | type(1) | flags(1) | reserved(1) | targetId(4) | length(4) | payload(length) |
+// 多字节字段均为网络字节序。magic 不可能是文本帧的首字符 'L'，所以两种帧可以混在同一条流里
+#define BIN_MAGIC 0xB5
+#define BIN_HEADER_LEN 12
+#define MAX_PAYLOAD_LEN (16 * 1024 * 1024) // 单帧负载上限，防止非法长度耗尽内存
+// flags 的 BIN_FLAG_CORR 位表示头部后面先跟 4 字节关联 ID 再跟负载，length 包括这 4 字节，
+// 所以不认识该标志的解析器仍然能正确分帧
+#define BIN_FLAG_CORR 0x01
+#define BIN_CORR_LEN 4
+
+// 协商二进制帧：客户端连上后用文本帧发送 'B' 请求，内容为 PROTO_BINARY_CAP；
+// 服务器支持则回复同样内容的 'B'，之后双方都可以发送二进制帧。老客户端不发 'B'，一直使用文本帧
+// 'B' 应答的 targetId 是服务器给这个连接分配的 ID
+// 'B' 请求带关联 ID 时，支持关联 ID 的服务器会在应答里原样带回，客户端据此判断之后能否依赖关联 ID
+#define PROTO_BINARY_CAP "BIN1"
+
+// 压缩：'B' 请求的内容写成 PROTO_BINARY_LZ4_CAP（"BIN1,LZ4"），服务器同意则原样回复，不压缩时只回复 "BIN1"。
+// 之后双方都可以把连续的一个或多个二进制帧（一条大的转发、整个列表应答）压缩成一个 'Z' 帧：
+// 二进制帧，负载为原始长度(4) + LZ4 块，解压后按原来的顺序逐帧处理。'Z' 里不会再套 'Z'。
+// 不认识 "BIN1,LZ4" 的老服务器回复空内容，客户端再单独协商 "BIN1"
+#define PROTO_LZ4_CAP "LZ4"
+#define PROTO_BINARY_LZ4_CAP PROTO_BINARY_CAP "," PROTO_LZ4_CAP
+#define MSG_COMPRESSED 'Z'
+#define COMPRESS_LEN_BYTES 4
+#define COMPRESS_MIN_DEFAULT 512 // 默认只压缩不小于该长度的数据，小帧压缩省不了多少字节
+
+// 心跳 'H'：负载为 HEARTBEAT_PING 的一方要求对方回一个负载为 HEARTBEAT_PONG 的 'H'，pong 不再应答。
+// 服务器对静默的连接发 ping，一段时间内没有收到任何数据就断开；客户端也可以 ping 服务器
+#define HEARTBEAT_PING "ping"
+#define HEARTBEAT_PONG "pong"
+
+// 会话 'I'：负载为空时新建会话，为之前拿到的令牌时恢复会话。应答 'I' 的 targetId 是会话 ID、负载是令牌，
+// 之后这个连接就用会话 ID 收发消息；失败时 targetId 为 0，负载是 "[System] Error: ..." 说明。
+// 会话断开期间发给它的消息由服务器保存，恢复时先按原来的顺序补发
+
+// 消息视图：字段直接指向接收缓冲区，不分配内存
+// 只在对应缓冲区下一次写入之前有效，需要保存时转换成 NetMsg
+struct NetMsgView {
+    char type;          // 消息类型
+    int targetId;       // 目标ID
+    uint32_t corrId;    // 关联 ID，0 表示没有
+    StrView payload;    // 消息内容（借用缓冲区）
+
+    NetMsgView() : type(0), targetId(0), corrId(0) {}
+};
+
 class NetMsg {
 private:
     char _type;           // 消息类型
     int _targetId;        // 目标ID (0表示服务器，其他表示客户端ID)
+    uint32_t _corrId;     // 关联 ID，0 表示没有
     std::string _payload; // 消息内容
 
 public:
     // 默认构造函数
-    NetMsg() : _type(0), _targetId(0), _payload("") {}
+    NetMsg() : _type(0), _targetId(0), _corrId(0), _payload("") {}
     
     // 带参构造函数
     NetMsg(char type, std::string data = "", int target = 0) 
-            : _type(type), _targetId(target), _payload(data) {} // 修复：与声明顺序一致
+            : _type(type), _targetId(target), _corrId(0), _payload(std::move(data)) {} // 修复：与声明顺序一致
+
+    // 从视图拷贝出一份独立的消息
+    explicit NetMsg(const NetMsgView& view)
+            : _type(view.type), _targetId(view.targetId), _corrId(view.corrId),
+              _payload(view.payload.data, view.payload.len) {}
 
     // Getters
     char getType() const { return _type; }
     int getTargetId() const { return _targetId; }
-    std::string getContent() const { return _payload; }
+    uint32_t getCorrId() const { return _corrId; }
+    void setCorrId(uint32_t corrId) { _corrId = corrId; }
+    const std::string& getContent() const { return _payload; }
 
 // 序列化：将对象打包成字符串
     // 格式: LAB_PROTO|type|targetId|content\n  <-- 注意换行符
-    std::string encode() {
-        return std::string(MSG_HEAD) + DELIMITER + 
-               _type + DELIMITER + 
-               std::to_string(_targetId) + DELIMITER + 
-               _payload + "\n"; // 【修改】增加 "\n" 作为包结束标记
+    std::string encode() const {
+        std::string out;
+        encodeTo(out, _type, _targetId, _payload, false, _corrId);
+        return out;
+    }
+
+    // 二进制序列化：一次分配，负载原样拷贝
+    std::string encodeBinary() const {
+        std::string out;
+        encodeTo(out, _type, _targetId, _payload, true, _corrId);
+        return out;
+    }
+
+    // 按连接协商的格式序列化
+    std::string encode(bool binary) const {
+        return binary ? encodeBinary() : encode();
+    }
+
+    // 【热路径】把一条消息编码后追加到 out 末尾（不清空 out）
+    // out 可以是复用的缓冲区：容量足够时整个过程不分配内存。corrId 为 0 时不带关联 ID
+    static void encodeTo(std::string& out, char type, int targetId, StrView payload, bool binary,
+                         uint32_t corrId = 0) {
+        encodeTo(out, type, targetId, StrView(), payload, binary, corrId);
+    }
+
+    // 改写一个已编码、带关联 ID 的二进制帧里的 ID，用于重复发送预先编码好的应答
+    static void patchCorrId(char* frame, uint32_t corrId) {
+        putU32(frame + BIN_HEADER_LEN, corrId);
+    }
+
+    // 同上，负载由 head + body 两段拼成，省去调用方先拼接字符串
+    static void encodeTo(std::string& out, char type, int targetId, StrView head, StrView body, bool binary,
+                         uint32_t corrId = 0) {
+        size_t payloadLen = head.len + body.len;
+        size_t start = out.size();
+        if (binary) {
+            size_t extra = corrId ? BIN_CORR_LEN : 0;
+            out.resize(start + BIN_HEADER_LEN + extra + payloadLen);
+            char* p = &out[start];
+            p[0] = (char)BIN_MAGIC;
+            p[1] = type;
+            p[2] = corrId ? BIN_FLAG_CORR : 0;
+            p[3] = 0;
+            putU32(p + 4, (uint32_t)targetId);
+            putU32(p + 8, (uint32_t)(extra + payloadLen));
+            p += BIN_HEADER_LEN;
+            if (corrId) {
+                putU32(p, corrId);
+                p += BIN_CORR_LEN;
+            }
+            if (head.len) memcpy(p, head.data, head.len);
+            if (body.len) memcpy(p + head.len, body.data, body.len);
+            return;
+        }
+
+        // 文本帧：LAB_PROTO|type[:corrId]|targetId|payload\n，数字直接格式化到栈上
+        char idBuf[16];
+        size_t idLen = formatInt(idBuf, targetId);
+        char corrBuf[16];
+        size_t corrLen = corrId ? formatUInt(corrBuf, corrId) : 0;
+        size_t headLen = sizeof(MSG_HEAD) - 1;
+        out.resize(start + headLen + 1 + 1 + (corrId ? 1 + corrLen : 0) + 1 + idLen + 1 + payloadLen + 1);
+        char* p = &out[start];
+        memcpy(p, MSG_HEAD, headLen);
+        p += headLen;
+        *p++ = DELIMITER[0];
+        *p++ = type;
+        if (corrId) {
+            *p++ = ':';
+            memcpy(p, corrBuf, corrLen);
+            p += corrLen;
+        }
+        *p++ = DELIMITER[0];
+        memcpy(p, idBuf, idLen);
+        p += idLen;
+        *p++ = DELIMITER[0];
+        if (head.len) memcpy(p, head.data, head.len);
+        if (body.len) memcpy(p + head.len, body.data, body.len);
+        p += payloadLen;
+        *p = '\n'; // 【修改】增加 "\n" 作为包结束标记
+    }
+
+    // 把 frames（一个或多个完整的二进制帧）压缩成一个 'Z' 帧追加到 out 末尾
+    // 压缩后没有变小时不写入，返回 false，调用方照常发送原来的帧
+    static bool compressTo(std::string& out, StrView frames) {
+        if (frames.len == 0 || frames.len > MAX_PAYLOAD_LEN) return false;
+        size_t start = out.size();
+        size_t headLen = BIN_HEADER_LEN + COMPRESS_LEN_BYTES;
+        out.resize(start + headLen + Lz4::bound(frames.len));
+        char* p = &out[start];
+        size_t zlen = Lz4::compress(frames.data, frames.len, p + headLen);
+        if (headLen + zlen >= frames.len) {
+            out.resize(start);
+            return false;
+        }
+        p[0] = (char)BIN_MAGIC;
+        p[1] = MSG_COMPRESSED;
+        p[2] = 0;
+        p[3] = 0;
+        putU32(p + 4, 0);
+        putU32(p + 8, (uint32_t)(COMPRESS_LEN_BYTES + zlen));
+        putU32(p + BIN_HEADER_LEN, (uint32_t)frames.len);
+        out.resize(start + headLen + zlen);
+        return true;
+    }
+
+    // 解压 'Z' 帧的负载，out 被覆盖为原来的一串帧（用 forEachFrame 逐个处理）；数据非法时返回 false
+    static bool decompress(StrView payload, std::string& out) {
+        long rawLen = inflatedSize(payload);
+        if (rawLen < 0) return false;
+        out.resize(rawLen);
+        return decompressInto(payload, &out[0], rawLen);
+    }
+
+    // 'Z' 帧负载里声明的原始长度，在分配缓冲区之前检查：为 0、超过 MAX_PAYLOAD_LEN、
+    // 或者这么短的压缩数据根本解压不出这么长（对端谎报长度让接收方白白分配）时返回 -1
+    static long inflatedSize(StrView payload) {
+        if (payload.len < COMPRESS_LEN_BYTES) return -1;
+        uint32_t rawLen = getU32(payload.data);
+        if (rawLen == 0 || rawLen > MAX_PAYLOAD_LEN) return -1;
+        if (rawLen > Lz4::maxInflated(payload.len - COMPRESS_LEN_BYTES)) return -1;
+        return rawLen;
+    }
+
+    // 解压到调用方准备好的 dst（长度为 inflatedSize 的返回值），不要求 dst 事先清零
+    static bool decompressInto(StrView payload, char* dst, size_t rawLen) {
+        long n = Lz4::decompress(payload.data + COMPRESS_LEN_BYTES, payload.len - COMPRESS_LEN_BYTES, dst, rawLen);
+        return n == (long)rawLen;
+    }
+
+    // 依次解析解压出的帧并交给 handle(const NetMsgView&)，嵌套的 'Z' 跳过
+    // 有不完整或非法的帧时停下，返回 false
+    template <typename F>
+    static bool forEachFrame(StrView frames, F handle) {
+        while (frames.len > 0) {
+            long len = peekFrame(frames.data, frames.len);
+            NetMsgView msg;
+            if (len <= 0 || !decodeView(StrView(frames.data, len), msg)) return false;
+            if (msg.type != MSG_COMPRESSED) handle(msg);
+            frames = StrView(frames.data + len, frames.len - len);
+        }
+        return true;
+    }
+
+    // 【分包】检查缓冲区头部是否已有一个完整帧（文本帧或二进制帧）
+    // 返回值: >0 为该帧的总长度（文本帧含 \n），0 表示数据还不够，-1 表示非法数据
+    static long peekFrame(const char* data, size_t len) {
+        if (len == 0) return 0;
+        if ((unsigned char)data[0] == BIN_MAGIC) {
+            if (len < BIN_HEADER_LEN) return 0;
+            uint32_t payloadLen = getU32(data + 8);
+            if (payloadLen > MAX_PAYLOAD_LEN) return -1;
+            if (len < BIN_HEADER_LEN + payloadLen) return 0;
+            return (long)(BIN_HEADER_LEN + payloadLen);
+        }
+        const char* nl = (const char*)memchr(data, '\n', len);
+        if (nl == NULL) {
+            return len > MAX_PAYLOAD_LEN ? -1 : 0; // 一直没有换行的超长数据
+        }
+        return (long)(nl - data) + 1;
+    }
+
+    // 【热路径】把 peekFrame/nextFrame 切出的完整帧解析成视图，自动识别文本/二进制，不分配内存
+    static bool decodeView(StrView frame, NetMsgView& out) {
+        if (frame.len > 0 && (unsigned char)frame.data[0] == BIN_MAGIC) {
+            if (frame.len < BIN_HEADER_LEN) return false;
+            uint32_t bodyLen = getU32(frame.data + 8);
+            if (bodyLen != frame.len - BIN_HEADER_LEN) return false;
+            const char* body = frame.data + BIN_HEADER_LEN;
+            out.corrId = 0;
+            if (frame.data[2] & BIN_FLAG_CORR) {
+                if (bodyLen < BIN_CORR_LEN) return false;
+                out.corrId = getU32(body);
+                body += BIN_CORR_LEN;
+                bodyLen -= BIN_CORR_LEN;
+            }
+            out.type = frame.data[1];
+            out.targetId = (int)getU32(frame.data + 4);
+            out.payload = StrView(body, bodyLen);
+            return true;
+        }
+        if (frame.len == 0 || frame.data[frame.len - 1] != '\n') return false;
+        return decodeText(StrView(frame.data, frame.len - 1), out);
+    }
+
+    // 解析 peekFrame 切出的一个完整帧，自动识别文本/二进制
+    static bool decodeFrame(const char* data, size_t len, NetMsg& outMsg) {
+        NetMsgView view;
+        if (!decodeView(StrView(data, len), view)) return false;
+        outMsg.assign(view);
+        return true;
+    }
+
+    // 二进制反序列化：直接按偏移取字段，没有查找和数字转换
+    static bool decodeBinary(const char* data, size_t len, NetMsg& outMsg) {
+        if (len == 0 || (unsigned char)data[0] != BIN_MAGIC) return false;
+        return decodeFrame(data, len, outMsg);
     }
 
     // 【核心】反序列化：解析字符串到对象
     // 返回值: true 表示解析成功，false 表示失败（可能是粘包或非法包）
-    static bool decode(std::string raw, NetMsg& outMsg) {
+    static bool decode(const std::string& raw, NetMsg& outMsg) {
+        NetMsgView view;
+        if (!decodeText(raw, view)) return false;
+        outMsg.assign(view);
+        return true;
+    }
+
+    // 文本帧（不含结尾 \n）解析成视图
+    static bool decodeText(StrView raw, NetMsgView& out) {
         // 1. 校验协议头
-        if (raw.find(MSG_HEAD) != 0) return false; 
-        
+        size_t headLen = sizeof(MSG_HEAD) - 1;
+        if (raw.len < headLen || memcmp(raw.data, MSG_HEAD, headLen) != 0) return false;
+
         // 2. 查找分隔符位置
+        const char* end = raw.data + raw.len;
         // 第一个分隔符: HEAD 后面
-        size_t firstSep = raw.find(DELIMITER);
-        if (firstSep == std::string::npos) return false;
+        const char* firstSep = findSep(raw.data + headLen, end);
+        if (firstSep == NULL) return false;
 
         // 第二个分隔符: type 后面
-        size_t secondSep = raw.find(DELIMITER, firstSep + 1);
-        if (secondSep == std::string::npos) return false;
+        const char* secondSep = findSep(firstSep + 1, end);
+        if (secondSep == NULL) return false;
 
         // 第三个分隔符: targetId 后面
-        size_t thirdSep = raw.find(DELIMITER, secondSep + 1);
-        if (thirdSep == std::string::npos) return false;
+        const char* thirdSep = findSep(secondSep + 1, end);
+        if (thirdSep == NULL) return false;
 
         // 3. 提取字段
-        try {
-            // 提取 Type (char)
-            // firstSep + 1 位置的一个字符
-            char type = raw[firstSep + 1];
-            
-            // 提取 TargetId (int)
-            std::string idStr = raw.substr(secondSep + 1, thirdSep - secondSep - 1);
-            int targetId = std::stoi(idStr);
-
-            // 提取 Content (string)
-            // 从第三个分隔符之后直到末尾
-            std::string content = raw.substr(thirdSep + 1);
-
-            // 赋值给输出对象
-            outMsg = NetMsg(type, content, targetId);
-            return true;
-        } catch (...) {
-            // 如果 stoi 失败或越界
-            return false;
+        // 提取 TargetId (int)，规则与 std::stoi 相同：允许前导空白和符号，忽略数字后的多余字符
+        int targetId;
+        if (!parseInt(secondSep + 1, thirdSep, targetId)) return false;
+
+        // 提取 Type (char): firstSep + 1 位置的一个字符，后面可以跟 :corrId
+        out.type = firstSep[1];
+        out.corrId = 0;
+        if (secondSep - firstSep > 3 && firstSep[2] == ':') {
+            uint64_t corrId = 0;
+            for (const char* c = firstSep + 3; c < secondSep && *c >= '0' && *c <= '9'; c++) {
+                corrId = corrId * 10 + (uint32_t)(*c - '0');
+                if (corrId > 0xFFFFFFFFULL) return false; // 越界：不能回绕成别的请求的 ID
+            }
+            out.corrId = (uint32_t)corrId;
         }
+        out.targetId = targetId;
+        // 提取 Content: 从第三个分隔符之后直到末尾
+        out.payload = StrView(thirdSep + 1, end - thirdSep - 1);
+        return true;
+    }
+
+private:
+    // 从视图拷贝字段，复用 _payload 已有的容量
+    void assign(const NetMsgView& view) {
+        _type = view.type;
+        _targetId = view.targetId;
+        _corrId = view.corrId;
+        _payload.assign(view.payload.data, view.payload.len);
+    }
+
+    static const char* findSep(const char* from, const char* end) {
+        if (from >= end) return NULL;
+        return (const char*)memchr(from, DELIMITER[0], end - from);
+    }
+
+    static bool parseInt(const char* p, const char* end, int& out) {
+        while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) p++;
+        bool neg = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            neg = (*p == '-');
+            p++;
+        }
+        if (p >= end || *p < '0' || *p > '9') return false;
+        long long v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            v = v * 10 + (*p - '0');
+            if (v > 2147483648LL) return false; // 越界
+            p++;
+        }
+        if (neg) v = -v;
+        if (v > 2147483647LL) return false;
+        out = (int)v;
+        return true;
+    }
+
+    // 十进制格式化，返回长度
+    static size_t formatInt(char* buf, int value) {
+        if (value >= 0) return formatUInt(buf, (uint32_t)value);
+        buf[0] = '-';
+        return 1 + formatUInt(buf + 1, 0u - (uint32_t)value);
+    }
+
+    static size_t formatUInt(char* buf, uint32_t value) {
+        char tmp[16];
+        size_t n = 0;
+        do {
+            tmp[n++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+        size_t len = 0;
+        while (n) buf[len++] = tmp[--n];
+        return len;
+    }
+
+    // 按网络字节序读写 32 位整数（不要求对齐）
+    static void putU32(char* p, uint32_t v) {
+        p[0] = (char)(v >> 24);
+        p[1] = (char)(v >> 16);
+        p[2] = (char)(v >> 8);
+        p[3] = (char)v;
+    }
+
+    static uint32_t getU32(const char* p) {
+        const unsigned char* u = (const unsigned char*)p;
+        return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | (uint32_t)u[3];
     }
 };
 
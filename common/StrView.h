@@ -0,0 +1,37 @@
+#ifndef STR_VIEW_H
+#define STR_VIEW_H
+
+#include <string>
+#include <cstring>
+#include <ostream>
+
+// 只读字符串视图：指针 + 长度，不拥有内存（项目使用 C++11，没有 std::string_view）
+// 视图指向的缓冲区被修改或释放后，视图随之失效
+struct StrView {
+    const char* data;
+    size_t len;
+
+    StrView() : data(""), len(0) {}
+    StrView(const char* d, size_t n) : data(d), len(n) {}
+    StrView(const char* s) : data(s), len(strlen(s)) {}
+    StrView(const std::string& s) : data(s.data()), len(s.size()) {}
+
+    bool empty() const { return len == 0; }
+    size_t size() const { return len; }
+    char operator[](size_t i) const { return data[i]; }
+
+    // 需要持有内容时才拷贝
+    std::string str() const { return std::string(data, len); }
+
+    bool operator==(const StrView& o) const {
+        return len == o.len && (len == 0 || memcmp(data, o.data, len) == 0);
+    }
+    bool operator!=(const StrView& o) const { return !(*this == o); }
+};
+
+// 直接输出视图内容（按长度写，不要求以 \0 结尾）
+inline std::ostream& operator<<(std::ostream& os, const StrView& v) {
+    return os.write(v.data, v.len);
+}
+
+#endif
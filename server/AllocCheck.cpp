@@ -0,0 +1,293 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "TcpServer.h"
+#include "Config.h"
+#include "Logger.h"
+#include "../common/NetMsg.h"
+#include "../common/BufferPool.h"
+
+using namespace std;
+
+// 转发路径的分配检查：在进程内启动服务器，用原始套接字持续发送转发（'S'）和广播（'A'），
+// 预热之后统计 operator new 和内存池向 malloc 要内存的次数，超过每 ALLOC_CHECK_MSGS_PER_ALLOC 条投递一次就失败（退出码 1）。
+// 覆盖 handleForwardReq 同一个 Reactor 内直接 sendRaw、跨 Reactor 经 postToLoop 投递，以及 fanOut，
+// 在线程模式、epoll（单 Reactor 和多 Reactor）和 io_uring 下，文本帧和二进制帧各跑一遍。
+//
+//   ./alloccheck [-m thread|epoll|uring] [-n 轮数] [-p 端口]
+//
+// 多 Reactor 时连接由 SO_REUSEPORT 分到各个 Reactor，ALLOC_CHECK_PAIRS 对连接里几乎总有同一个和不同 Reactor 的。
+// 服务器和检查端在同一个进程里，io_uring 模式下检查端的阻塞调用可能返回 EINTR（外部客户端不会），收发都要重试。
+// 检查端自己只在预热前分配内存，统计窗口里的分配都来自服务器。不要求严格为 0：块在 Reactor 之间流动时，
+// 内存池偶尔还要再切一块 slab（摊到几百个块上）；每条消息都分配时比容许的多出几个数量级。
+
+#define ALLOC_CHECK_PORT (SERVER_PORT + 50) // 默认端口，避开正在运行的服务器
+#define ALLOC_CHECK_PAIRS 16                // 发送方/接收方连接对数
+#define ALLOC_CHECK_BATCH 32                // 每轮每个发送方连续发出的消息数，接收方的套接字缓冲区放得下
+#define ALLOC_CHECK_WARMUP 50               // 预热轮数：填满线程缓存、scratch 缓冲区和各种复用的容量
+#define ALLOC_CHECK_ROUNDS 300              // 默认统计轮数
+#define ALLOC_CHECK_PAYLOAD 100             // 消息正文长度
+#define ALLOC_CHECK_MSGS_PER_ALLOC 10000    // 容许的分配次数：每这么多条投递一次
+
+// ---------- 分配计数：全局 operator new，加上内存池向 malloc 要内存的次数 ----------
+
+static atomic<uint64_t> g_news(0);
+
+void* operator new(size_t n) {
+    g_news.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+static uint64_t allocCount() {
+    PoolStats stats;
+    BufferPool::stats(stats);
+    return g_news.load(memory_order_relaxed) + stats.mallocs;
+}
+
+// ---------- 检查端的连接 ----------
+
+struct Conn {
+    int fd;
+    int id;
+    string expect;  // 这个连接每收到一条消息应该收到的完整帧
+    size_t offset;  // 下一个收到的字节在 expect 中的位置
+
+    Conn() : fd(-1), id(0), offset(0) {}
+};
+
+static bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+// 收 count 个帧，逐字节和预期的帧比较。超时、断开或内容不对返回 false
+static bool recvFrames(Conn& conn, size_t count) {
+    static char buf[64 * 1024];
+    size_t left = count * conn.expect.size();
+    while (left > 0) {
+        ssize_t n = recv(conn.fd, buf, min(left, sizeof(buf)), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != conn.expect[conn.offset]) return false;
+            if (++conn.offset == conn.expect.size()) conn.offset = 0;
+        }
+        left -= n;
+    }
+    return true;
+}
+
+// 连接并协商帧格式，服务器的应答（总是文本帧）带回分配的 ID
+static bool openConn(int port, bool binary, Conn& conn) {
+    conn.fd = -1;
+    conn.offset = 0;
+    for (int attempt = 0; attempt < 100 && conn.fd < 0; attempt++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+            conn.fd = fd;
+        } else {
+            close(fd);
+            usleep(20 * 1000); // 服务器还没开始监听
+        }
+    }
+    if (conn.fd < 0) return false;
+
+    int one = 1;
+    setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval tv = {5, 0};
+    setsockopt(conn.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    string req;
+    NetMsg::encodeTo(req, 'B', 0, binary ? PROTO_BINARY_CAP : "TEXT", false);
+    if (!sendAll(conn.fd, req)) return false;
+
+    string reply;
+    char c;
+    while (reply.empty() || reply[reply.size() - 1] != '\n') {
+        ssize_t n = recv(conn.fd, &c, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 1) return false;
+        reply += c;
+    }
+    NetMsgView msg;
+    if (!NetMsg::decodeView(reply, msg) || msg.type != 'B') return false;
+    conn.id = msg.targetId;
+    return true;
+}
+
+// 服务器把 sourceId 发来的 content 转给 target 时编码出的帧，和 handleForwardReq/fanOut 一致
+static string deliveredFrame(char type, int sourceId, const string& content, bool binary) {
+    char prefix[32];
+    int prefixLen = snprintf(prefix, sizeof(prefix), "[From %d]: ", sourceId);
+    string frame;
+    NetMsg::encodeTo(frame, type, sourceId, StrView(prefix, prefixLen), content, binary);
+    return frame;
+}
+
+// ---------- 一种线程模型 + 帧格式 + 发送方式的检查 ----------
+
+struct CaseResult {
+    uint64_t msgs;      // 投递的消息数，广播时每个接收方各算一条
+    uint64_t allocs;
+    bool ok;
+};
+
+// broadcast 为 false 时第 i 个发送方给第 i 个接收方发 'S'；为 true 时第一个发送方发 'A'，其余所有连接都收到
+static CaseResult runCase(vector<Conn>& senders, vector<Conn>& receivers, bool binary, bool broadcast, int rounds) {
+    CaseResult result = {0, 0, false};
+    string content(ALLOC_CHECK_PAYLOAD, 'x');
+
+    // 每个发送方一轮发出的数据和每个接收方应该收到的帧都在预热前准备好
+    vector<string> batches(senders.size());
+    vector<Conn*> sinks;
+    if (broadcast) {
+        for (int k = 0; k < ALLOC_CHECK_BATCH; k++) NetMsg::encodeTo(batches[0], 'A', 0, content, binary);
+        for (size_t i = 1; i < senders.size(); i++) sinks.push_back(&senders[i]);
+        for (size_t i = 0; i < receivers.size(); i++) sinks.push_back(&receivers[i]);
+        for (size_t i = 0; i < sinks.size(); i++) {
+            sinks[i]->expect = deliveredFrame('A', senders[0].id, content, binary);
+        }
+    } else {
+        for (size_t i = 0; i < senders.size(); i++) {
+            for (int k = 0; k < ALLOC_CHECK_BATCH; k++) {
+                NetMsg::encodeTo(batches[i], 'S', receivers[i].id, content, binary);
+            }
+            receivers[i].expect = deliveredFrame('S', senders[i].id, content, binary);
+            sinks.push_back(&receivers[i]);
+        }
+    }
+    for (size_t i = 0; i < sinks.size(); i++) sinks[i]->offset = 0;
+
+    uint64_t before = 0;
+    for (int round = 0; round < ALLOC_CHECK_WARMUP + rounds; round++) {
+        if (round == ALLOC_CHECK_WARMUP) before = allocCount();
+        for (size_t i = 0; i < batches.size(); i++) {
+            if (!batches[i].empty() && !sendAll(senders[i].fd, batches[i])) return result;
+        }
+        for (size_t i = 0; i < sinks.size(); i++) {
+            if (!recvFrames(*sinks[i], ALLOC_CHECK_BATCH)) return result;
+        }
+    }
+    result.allocs = allocCount() - before;
+    result.msgs = (uint64_t)rounds * ALLOC_CHECK_BATCH * sinks.size();
+    result.ok = true;
+    return result;
+}
+
+// 启动一个服务器，文本帧和二进制帧下分别检查转发和广播。全部通过返回 true
+static bool runMode(const char* mode, const char* threads, int port, int rounds) {
+    ServerConfig cfg;
+    string err;
+    if (!ConfigFile::set(cfg, "mode", mode, err) || !ConfigFile::set(cfg, "threads", threads, err)) {
+        cerr << err << endl;
+        return false;
+    }
+    cfg.port = port;
+    cfg.drainTimeoutMs = 1000;
+
+    char label[32];
+    snprintf(label, sizeof(label), cfg.mode == MODE_THREAD ? "%s" : "%s x%s", mode, threads); // 例如 "epoll x4"
+
+    TcpServer server(cfg);
+    thread serverThread([&server]() { server.start(); });
+
+    bool passed = true;
+    for (int binary = 0; binary < 2; binary++) {
+        vector<Conn> senders(ALLOC_CHECK_PAIRS), receivers(ALLOC_CHECK_PAIRS);
+        bool connected = true;
+        for (int i = 0; i < ALLOC_CHECK_PAIRS && connected; i++) {
+            connected = openConn(port, binary, senders[i]) && openConn(port, binary, receivers[i]);
+        }
+
+        for (int broadcast = 0; broadcast < 2 && connected; broadcast++) {
+            CaseResult r = runCase(senders, receivers, binary, broadcast, rounds);
+            double perMsg = r.msgs ? (double)r.allocs / r.msgs : 0;
+            bool ok = r.ok && r.allocs * ALLOC_CHECK_MSGS_PER_ALLOC <= r.msgs;
+            printf("%-9s  %-6s  %-9s  %8llu msgs  %6llu allocs  %.6f allocs/msg  %s\n",
+                   label, binary ? "binary" : "text", broadcast ? "broadcast" : "forward",
+                   (unsigned long long)r.msgs, (unsigned long long)r.allocs, perMsg,
+                   !r.ok ? "FAILED (lost or corrupted messages)" : ok ? "ok" : "FAILED");
+            if (!ok) passed = false;
+        }
+        if (!connected) {
+            printf("%-9s  %-6s  FAILED (cannot connect)\n", label, binary ? "binary" : "text");
+            passed = false;
+        }
+
+        for (int i = 0; i < ALLOC_CHECK_PAIRS; i++) {
+            if (senders[i].fd >= 0) close(senders[i].fd);
+            if (receivers[i].fd >= 0) close(receivers[i].fd);
+        }
+    }
+
+    server.stop();
+    serverThread.join();
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    const char* only = NULL;
+    int rounds = ALLOC_CHECK_ROUNDS;
+    int port = ALLOC_CHECK_PORT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else {
+            cerr << "Usage: " << argv[0] << " [-m thread|epoll|uring] [-n rounds] [-p port]" << endl;
+            return 2;
+        }
+    }
+
+    // 连接建立和断开的日志不关心，日志线程也不启动（不在统计窗口里分配内存）
+    Logger::instance().setLevel(LOG_LEVEL_WARN);
+
+    static const struct {
+        const char* mode;
+        const char* threads;
+    } MODES[] = {
+        {"thread", "1"},
+        {"epoll", "1"},   // 全部在同一个 Reactor：sendRaw
+        {"epoll", "4"},   // 大多跨 Reactor：postToLoop
+        {"uring", "4"},
+    };
+
+    bool passed = true;
+    for (size_t i = 0; i < sizeof(MODES) / sizeof(MODES[0]); i++) {
+        if (only && strcmp(only, MODES[i].mode) != 0) continue;
+        if (!runMode(MODES[i].mode, MODES[i].threads, port, rounds)) passed = false;
+    }
+    printf("%s\n", passed ? "PASSED: no per-message allocations on the forward path" : "FAILED");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+#ifndef CLIENT_ROSTER_H
+#define CLIENT_ROSTER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <stdint.h>
+
+#define LIST_PAGE_MAX 1000  // 分页列表每页最多的行数
+
+// 在线列表：按 ID 排序的 <ID, 显示信息>，带版本号，供分页查询和增量订阅
+//
+// 和 ShardedRegistry 分开：转发只查注册表，不碰这里的锁。每次上线/下线版本号加一，
+// 分页查询只在锁内拷贝一页（O(log n + 每页行数)），不再为一次 'L' 遍历全部连接。
+// 订阅者列表写时复制（同 TopicRegistry），推送增量时在锁外遍历。
+class ClientRoster {
+public:
+    typedef std::shared_ptr<const std::vector<int> > Watchers;
+    typedef std::vector<std::pair<int, std::string> > Rows;
+
+    ClientRoster() : _version(0), _watchers(std::make_shared<std::vector<int> >()) {}
+
+    // 上线，返回新的版本号
+    uint64_t add(int id, const std::string& info) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _entries[id] = info;
+        return ++_version;
+    }
+
+    // 下线，返回新的版本号；不在列表里返回 0
+    uint64_t remove(int id) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_entries.erase(id) == 0) return 0;
+        return ++_version;
+    }
+
+    // 取 ID 大于 afterId 的前 limit 行，返回这一页对应的版本号
+    // next 为本页最后一行的 ID（后面没有了为 0），total 为当前在线总数
+    uint64_t page(int afterId, size_t limit, Rows& rows, int& next, size_t& total) const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        std::map<int, std::string>::const_iterator it = _entries.upper_bound(afterId);
+        for (; it != _entries.end() && rows.size() < limit; ++it) {
+            rows.push_back(*it);
+        }
+        next = (it != _entries.end() && !rows.empty()) ? rows.back().first : 0;
+        total = _entries.size();
+        return _version;
+    }
+
+    // 订阅增量，返回当前版本号：此后的每次变化（版本号更大）都会推送给订阅者
+    uint64_t watch(int id) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (std::find(_watchers->begin(), _watchers->end(), id) == _watchers->end()) {
+            std::shared_ptr<std::vector<int> > next = std::make_shared<std::vector<int> >(*_watchers);
+            next->push_back(id);
+            _watchers = next;
+        }
+        return _version;
+    }
+
+    // 退订，返回当前版本号
+    uint64_t unwatch(int id) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        std::vector<int>::const_iterator it = std::find(_watchers->begin(), _watchers->end(), id);
+        if (it == _watchers->end()) return _version;
+        std::shared_ptr<std::vector<int> > next = std::make_shared<std::vector<int> >(*_watchers);
+        next->erase(next->begin() + (it - _watchers->begin()));
+        _watchers = next;
+        return _version;
+    }
+
+    // 当前订阅者（在变化之后读取，不会漏掉刚登记的订阅者）
+    Watchers watchers() const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        return _watchers;
+    }
+
+private:
+    mutable std::mutex _mtx;
+    std::map<int, std::string> _entries;
+    uint64_t _version;
+    Watchers _watchers;
+};
+
+#endif
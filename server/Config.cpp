@@ -0,0 +1,241 @@
+#include "Config.h"
+#include "Logger.h"
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+
+using namespace std;
+
+// --- 值的解析 ---
+
+static bool parseInt(const string& value, int& out) {
+    if (value.empty()) return false;
+    char* end;
+    errno = 0;
+    long v = strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || errno != 0 || v < 0 || v > INT_MAX) return false;
+    out = (int)v;
+    return true;
+}
+
+// 字节数，可以带 K/M/G 后缀
+static bool parseBytes(const string& value, size_t& out) {
+    if (value.empty()) return false;
+    char* end;
+    errno = 0;
+    unsigned long long v = strtoull(value.c_str(), &end, 10);
+    if (end == value.c_str() || errno != 0) return false;
+    switch (*end) {
+        case 'k': case 'K': v <<= 10; end++; break;
+        case 'm': case 'M': v <<= 20; end++; break;
+        case 'g': case 'G': v <<= 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0') return false;
+    out = (size_t)v;
+    return true;
+}
+
+static bool parseBytesInt(const string& value, int& out) {
+    size_t v;
+    if (!parseBytes(value, v) || v > INT_MAX) return false;
+    out = (int)v;
+    return true;
+}
+
+static bool parseBool(const string& value, bool& out) {
+    if (value == "1" || value == "on" || value == "true" || value == "yes") {
+        out = true;
+        return true;
+    }
+    if (value == "0" || value == "off" || value == "false" || value == "no") {
+        out = false;
+        return true;
+    }
+    return false;
+}
+
+// 日志限速 "类别:每秒条数[:采样间隔]"，如 forward:500:10
+static bool parseLogLimit(const string& value) {
+    size_t colon = value.find(':');
+    if (colon == string::npos) return false;
+    LogCategory cat;
+    if (!Logger::parseCategory(value.substr(0, colon).c_str(), cat)) return false;
+    char* end;
+    uint32_t perSecond = strtoul(value.c_str() + colon + 1, &end, 10);
+    uint32_t sampleEvery = (*end == ':') ? strtoul(end + 1, NULL, 10) : 1;
+    Logger::instance().setLimit(cat, perSecond, sampleEvery);
+    return true;
+}
+
+// --- 配置项表 ---
+
+typedef bool (*OptionSetter)(ServerConfig& cfg, const string& value);
+
+struct ConfigOption {
+    const char* key;
+    const char* help;
+    OptionSetter apply;
+};
+
+static const ConfigOption OPTIONS[] = {
+    // 线程模型
+    {"mode", "thread|epoll|uring", [](ServerConfig& c, const string& v) {
+        // uring 是 Reactor 模式换用 io_uring 收发，内核不支持时退回 epoll
+        c.ioUring = (v == "uring");
+        if (v == "epoll" || v == "uring") c.mode = MODE_EPOLL;
+        else if (v == "thread") c.mode = MODE_THREAD;
+        else return false;
+        return true;
+    }},
+    {"threads", "reactor threads in epoll mode", [](ServerConfig& c, const string& v) {
+        return parseInt(v, c.loopThreads) && c.loopThreads > 0;
+    }},
+    {"pin_cpu", "pin reactor i to CPU i (bool)", [](ServerConfig& c, const string& v) { return parseBool(v, c.pinCpu); }},
+
+    // 监听与套接字选项
+    {"bind", "listen address (IPv4)", [](ServerConfig& c, const string& v) {
+        c.bindAddr = v;
+        return !v.empty();
+    }},
+    {"port", "listen port", [](ServerConfig& c, const string& v) {
+        return parseInt(v, c.port) && c.port > 0 && c.port < 65536;
+    }},
+    {"backlog", "listen backlog", [](ServerConfig& c, const string& v) {
+        return parseInt(v, c.backlog) && c.backlog > 0;
+    }},
+    {"recv_chunk", "bytes reserved per recv", [](ServerConfig& c, const string& v) {
+        return parseBytes(v, c.recvChunk) && c.recvChunk >= 64;
+    }},
+    {"tcp_nodelay", "TCP_NODELAY (bool, default on)", [](ServerConfig& c, const string& v) { return parseBool(v, c.tcpNoDelay); }},
+    {"rcvbuf", "SO_RCVBUF bytes, 0 = kernel autotuning", [](ServerConfig& c, const string& v) { return parseBytesInt(v, c.rcvBuf); }},
+    {"sndbuf", "SO_SNDBUF bytes, 0 = kernel autotuning", [](ServerConfig& c, const string& v) { return parseBytesInt(v, c.sndBuf); }},
+    {"defer_accept", "TCP_DEFER_ACCEPT seconds, 0 = off", [](ServerConfig& c, const string& v) { return parseInt(v, c.deferAcceptSec); }},
+    {"keepalive", "SO_KEEPALIVE (bool)", [](ServerConfig& c, const string& v) { return parseBool(v, c.keepAlive); }},
+    {"keepalive_idle", "TCP_KEEPIDLE seconds", [](ServerConfig& c, const string& v) { return parseInt(v, c.keepIdleSec); }},
+    {"keepalive_interval", "TCP_KEEPINTVL seconds", [](ServerConfig& c, const string& v) { return parseInt(v, c.keepIntervalSec); }},
+    {"keepalive_count", "TCP_KEEPCNT probes", [](ServerConfig& c, const string& v) { return parseInt(v, c.keepCount); }},
+
+    // accept
+    {"accept_batch", "max connections accepted per wakeup", [](ServerConfig& c, const string& v) {
+        return parseInt(v, c.acceptBatch) && c.acceptBatch > 0;
+    }},
+    {"conn_rate", "new connections per second per IP, 0 = unlimited", [](ServerConfig& c, const string& v) { return parseInt(v, c.connRatePerIp); }},
+    {"conn_burst", "per-IP connection burst, 0 = conn_rate", [](ServerConfig& c, const string& v) { return parseInt(v, c.connBurstPerIp); }},
+
+    // 发送队列
+    {"high_water", "send queue high watermark, bytes", [](ServerConfig& c, const string& v) { return parseBytes(v, c.outHighWater); }},
+    {"low_water", "send queue low watermark, bytes", [](ServerConfig& c, const string& v) { return parseBytes(v, c.outLowWater); }},
+    {"slow_policy", "drop|disconnect|backpressure", [](ServerConfig& c, const string& v) {
+        if (v == "drop") c.slowPolicy = SLOW_DROP;
+        else if (v == "disconnect") c.slowPolicy = SLOW_DISCONNECT;
+        else if (v == "backpressure") c.slowPolicy = SLOW_BACKPRESSURE;
+        else return false;
+        return true;
+    }},
+    {"zero_copy", "MSG_ZEROCOPY threshold, bytes, 0 = off", [](ServerConfig& c, const string& v) { return parseBytes(v, c.zeroCopyThreshold); }},
+    {"compress_min", "compress sends of at least this many bytes, 0 = refuse compression", [](ServerConfig& c, const string& v) { return parseBytes(v, c.compressMin); }},
+
+    // 统计、关闭与热重启
+    {"stats_port", "stats port on 127.0.0.1, 0 = off", [](ServerConfig& c, const string& v) { return parseInt(v, c.statsPort); }},
+    {"drain_ms", "graceful shutdown deadline", [](ServerConfig& c, const string& v) { return parseInt(v, c.drainTimeoutMs); }},
+    {"handoff_path", "hot restart socket path", [](ServerConfig& c, const string& v) {
+        c.handoffPath = v;
+        return true;
+    }},
+
+    // 超时与心跳
+    {"heartbeat_ms", "ping after this much silence, 0 = off", [](ServerConfig& c, const string& v) { return parseInt(v, c.heartbeatMs); }},
+    {"idle_timeout_ms", "close after no requests, 0 = off", [](ServerConfig& c, const string& v) { return parseInt(v, c.idleTimeoutMs); }},
+    {"read_timeout_ms", "close on a stalled partial frame, 0 = off", [](ServerConfig& c, const string& v) { return parseInt(v, c.readTimeoutMs); }},
+
+    // 会话与离线消息
+    {"store_dir", "offline message log directory, empty = off", [](ServerConfig& c, const string& v) {
+        c.storeDir = v;
+        return true;
+    }},
+    {"store_segment", "log segment file size, bytes", [](ServerConfig& c, const string& v) {
+        return parseBytes(v, c.storeSegmentBytes) && c.storeSegmentBytes >= 64 * 1024 &&
+               c.storeSegmentBytes <= UINT32_MAX;
+    }},
+    {"offline_max", "queued offline messages per session", [](ServerConfig& c, const string& v) {
+        int n;
+        if (!parseInt(v, n) || n <= 0) return false;
+        c.offlineMax = n;
+        return true;
+    }},
+    {"session_ttl", "seconds a session may stay offline, 0 = forever", [](ServerConfig& c, const string& v) {
+        return parseInt(v, c.sessionTtlSec) && c.sessionTtlSec >= 0;
+    }},
+
+    // 日志（不在 ServerConfig 里，直接设置 Logger）
+    {"log_level", "debug|info|warn|error", [](ServerConfig&, const string& v) {
+        LogLevel level;
+        if (!Logger::parseLevel(v.c_str(), level)) return false;
+        Logger::instance().setLevel(level);
+        return true;
+    }},
+    {"log_limit", "category:perSecond[:sampleEvery], repeatable", [](ServerConfig&, const string& v) { return parseLogLimit(v); }},
+};
+
+static const size_t OPTION_COUNT = sizeof(OPTIONS) / sizeof(OPTIONS[0]);
+
+static string trim(const string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == string::npos) return string();
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+bool ConfigFile::set(ServerConfig& cfg, const string& key, const string& value, string& err) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        if (key != OPTIONS[i].key) continue;
+        if (OPTIONS[i].apply(cfg, value)) return true;
+        err = "invalid value for " + key + ": '" + value + "' (" + OPTIONS[i].help + ")";
+        return false;
+    }
+    err = "unknown option: " + key;
+    return false;
+}
+
+bool ConfigFile::setPair(ServerConfig& cfg, const string& pair, string& err) {
+    size_t eq = pair.find('=');
+    if (eq == string::npos) {
+        err = "expected key=value: " + pair;
+        return false;
+    }
+    return set(cfg, trim(pair.substr(0, eq)), trim(pair.substr(eq + 1)), err);
+}
+
+bool ConfigFile::load(const char* path, ServerConfig& cfg, string& err) {
+    ifstream in(path);
+    if (!in) {
+        err = string(path) + ": " + strerror(errno);
+        return false;
+    }
+    string line;
+    int lineNo = 0;
+    while (getline(in, line)) {
+        lineNo++;
+        size_t hash = line.find('#');
+        if (hash != string::npos) line.erase(hash);
+        line = trim(line);
+        if (line.empty()) continue;
+        string why;
+        if (!setPair(cfg, line, why)) {
+            err = string(path) + ":" + to_string(lineNo) + ": " + why;
+            return false;
+        }
+    }
+    return true;
+}
+
+void ConfigFile::printKeys(ostream& out) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        out << "    " << OPTIONS[i].key;
+        for (size_t n = strlen(OPTIONS[i].key); n < 20; n++) out << ' ';
+        out << OPTIONS[i].help << "\n";
+    }
+}
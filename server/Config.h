@@ -0,0 +1,33 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <ostream>
+#include "TcpServer.h"
+
+// 配置文件：每行一项 "key = value"，# 之后为注释，空行忽略。例如
+//
+//   mode = epoll
+//   threads = 8
+//   backlog = 4096
+//   rcvbuf = 256K
+//   log_limit = forward:500:10   # 可以出现多次
+//
+// 命令行在配置文件之后生效：-o key=value 可以覆盖任意一项，原有的 -m/-t/-w 等参数也照常覆盖。
+// 字节数可以带 K/M/G 后缀，开关可以写 1/0、on/off、true/false、yes/no。
+class ConfigFile {
+public:
+    // 读取配置文件，出错时 err 为 "文件:行号: 原因"
+    static bool load(const char* path, ServerConfig& cfg, std::string& err);
+
+    // 设置一项（配置文件的每一行和命令行的 -o 都走这里）
+    static bool set(ServerConfig& cfg, const std::string& key, const std::string& value, std::string& err);
+
+    // 解析 "key=value" 形式的一项
+    static bool setPair(ServerConfig& cfg, const std::string& pair, std::string& err);
+
+    // 列出所有配置项（用法说明）
+    static void printKeys(std::ostream& out);
+};
+
+#endif
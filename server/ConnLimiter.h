@@ -0,0 +1,84 @@
+#ifndef CONN_LIMITER_H
+#define CONN_LIMITER_H
+
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+#define CONN_LIMITER_SHARDS 16          // 分片数，多个 Reactor 同时 accept 时减少锁竞争
+#define CONN_LIMITER_SWEEP_SIZE 4096    // 分片里的 IP 超过这么多时清理已经攒满令牌的条目
+
+// 按源 IP 的新连接速率限制：令牌桶，每个 IP 每秒补充 rate 个令牌，最多攒 burst 个，每个新连接消耗一个
+//
+// 只在 accept 时调用一次，不在消息的热路径上。令牌在调用时按经过的时间补充，不需要定时器。
+// 攒满令牌的 IP 与从没见过的 IP 等价，分片变大时把它们删掉，内存只与最近活跃的 IP 数有关。
+class ConnLimiter {
+public:
+    ConnLimiter() : _rate(0), _burst(0) {}
+
+    // rate 为 0 表示不限制；burst 为 0 时取 rate
+    void configure(int rate, int burst) {
+        _rate = rate;
+        _burst = burst > 0 ? burst : rate;
+    }
+
+    bool enabled() const { return _rate > 0; }
+
+    // ip 为网络字节序，nowMs 为单调时钟毫秒。返回 false 表示超过了限制
+    bool allow(uint32_t ip, uint64_t nowMs) {
+        Shard& shard = _shards[(ip * 2654435761u) >> 28]; // 乘法散列取高 4 位
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (shard.buckets.size() > CONN_LIMITER_SWEEP_SIZE && nowMs - shard.lastSweepMs >= 1000) {
+            sweep(shard, nowMs); // 每秒最多一次：来自大量 IP 的风暴中每次都扫会变成 O(n)
+            shard.lastSweepMs = nowMs;
+        }
+
+        std::unordered_map<uint32_t, Bucket>::iterator it = shard.buckets.find(ip);
+        if (it == shard.buckets.end()) {
+            Bucket b;
+            b.tokens = _burst - 1;
+            b.lastMs = nowMs;
+            shard.buckets[ip] = b;
+            return true;
+        }
+        Bucket& b = it->second;
+        b.tokens += (double)(nowMs - b.lastMs) * _rate / 1000.0;
+        if (b.tokens > _burst) b.tokens = _burst;
+        b.lastMs = nowMs;
+        if (b.tokens < 1.0) return false;
+        b.tokens -= 1.0;
+        return true;
+    }
+
+private:
+    struct Bucket {
+        double tokens;      // 剩余令牌
+        uint64_t lastMs;    // 上次补充的时间
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<uint32_t, Bucket> buckets;
+        uint64_t lastSweepMs;
+
+        Shard() : lastSweepMs(0) {}
+    };
+
+    // 删掉到现在已经补满的条目
+    void sweep(Shard& shard, uint64_t nowMs) {
+        uint64_t fullMs = (uint64_t)_burst * 1000 / _rate + 1;
+        for (std::unordered_map<uint32_t, Bucket>::iterator it = shard.buckets.begin(); it != shard.buckets.end();) {
+            if (nowMs - it->second.lastMs >= fullMs) {
+                it = shard.buckets.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    int _rate;
+    int _burst;
+    Shard _shards[CONN_LIMITER_SHARDS];
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "Handoff.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+using namespace std;
+
+static bool makeAddr(const std::string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+int handoffListen(const std::string& path) {
+    sockaddr_un addr;
+    if (!makeAddr(path, addr)) return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    unlink(path.c_str()); // 上一代进程留下的路径，它自己的监听套接字不受影响
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, 4) < 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+int handoffConnect(const std::string& path) {
+    sockaddr_un addr;
+    if (!makeAddr(path, addr)) return -1;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(sock);
+        errno = err;
+        return -1;
+    }
+    return sock;
+}
+
+bool handoffSendFds(int sock, const std::string& line, const std::vector<int>& fds) {
+    if (fds.empty() || fds.size() > HANDOFF_MAX_FDS) return false;
+
+    iovec iov;
+    iov.iov_base = (void*)line.data();
+    iov.iov_len = line.size();
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()), 0);
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)line.size(); // 描述很短，一次就能发完
+}
+
+bool handoffRecvFds(int sock, std::string& line, std::vector<int>& fds) {
+    char buf[256];
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS), 0);
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    line.assign(buf, n);
+
+    fds.clear();
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = (const int*)CMSG_DATA(cmsg);
+        fds.insert(fds.end(), data, data + count);
+    }
+    if (msg.msg_flags & MSG_CTRUNC) {
+        // 描述符被截断：收到的也不能用
+        for (size_t i = 0; i < fds.size(); i++) close(fds[i]);
+        fds.clear();
+        return false;
+    }
+    return !fds.empty();
+}
@@ -0,0 +1,29 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <vector>
+
+// 热重启：把监听套接字交给新进程
+//
+// 运行中的服务器在一个 Unix 域套接字上等待接管请求。新进程启动时先连接这个路径，
+// 旧进程用 SCM_RIGHTS 把所有监听套接字连同一行描述（"CHAT1 模式 个数"）发过去，
+// 新进程开始 accept 之后回一个 "OK"，旧进程随即停止 accept 并排空现有连接后退出。
+// 交接期间两个进程同时在同一组监听套接字上 accept，内核的 accept 队列不会丢连接。
+
+#define HANDOFF_MAGIC "CHAT1"
+#define HANDOFF_MAX_FDS 64
+
+// 在 path 上监听接管请求（先删除旧的路径），失败返回 -1
+int handoffListen(const std::string& path);
+
+// 连接 path 上的旧进程，没有旧进程返回 -1
+int handoffConnect(const std::string& path);
+
+// 发送一行描述和一组文件描述符
+bool handoffSendFds(int sock, const std::string& line, const std::vector<int>& fds);
+
+// 接收描述和文件描述符（收到的描述符已设置 FD_CLOEXEC）
+bool handoffRecvFds(int sock, std::string& line, std::vector<int>& fds);
+
+#endif
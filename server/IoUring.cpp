@@ -0,0 +1,276 @@
+#include "IoUring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+static int sysSetup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int sysRegister(int fd, unsigned op, void* arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+IoUring::IoUring()
+    : _fd(-1), _features(0),
+      _sqRing(nullptr), _sqRingSize(0), _sqes(nullptr), _sqesSize(0),
+      _sqHead(nullptr), _sqTail(nullptr), _sqArray(nullptr), _sqMask(0), _sqEntries(0), _sqLocalTail(0), _toSubmit(0),
+      _cqRing(nullptr), _cqRingSize(0), _cqes(nullptr), _cqHead(nullptr), _cqTail(nullptr), _cqMask(0),
+      _bufRing(nullptr), _bufRingSize(0), _bufBase(nullptr), _bufSize(0), _bufCount(0), _bufTail(0),
+      _inflight(0) {}
+
+IoUring::~IoUring() {
+    // 先关闭实例：内核取消所有未完成的请求，之后才能释放它们用到的缓冲区
+    if (_fd >= 0) close(_fd);
+    if (_bufRing) munmap(_bufRing, _bufRingSize);
+    if (_bufBase) munmap(_bufBase, _bufSize * _bufCount);
+    if (_sqes) munmap(_sqes, _sqesSize);
+    if (_cqRing && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+    if (_sqRing) munmap(_sqRing, _sqRingSize);
+}
+
+bool IoUring::init(unsigned entries, std::string& err) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // 只有本线程提交，完成事件的处理推迟到本线程等待时做，避免内核随时打断 Reactor 线程
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    _fd = sysSetup(entries, &p);
+    if (_fd < 0 && errno == EINVAL) {
+        // 老内核（6.1 之前）不认识这些标志
+        memset(&p, 0, sizeof(p));
+        _fd = sysSetup(entries, &p);
+    }
+    if (_fd < 0) {
+        err = string("io_uring_setup: ") + strerror(errno);
+        return false;
+    }
+    _features = p.features;
+    if (!(_features & IORING_FEAT_EXT_ARG) || !(_features & IORING_FEAT_NODROP)) {
+        err = "io_uring: kernel lacks EXT_ARG/NODROP";
+        return false;
+    }
+
+    _sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (_features & IORING_FEAT_SINGLE_MMAP) {
+        if (_cqRingSize > _sqRingSize) _sqRingSize = _cqRingSize;
+        _cqRingSize = _sqRingSize;
+    }
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED) {
+        _sqRing = nullptr;
+        err = string("io_uring mmap: ") + strerror(errno);
+        return false;
+    }
+    if (_features & IORING_FEAT_SINGLE_MMAP) {
+        _cqRing = _sqRing;
+    } else {
+        _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED) {
+            _cqRing = nullptr;
+            err = string("io_uring mmap: ") + strerror(errno);
+            return false;
+        }
+    }
+    _sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        err = string("io_uring mmap: ") + strerror(errno);
+        return false;
+    }
+    _sqes = (struct io_uring_sqe*)sqes;
+
+    char* sq = (char*)_sqRing;
+    _sqHead = (unsigned*)(sq + p.sq_off.head);
+    _sqTail = (unsigned*)(sq + p.sq_off.tail);
+    _sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    _sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    _sqArray = (unsigned*)(sq + p.sq_off.array);
+    _sqLocalTail = *_sqTail;
+    // 提交队列的下标数组固定为恒等映射，之后只推进 tail
+    for (unsigned i = 0; i < _sqEntries; i++) _sqArray[i] = i;
+
+    char* cq = (char*)_cqRing;
+    _cqHead = (unsigned*)(cq + p.cq_off.head);
+    _cqTail = (unsigned*)(cq + p.cq_off.tail);
+    _cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+bool IoUring::supported(std::string& why) {
+    IoUring ring;
+    if (!ring.init(8, why)) return false;
+
+    // 多次接收的 recv（6.0）没有单独的探测方式，用缓冲区环（5.19）和 SENDMSG/ACCEPT 是否支持近似判断
+    size_t probeLen = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = (struct io_uring_probe*)calloc(1, probeLen);
+    if (!probe) {
+        why = "out of memory";
+        return false;
+    }
+    bool ok = sysRegister(ring._fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    if (!ok) {
+        why = string("io_uring probe: ") + strerror(errno);
+    } else {
+        const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL };
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                why = "io_uring: required opcode not supported";
+                ok = false;
+                break;
+            }
+        }
+    }
+    free(probe);
+    if (ok) ok = ring.setupBuffers(0, 1, 64, why);
+    return ok;
+}
+
+bool IoUring::setupBuffers(uint16_t group, unsigned count, size_t size, std::string& err) {
+    if (count == 0 || (count & (count - 1)) != 0 || count > 32768) {
+        err = "io_uring: buffer count must be a power of two";
+        return false;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    _bufRingSize = (count * sizeof(struct io_uring_buf) + page - 1) / page * page;
+    void* ring = mmap(nullptr, _bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        err = string("io_uring buffer ring: ") + strerror(errno);
+        return false;
+    }
+    _bufRing = (struct io_uring_buf_ring*)ring;
+    // 缓冲区按需分配物理页：空闲时不占内存
+    void* base = mmap(nullptr, size * count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        err = string("io_uring buffers: ") + strerror(errno);
+        return false;
+    }
+    _bufBase = (char*)base;
+    _bufSize = size;
+    _bufCount = count;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)_bufRing;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (sysRegister(_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        err = string("io_uring register buffer ring: ") + strerror(errno);
+        return false;
+    }
+    _bufTail = 0;
+    for (unsigned i = 0; i < count; i++) recycleBuffer((uint16_t)i);
+    return true;
+}
+
+void IoUring::recycleBuffer(uint16_t bid) {
+    // 环的第 0 项和头部重叠（tail 占的是第 0 项的保留字段）。头文件里的 bufs 用的是柔性数组宏，
+    // 在 C++ 里前面多了一个空结构体，偏移变成 8，所以这里按起始地址自己算
+    struct io_uring_buf* b = (struct io_uring_buf*)_bufRing + (_bufTail & (_bufCount - 1));
+    b->addr = (uint64_t)(uintptr_t)buffer(bid);
+    b->len = (uint32_t)_bufSize;
+    b->bid = bid;
+    _bufTail++;
+    __atomic_store_n(&_bufRing->tail, _bufTail, __ATOMIC_RELEASE);
+}
+
+struct io_uring_sqe* IoUring::getSqe() {
+    unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    if (_sqLocalTail - head >= _sqEntries) {
+        // 提交队列满了：先把已准备的提交掉
+        submit();
+        head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    }
+    struct io_uring_sqe* sqe = &_sqes[_sqLocalTail & _sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    _sqLocalTail++;
+    _toSubmit++;
+    _inflight++;
+    return sqe;
+}
+
+void IoUring::prepAcceptMultishot(int fd, int flags, uint64_t userData) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = (uint32_t)flags;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = userData;
+}
+
+void IoUring::prepRecvMultishot(int fd, uint16_t group, uint64_t userData) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = userData;
+}
+
+void IoUring::prepSendmsg(int fd, const struct msghdr* msg, int flags, uint64_t userData) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = (uint32_t)flags;
+    sqe->user_data = userData;
+}
+
+void IoUring::prepPollMultishot(int fd, uint32_t events, uint64_t userData) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = userData;
+}
+
+void IoUring::prepCancel(uint64_t target, uint64_t userData) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+}
+
+void IoUring::prepCancelAll(uint64_t userData) {
+    struct io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = userData;
+}
+
+int IoUring::submitAndWait(unsigned waitNr, int timeoutMs) {
+    // 已经有完成事件就不等
+    // DEFER_TASKRUN 下完成事件只在带 GETEVENTS 进入内核时才生成，所以不等也总是带上它
+    if (waitNr > 0 && *_cqHead != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)) waitNr = 0;
+    __atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    unsigned toSubmit = _toSubmit;
+    int ret = sysEnter(_fd, toSubmit, waitNr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (ret < 0) return -errno;
+    // 提交了多少由内核的 head 决定（SUBMIT_ALL 下出错的请求也会产生完成事件）
+    _toSubmit -= (unsigned)ret < toSubmit ? (unsigned)ret : toSubmit;
+    return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <string>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// io_uring 的最小封装：直接用 io_uring_setup/io_uring_enter/io_uring_register 三个系统调用，不依赖 liburing
+//
+// 只提供 Reactor 用到的几种请求：多次接收的 accept 和 recv（multishot，挂一次持续产生完成事件）、sendmsg、
+// 多次触发的 poll（唤醒用的 eventfd）和取消。recv 的数据放在预先提供给内核的缓冲区环里（provided buffer ring），
+// 完成事件带回缓冲区编号，用完还回环里。
+// 准备好的请求只写进提交队列，由下一次 submitAndWait 和等待完成合成一次系统调用提交。
+// 只能由一个线程使用（创建它的线程）。
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    // 创建实例并映射提交/完成队列，entries 为提交队列长度
+    bool init(unsigned entries, std::string& err);
+
+    // 内核是否支持这里用到的全部功能（多次接收的 recv 和缓冲区环），不支持时 why 说明原因
+    static bool supported(std::string& why);
+
+    // 注册 count 个 size 字节的接收缓冲区，编号 0..count-1，组号 group；count 须为 2 的幂
+    bool setupBuffers(uint16_t group, unsigned count, size_t size, std::string& err);
+    char* buffer(uint16_t bid) { return _bufBase + (size_t)bid * _bufSize; }
+    void recycleBuffer(uint16_t bid);
+
+    // --- 准备请求（写进提交队列，submitAndWait 时提交） ---
+
+    void prepAcceptMultishot(int fd, int flags, uint64_t userData);
+    void prepRecvMultishot(int fd, uint16_t group, uint64_t userData);
+    void prepSendmsg(int fd, const struct msghdr* msg, int flags, uint64_t userData);
+    void prepPollMultishot(int fd, uint32_t events, uint64_t userData);
+    void prepCancel(uint64_t target, uint64_t userData);   // 取消 user_data 为 target 的请求
+    void prepCancelAll(uint64_t userData);                 // 取消所有未完成的请求
+
+    // 提交已准备的请求，并等待至少 waitNr 个完成事件，最多等 timeoutMs（-1 表示一直等）
+    // 已经有完成事件时不等待。返回 0 或 -errno（超时为 -ETIME）
+    int submitAndWait(unsigned waitNr, int timeoutMs);
+
+    // 只提交，不等待
+    int submit() { return submitAndWait(0, 0); }
+
+    // 依次处理所有已到达的完成事件，处理完一起归还完成队列的位置，返回处理的个数
+    template <typename F>
+    unsigned forEachCqe(F handle) {
+        unsigned head = *_cqHead;
+        unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        for (; head != tail; head++, n++) {
+            const struct io_uring_cqe& cqe = _cqes[head & _cqMask];
+            if (!(cqe.flags & IORING_CQE_F_MORE)) _inflight--; // 这个请求不会再有完成事件
+            handle(cqe);
+        }
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // 已提交、还没有最后一个完成事件的请求数
+    unsigned inflight() const { return _inflight; }
+
+private:
+    struct io_uring_sqe* getSqe();
+
+    int _fd;
+    unsigned _features;
+
+    // 提交队列
+    void* _sqRing;
+    size_t _sqRingSize;
+    struct io_uring_sqe* _sqes;
+    size_t _sqesSize;
+    unsigned* _sqHead;
+    unsigned* _sqTail;
+    unsigned* _sqArray;
+    unsigned _sqMask;
+    unsigned _sqEntries;
+    unsigned _sqLocalTail;  // 已准备到的位置，提交时才发布给内核
+    unsigned _toSubmit;
+
+    // 完成队列
+    void* _cqRing;
+    size_t _cqRingSize;
+    struct io_uring_cqe* _cqes;
+    unsigned* _cqHead;
+    unsigned* _cqTail;
+    unsigned _cqMask;
+
+    // 接收缓冲区环
+    struct io_uring_buf_ring* _bufRing;
+    size_t _bufRingSize;
+    char* _bufBase;
+    size_t _bufSize;
+    unsigned _bufCount;
+    uint16_t _bufTail;
+
+    unsigned _inflight;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "Logger.h"
+#include <unistd.h>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+
+using namespace std;
+
+#define LOG_IDLE_SLEEP_MS 2         // 缓冲区空时写线程的休眠间隔
+#define LOG_REPORT_INTERVAL_NS 1000000000ULL // 汇总被丢弃条数的间隔
+
+static const char* LEVEL_NAMES[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+static const char* CATEGORY_NAMES[LOG_CAT_COUNT] = {"server", "conn", "request", "forward", "topic"};
+
+static uint64_t wallNs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t coarseSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec;
+}
+
+Logger& Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() : _ring(new Slot[LOG_RING_SIZE]), _enqueuePos(0), _dequeuePos(0),
+                   _level(LOG_LEVEL_INFO), _dropped(0), _running(false) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        _ring[i].seq.store(i, memory_order_relaxed);
+    }
+    for (int i = 0; i < LOG_CAT_COUNT; i++) {
+        _cats[i].perSecond.store(0);
+        _cats[i].sampleEvery.store(1);
+        _cats[i].window.store(0);
+        _cats[i].inWindow.store(0);
+        _cats[i].sampleSeq.store(0);
+        _cats[i].suppressed.store(0);
+    }
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+void Logger::start() {
+    bool expected = false;
+    if (!_running.compare_exchange_strong(expected, true)) return;
+    _writer = std::thread(&Logger::writerLoop, this);
+}
+
+void Logger::stop() {
+    bool expected = true;
+    if (!_running.compare_exchange_strong(expected, false)) return;
+    if (_writer.joinable()) _writer.join();
+}
+
+void Logger::setLimit(LogCategory cat, uint32_t perSecond, uint32_t sampleEvery) {
+    _cats[cat].perSecond.store(perSecond, memory_order_relaxed);
+    _cats[cat].sampleEvery.store(sampleEvery > 0 ? sampleEvery : 1, memory_order_relaxed);
+}
+
+bool Logger::shouldLog(LogLevel level, LogCategory cat) {
+    if (level < _level.load(memory_order_relaxed)) return false;
+    if (level >= LOG_LEVEL_WARN) return true; // 警告和错误不采样、不限速
+
+    CategoryState& st = _cats[cat];
+    uint32_t every = st.sampleEvery.load(memory_order_relaxed);
+    if (every > 1 && st.sampleSeq.fetch_add(1, memory_order_relaxed) % every != 0) {
+        st.suppressed.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    uint32_t limit = st.perSecond.load(memory_order_relaxed);
+    if (limit == 0) return true;
+    // 按秒分窗口计数；换窗口时的竞争最多让几条多记或少记，不影响限速效果
+    uint64_t now = coarseSeconds();
+    uint64_t window = st.window.load(memory_order_relaxed);
+    if (window != now && st.window.compare_exchange_strong(window, now, memory_order_relaxed)) {
+        st.inWindow.store(0, memory_order_relaxed);
+    }
+    if (st.inWindow.fetch_add(1, memory_order_relaxed) >= limit) {
+        st.suppressed.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void Logger::write(LogLevel level, const char* fmt, ...) {
+    va_list args;
+
+    if (!_running.load(memory_order_acquire)) {
+        // 写线程还没启动：同步写出
+        char text[LOG_LINE_MAX];
+        va_start(args, fmt);
+        int n = vsnprintf(text, sizeof(text), fmt, args);
+        va_end(args);
+        if (n < 0) return;
+        std::vector<char> out;
+        appendLine(out, wallNs(), level, text, (size_t)n < sizeof(text) ? (size_t)n : sizeof(text) - 1);
+        writeAll(out);
+        return;
+    }
+
+    // 抢占一个槽位（Vyukov 有界队列）：seq == pos 表示空闲
+    size_t pos = _enqueuePos.load(memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &_ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = slot->seq.load(memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            _dropped.fetch_add(1, memory_order_relaxed); // 满了
+            return;
+        } else {
+            pos = _enqueuePos.load(memory_order_relaxed);
+        }
+    }
+
+    // 直接格式化进槽位，不经过临时缓冲区
+    va_start(args, fmt);
+    int n = vsnprintf(slot->text, LOG_LINE_MAX, fmt, args);
+    va_end(args);
+    slot->len = n < 0 ? 0 : (n < LOG_LINE_MAX ? n : LOG_LINE_MAX - 1);
+    slot->level = (uint8_t)level;
+    slot->timeNs = wallNs();
+    slot->seq.store(pos + 1, memory_order_release); // 交给写线程
+}
+
+// 取出一条追加到 out，队头的槽位还没写完或队列为空时返回 false
+bool Logger::tryPop(std::vector<char>& out) {
+    Slot& slot = _ring[_dequeuePos & (LOG_RING_SIZE - 1)];
+    if (slot.seq.load(memory_order_acquire) != _dequeuePos + 1) return false;
+    appendLine(out, slot.timeNs, slot.level, slot.text, slot.len);
+    slot.seq.store(_dequeuePos + LOG_RING_SIZE, memory_order_release); // 归还给生产者
+    _dequeuePos++;
+    return true;
+}
+
+// 一行：时间 级别 正文
+void Logger::appendLine(std::vector<char>& out, uint64_t timeNs, int level, const char* text, size_t len) {
+    time_t sec = (time_t)(timeNs / 1000000000ULL);
+    tm local;
+    localtime_r(&sec, &local);
+    char prefix[48];
+    int n = snprintf(prefix, sizeof(prefix), "%02d:%02d:%02d.%03d %-5s ", local.tm_hour, local.tm_min,
+                     local.tm_sec, (int)(timeNs / 1000000ULL % 1000), LEVEL_NAMES[level]);
+    out.insert(out.end(), prefix, prefix + n);
+    out.insert(out.end(), text, text + len);
+    out.push_back('\n');
+}
+
+void Logger::reportSuppressed(std::vector<char>& out) {
+    char text[LOG_LINE_MAX];
+    for (int i = 0; i < LOG_CAT_COUNT; i++) {
+        uint64_t n = _cats[i].suppressed.exchange(0, memory_order_relaxed);
+        if (n == 0) continue;
+        int len = snprintf(text, sizeof(text), "[Log] %llu %s message(s) suppressed by sampling/rate limit",
+                           (unsigned long long)n, CATEGORY_NAMES[i]);
+        appendLine(out, wallNs(), LOG_LEVEL_INFO, text, len);
+    }
+    uint64_t dropped = _dropped.exchange(0, memory_order_relaxed);
+    if (dropped > 0) {
+        int len = snprintf(text, sizeof(text), "[Log] %llu message(s) dropped, log buffer full",
+                           (unsigned long long)dropped);
+        appendLine(out, wallNs(), LOG_LEVEL_WARN, text, len);
+    }
+}
+
+void Logger::writeAll(const std::vector<char>& out) {
+    size_t off = 0;
+    while (off < out.size()) {
+        ssize_t n = ::write(STDOUT_FILENO, out.data() + off, out.size() - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        off += n;
+    }
+}
+
+// 写线程：批量取出，一次 write；空闲时短暂休眠
+void Logger::writerLoop() {
+    std::vector<char> out;
+    out.reserve(64 * 1024);
+    uint64_t lastReport = wallNs();
+
+    while (true) {
+        bool running = _running.load(memory_order_acquire);
+        out.clear();
+        while (out.size() < 60 * 1024 && tryPop(out)) {}
+
+        uint64_t now = wallNs();
+        if (now - lastReport >= LOG_REPORT_INTERVAL_NS || !running) {
+            reportSuppressed(out);
+            lastReport = now;
+        }
+
+        if (!out.empty()) {
+            writeAll(out);
+            continue;
+        }
+        if (!running) break; // 已经写完
+        std::this_thread::sleep_for(std::chrono::milliseconds(LOG_IDLE_SLEEP_MS));
+    }
+}
+
+bool Logger::parseLevel(const char* name, LogLevel& level) {
+    for (int i = 0; i < 4; i++) {
+        if (strcasecmp(name, LEVEL_NAMES[i]) == 0) {
+            level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Logger::parseCategory(const char* name, LogCategory& cat) {
+    for (int i = 0; i < LOG_CAT_COUNT; i++) {
+        if (strcmp(name, CATEGORY_NAMES[i]) == 0) {
+            cat = (LogCategory)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,120 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+
+// 异步日志
+//
+// 业务线程只把格式化好的一行写进无锁环形缓冲区（有界 MPSC，每个槽位定长，不分配内存），
+// 后台线程批量取出后一次 write 到标准输出，stdout 的刷新不再阻塞 Reactor 和工作线程。
+// 缓冲区满时直接丢弃并计数，宁可少日志也不拖慢请求。
+//
+// 每条日志属于一个类别，类别可以设置采样（每 N 条记 1 条）和限速（每秒最多 N 条），
+// 被丢弃的条数由后台线程定期汇总输出。级别和类别的检查都在格式化之前，被过滤的日志几乎没有开销。
+//
+// 编译时定义 LOG_STRIP_DEBUG（make LOG_STRIP_DEBUG=1）会把 LOG_DEBUG 整个去掉，参数也不会求值。
+
+#define LOG_LINE_MAX 256        // 单条日志最大长度，超出截断
+#define LOG_RING_SIZE 8192      // 环形缓冲区槽位数，必须是 2 的幂
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO = 1,
+    LOG_LEVEL_WARN = 2,
+    LOG_LEVEL_ERROR = 3
+};
+
+enum LogCategory {
+    LOG_CAT_SERVER = 0,     // 启动、监听、Reactor
+    LOG_CAT_CONN,           // 连接建立/断开
+    LOG_CAT_REQUEST,        // T/N/L/B 等请求
+    LOG_CAT_FORWARD,        // 转发、广播、主题消息（最频繁）
+    LOG_CAT_TOPIC,          // 订阅/退订
+    LOG_CAT_COUNT
+};
+
+class Logger {
+public:
+    static Logger& instance();
+
+    // 启动后台写线程；未启动时日志直接同步写出（比如启动前的错误）
+    void start();
+
+    // 写出缓冲区里剩下的日志并停止后台线程
+    void stop();
+
+    void setLevel(LogLevel level) { _level.store(level, std::memory_order_relaxed); }
+
+    // 类别的采样与限速：sampleEvery 条里记 1 条（1 表示全记），每秒最多 perSecond 条（0 表示不限）
+    void setLimit(LogCategory cat, uint32_t perSecond, uint32_t sampleEvery);
+
+    // 级别、采样、限速都通过时返回 true，调用方再格式化
+    bool shouldLog(LogLevel level, LogCategory cat);
+
+    // 格式化并入队
+    void write(LogLevel level, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+    static bool parseLevel(const char* name, LogLevel& level);
+    static bool parseCategory(const char* name, LogCategory& cat);
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;    // 槽位状态（Vyukov 有界队列的序号）
+        uint64_t timeNs;            // 产生时间（墙上时间）
+        uint8_t level;
+        uint16_t len;
+        char text[LOG_LINE_MAX];
+    };
+
+    struct CategoryState {
+        std::atomic<uint32_t> perSecond;
+        std::atomic<uint32_t> sampleEvery;
+        std::atomic<uint64_t> window;       // 当前限速窗口（秒）
+        std::atomic<uint32_t> inWindow;     // 当前窗口已记录的条数
+        std::atomic<uint64_t> sampleSeq;    // 采样计数
+        std::atomic<uint64_t> suppressed;   // 被采样/限速丢掉的条数，后台线程汇总后清零
+    };
+
+    Logger();
+    ~Logger();
+    Logger(const Logger&);
+    Logger& operator=(const Logger&);
+
+    bool tryPop(std::vector<char>& out);
+    void appendLine(std::vector<char>& out, uint64_t timeNs, int level, const char* text, size_t len);
+    void reportSuppressed(std::vector<char>& out);
+    void writerLoop();
+    static void writeAll(const std::vector<char>& out);
+
+    std::unique_ptr<Slot[]> _ring;
+    std::atomic<size_t> _enqueuePos;    // 生产者抢占的下一个槽位
+    size_t _dequeuePos;                 // 只由写线程访问
+
+    std::atomic<int> _level;
+    CategoryState _cats[LOG_CAT_COUNT];
+    std::atomic<uint64_t> _dropped;     // 缓冲区满丢掉的条数
+
+    std::atomic<bool> _running;
+    std::thread _writer;
+};
+
+// 日志宏：先检查级别和限速，通过了才格式化
+#define LOG_AT(level, cat, ...) \
+    do { \
+        if (Logger::instance().shouldLog(level, cat)) Logger::instance().write(level, __VA_ARGS__); \
+    } while (0)
+
+#ifdef LOG_STRIP_DEBUG
+#define LOG_DEBUG(cat, ...) do {} while (0)
+#else
+#define LOG_DEBUG(cat, ...) LOG_AT(LOG_LEVEL_DEBUG, cat, __VA_ARGS__)
+#endif
+#define LOG_INFO(cat, ...) LOG_AT(LOG_LEVEL_INFO, cat, __VA_ARGS__)
+#define LOG_WARN(cat, ...) LOG_AT(LOG_LEVEL_WARN, cat, __VA_ARGS__)
+#define LOG_ERROR(cat, ...) LOG_AT(LOG_LEVEL_ERROR, cat, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,154 @@
+#include "Metrics.h"
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+
+using namespace std;
+
+#define METRIC_LAT_MIN_BUCKET 8 // 输出的最小桶上界 2^8 ns，更小的值累计在里面
+
+// 所有线程的计数块
+struct MetricsRegistry {
+    mutex mtx;
+    vector<ThreadMetrics*> live;    // 还在运行的线程
+    MetricsTotals retired;          // 已退出线程的计数
+};
+
+static MetricsRegistry& registry() {
+    static MetricsRegistry reg;
+    return reg;
+}
+
+// 线程局部的持有者：线程第一次计数时登记，退出时把计数并入 retired
+struct LocalMetricsHolder {
+    ThreadMetrics* metrics;
+
+    LocalMetricsHolder() : metrics(new ThreadMetrics()) {
+        MetricsRegistry& reg = registry();
+        lock_guard<mutex> lock(reg.mtx);
+        reg.live.push_back(metrics);
+    }
+
+    ~LocalMetricsHolder() {
+        MetricsRegistry& reg = registry();
+        {
+            lock_guard<mutex> lock(reg.mtx);
+            reg.retired.add(*metrics);
+            reg.live.erase(std::remove(reg.live.begin(), reg.live.end(), metrics), reg.live.end());
+        }
+        delete metrics;
+    }
+};
+
+ThreadMetrics::ThreadMetrics() : bytesIn(0), bytesOut(0), compressIn(0), compressOut(0), accepted(0), rejected(0), lockWaits(0), lockWaitNs(0) {
+    for (int t = 0; t < METRIC_TYPES; t++) {
+        msgs[t].store(0);
+        latencySum[t].store(0);
+        for (int b = 0; b < METRIC_LAT_BUCKETS; b++) latency[t][b].store(0);
+    }
+}
+
+MetricsTotals::MetricsTotals() : bytesIn(0), bytesOut(0), compressIn(0), compressOut(0), accepted(0), rejected(0), lockWaits(0), lockWaitNs(0) {
+    for (int t = 0; t < METRIC_TYPES; t++) {
+        msgs[t] = 0;
+        latencySum[t] = 0;
+        for (int b = 0; b < METRIC_LAT_BUCKETS; b++) latency[t][b] = 0;
+    }
+}
+
+void MetricsTotals::add(const ThreadMetrics& m) {
+    for (int t = 0; t < METRIC_TYPES; t++) {
+        msgs[t] += m.msgs[t].load(memory_order_relaxed);
+        latencySum[t] += m.latencySum[t].load(memory_order_relaxed);
+        for (int b = 0; b < METRIC_LAT_BUCKETS; b++) latency[t][b] += m.latency[t][b].load(memory_order_relaxed);
+    }
+    bytesIn += m.bytesIn.load(memory_order_relaxed);
+    bytesOut += m.bytesOut.load(memory_order_relaxed);
+    compressIn += m.compressIn.load(memory_order_relaxed);
+    compressOut += m.compressOut.load(memory_order_relaxed);
+    accepted += m.accepted.load(memory_order_relaxed);
+    rejected += m.rejected.load(memory_order_relaxed);
+    lockWaits += m.lockWaits.load(memory_order_relaxed);
+    lockWaitNs += m.lockWaitNs.load(memory_order_relaxed);
+}
+
+ThreadMetrics& Metrics::local() {
+    static thread_local LocalMetricsHolder holder;
+    return *holder.metrics;
+}
+
+void Metrics::collect(MetricsTotals& out) {
+    MetricsRegistry& reg = registry();
+    lock_guard<mutex> lock(reg.mtx);
+    out = reg.retired;
+    for (size_t i = 0; i < reg.live.size(); i++) out.add(*reg.live[i]);
+}
+
+static void appendf(string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void appendf(string& out, const char* fmt, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (n > 0) out.append(line, (size_t)n < sizeof(line) ? n : sizeof(line) - 1);
+}
+
+static string typeLabel(int t) {
+    return t < METRIC_TYPES - 1 ? string(1, (char)('A' + t)) : string("other");
+}
+
+void Metrics::render(const MetricsTotals& m, std::string& out) {
+    out += "# HELP chat_requests_total Requests handled, by message type.\n";
+    out += "# TYPE chat_requests_total counter\n";
+    for (int t = 0; t < METRIC_TYPES; t++) {
+        if (m.msgs[t] == 0) continue;
+        appendf(out, "chat_requests_total{type=\"%s\"} %llu\n", typeLabel(t).c_str(), (unsigned long long)m.msgs[t]);
+    }
+
+    // 桶按 Prometheus 的约定累计输出，上界换算成秒
+    out += "# HELP chat_handler_seconds Time spent in the request handler, by message type.\n";
+    out += "# TYPE chat_handler_seconds histogram\n";
+    for (int t = 0; t < METRIC_TYPES; t++) {
+        if (m.msgs[t] == 0) continue;
+        string label = typeLabel(t);
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRIC_LAT_BUCKETS - 1; b++) {
+            cumulative += m.latency[t][b];
+            if (b < METRIC_LAT_MIN_BUCKET) continue;
+            appendf(out, "chat_handler_seconds_bucket{type=\"%s\",le=\"%.9g\"} %llu\n", label.c_str(),
+                    (double)(1ULL << b) / 1e9, (unsigned long long)cumulative);
+        }
+        appendf(out, "chat_handler_seconds_bucket{type=\"%s\",le=\"+Inf\"} %llu\n", label.c_str(),
+                (unsigned long long)m.msgs[t]);
+        appendf(out, "chat_handler_seconds_sum{type=\"%s\"} %.9f\n", label.c_str(), m.latencySum[t] / 1e9);
+        appendf(out, "chat_handler_seconds_count{type=\"%s\"} %llu\n", label.c_str(), (unsigned long long)m.msgs[t]);
+    }
+
+    out += "# HELP chat_received_bytes_total Bytes read from client sockets.\n";
+    out += "# TYPE chat_received_bytes_total counter\n";
+    appendf(out, "chat_received_bytes_total %llu\n", (unsigned long long)m.bytesIn);
+    out += "# HELP chat_sent_bytes_total Bytes written to client sockets.\n";
+    out += "# TYPE chat_sent_bytes_total counter\n";
+    appendf(out, "chat_sent_bytes_total %llu\n", (unsigned long long)m.bytesOut);
+    out += "# HELP chat_compress_input_bytes_total Bytes of frames sent compressed, before compression.\n";
+    out += "# TYPE chat_compress_input_bytes_total counter\n";
+    appendf(out, "chat_compress_input_bytes_total %llu\n", (unsigned long long)m.compressIn);
+    out += "# HELP chat_compress_output_bytes_total Bytes of the compressed frames that replaced them.\n";
+    out += "# TYPE chat_compress_output_bytes_total counter\n";
+    appendf(out, "chat_compress_output_bytes_total %llu\n", (unsigned long long)m.compressOut);
+    out += "# HELP chat_connections_accepted_total Connections accepted since start.\n";
+    out += "# TYPE chat_connections_accepted_total counter\n";
+    appendf(out, "chat_connections_accepted_total %llu\n", (unsigned long long)m.accepted);
+    out += "# HELP chat_connections_rejected_total Connections closed right after accept by the per-IP rate limit.\n";
+    out += "# TYPE chat_connections_rejected_total counter\n";
+    appendf(out, "chat_connections_rejected_total %llu\n", (unsigned long long)m.rejected);
+    out += "# HELP chat_lock_waits_total Contended acquisitions of a send queue lock.\n";
+    out += "# TYPE chat_lock_waits_total counter\n";
+    appendf(out, "chat_lock_waits_total %llu\n", (unsigned long long)m.lockWaits);
+    out += "# HELP chat_lock_wait_seconds_total Time spent waiting for contended send queue locks.\n";
+    out += "# TYPE chat_lock_wait_seconds_total counter\n";
+    appendf(out, "chat_lock_wait_seconds_total %.9f\n", m.lockWaitNs / 1e9);
+}
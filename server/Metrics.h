@@ -0,0 +1,116 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <time.h>
+#include <stdint.h>
+
+// 服务器运行统计
+//
+// 每个线程（Reactor 或线程模式下的连接线程）有自己的计数块，热路径上只写本线程的块：
+// 计数器只有一个写者，用 load + store 代替 fetch_add，没有锁前缀，也不和其他核抢缓存行。
+// 读取时（统计端口被访问）把所有线程的块逐项相加；线程退出时它的计数并入一个汇总块，不会丢失。
+// 读到的是各计数器某一时刻的值，彼此之间不保证是同一瞬间的快照，对监控来说足够了。
+
+#define METRIC_TYPES 27         // 'A'~'Z' 每种消息类型一个，其余归到最后一个
+#define METRIC_LAT_BUCKETS 32   // 延迟桶：第 k 个桶统计 [2^(k-1), 2^k) 纳秒，最后一个桶收所有更大的值
+
+// 单调时钟（纳秒）
+inline uint64_t metricsNowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 一个线程的计数块，只由所属线程写，其他线程只读
+struct ThreadMetrics {
+    std::atomic<uint64_t> msgs[METRIC_TYPES];       // 按类型的请求数
+    std::atomic<uint64_t> latencySum[METRIC_TYPES]; // 处理耗时之和（纳秒）
+    std::atomic<uint64_t> latency[METRIC_TYPES][METRIC_LAT_BUCKETS]; // 处理耗时分布
+    std::atomic<uint64_t> bytesIn;                  // 从套接字读到的字节
+    std::atomic<uint64_t> bytesOut;                 // 写进套接字的字节
+    std::atomic<uint64_t> compressIn;               // 压缩前的字节
+    std::atomic<uint64_t> compressOut;              // 压缩后的字节
+    std::atomic<uint64_t> accepted;                 // 接受的连接数
+    std::atomic<uint64_t> rejected;                 // 超过单 IP 速率限制、accept 后立即关闭的连接数
+    std::atomic<uint64_t> lockWaits;                // 发送队列锁发生竞争的次数
+    std::atomic<uint64_t> lockWaitNs;               // 因竞争等待的总时间（纳秒）
+
+    ThreadMetrics();
+
+    static int typeIndex(char type) {
+        return (type >= 'A' && type <= 'Z') ? type - 'A' : METRIC_TYPES - 1;
+    }
+
+    static int bucketIndex(uint64_t ns) {
+        if (ns == 0) return 0;
+        int k = 64 - __builtin_clzll(ns);
+        return k < METRIC_LAT_BUCKETS ? k : METRIC_LAT_BUCKETS - 1;
+    }
+
+    // 单写者自增
+    static void bump(std::atomic<uint64_t>& c, uint64_t n = 1) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void countMessage(char type, uint64_t ns) {
+        int t = typeIndex(type);
+        bump(msgs[t]);
+        bump(latencySum[t], ns);
+        bump(latency[t][bucketIndex(ns)]);
+    }
+    void addBytesIn(uint64_t n) { bump(bytesIn, n); }
+    void addBytesOut(uint64_t n) { bump(bytesOut, n); }
+    void addCompressed(uint64_t raw, uint64_t compressed) {
+        bump(compressIn, raw);
+        bump(compressOut, compressed);
+    }
+    void addAccepted() { bump(accepted); }
+    void addRejected() { bump(rejected); }
+    void addLockWait(uint64_t ns) {
+        bump(lockWaits);
+        bump(lockWaitNs, ns);
+    }
+};
+
+// 合并后的计数（普通整数）
+struct MetricsTotals {
+    uint64_t msgs[METRIC_TYPES];
+    uint64_t latencySum[METRIC_TYPES];
+    uint64_t latency[METRIC_TYPES][METRIC_LAT_BUCKETS];
+    uint64_t bytesIn;
+    uint64_t bytesOut;
+    uint64_t compressIn;
+    uint64_t compressOut;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t lockWaits;
+    uint64_t lockWaitNs;
+
+    MetricsTotals();
+    void add(const ThreadMetrics& m);
+};
+
+class Metrics {
+public:
+    // 本线程的计数块，第一次调用时登记
+    static ThreadMetrics& local();
+
+    // 合并所有线程（包括已经退出的）的计数
+    static void collect(MetricsTotals& out);
+
+    // 以 Prometheus 文本格式追加到 out
+    static void render(const MetricsTotals& totals, std::string& out);
+};
+
+// 先 try_lock，抢不到才计时等待：没有竞争时不读时钟。lock 须以 std::defer_lock 构造
+inline void lockMeasured(std::unique_lock<std::mutex>& lock) {
+    if (lock.try_lock()) return;
+    uint64_t start = metricsNowNs();
+    lock.lock();
+    Metrics::local().addLockWait(metricsNowNs() - start);
+}
+
+#endif
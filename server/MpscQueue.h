@@ -0,0 +1,69 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+#include "../common/BufferPool.h"
+
+// 无锁多生产者单消费者队列（Vyukov 算法）
+// 任意线程都可以 push，只有一个线程（所属 Reactor）可以 pop
+// push 只需要一次原子 exchange，不会因为消费者或其他生产者而阻塞
+// 节点从 BufferPool 分配：生产者分配、消费者释放，块经过内存池的仓库流回，不用每次 malloc/free
+template <typename T>
+class MpscQueue {
+private:
+    struct Node {
+        std::atomic<Node*> next;
+        T value;
+        Node() : next(nullptr) {}
+
+        static void* operator new(size_t n) { return BufferPool::alloc(n); }
+        static void operator delete(void* p, size_t n) { BufferPool::free(p, n); }
+    };
+
+    std::atomic<Node*> _head;   // 生产者在这里追加
+    Node* _tail;                // 消费者从这里取（始终指向一个已被取走的哨兵节点）
+
+    MpscQueue(const MpscQueue&);
+    MpscQueue& operator=(const MpscQueue&);
+
+public:
+    MpscQueue() {
+        Node* stub = new Node();
+        _head.store(stub);
+        _tail = stub;
+    }
+
+    ~MpscQueue() {
+        T tmp;
+        while (pop(tmp)) {}
+        delete _tail;
+    }
+
+    // 任意线程调用
+    void push(T value) {
+        Node* node = new Node();
+        node->value = std::move(value);
+        Node* prev = _head.exchange(node, std::memory_order_acq_rel);
+        // 在下面这行之前消费者暂时看不到该节点，生产者随后会唤醒消费者，不会丢失
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // 只能由消费者线程调用；有生产者正在 push 时也算非空
+    bool empty() const {
+        return _head.load(std::memory_order_acquire) == _tail;
+    }
+
+    // 只能由消费者线程调用，队列为空时返回 false
+    bool pop(T& out) {
+        Node* tail = _tail;
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) return false;
+        out = std::move(next->value);
+        _tail = next;   // next 成为新的哨兵
+        delete tail;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,638 @@
+#include "OfflineStore.h"
+#include "Logger.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/random.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+#define STORE_MAGIC 0x4c464f43u     // 每条记录开头的标记 "COFL"
+#define STORE_ALIGN 8               // 记录按 8 字节对齐
+#define COMPACT_CHUNK 1024          // 压缩时每次持锁最多处理的记录数，避免长时间挡住追加
+
+// 记录类型
+enum {
+    REC_MSG = 1,        // target 的一条离线消息，正文是消息内容
+    REC_ACK = 2,        // target 序号不超过 seq 的消息已投递
+    REC_SESSION = 3,    // 会话 target 的令牌
+    REC_END = 4         // 会话 target 已经结束，之前关于它的记录都作废
+};
+
+// 记录头，后面紧跟 length 字节正文，再补齐到 8 字节
+struct RecordHeader {
+    uint32_t magic;
+    uint32_t checksum;  // 头部 checksum 之后的部分 + 正文，见 recordChecksum
+    uint8_t kind;
+    uint8_t pad[3];
+    uint32_t length;
+    int32_t target;
+    int32_t sender;
+    uint64_t seq;
+};
+
+static_assert(sizeof(RecordHeader) == 32, "record header layout");
+
+static size_t recordLen(size_t bodyLen) {
+    return (sizeof(RecordHeader) + bodyLen + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1);
+}
+
+// 校验和：每次取 8 字节乘法混合，比逐字节的 FNV-1a 快得多，离线消息的追加不会被它拖慢
+static uint64_t mixBytes(const char* p, size_t n, uint64_t h) {
+    const uint64_t K = 0x9e3779b97f4a7c15ULL;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * K;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    if (n > 0) memcpy(&tail, p, n);
+    h = (h ^ tail ^ ((uint64_t)n << 56)) * K;
+    return h ^ (h >> 32);
+}
+
+static uint32_t recordChecksum(const RecordHeader& h, const char* body) {
+    const size_t skip = offsetof(RecordHeader, kind);
+    uint64_t sum = mixBytes((const char*)&h + skip, sizeof(h) - skip, 0x243f6a8885a308d3ULL);
+    return (uint32_t)mixBytes(body, h.length, sum);
+}
+
+static uint64_t steadyMs() {
+    return (uint64_t)chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static string segmentPath(const string& dir, uint32_t no) {
+    char name[32];
+    snprintf(name, sizeof(name), "/offline.%08u.log", no);
+    return dir + name;
+}
+
+OfflineStore::OfflineStore()
+    : _segmentBytes(STORE_SEGMENT_BYTES), _maxPerClient(STORE_MAX_PER_CLIENT), _sessionTtlSec(STORE_SESSION_TTL_SEC),
+      _lockFd(-1), _open(false),
+      _nextSeq(1), _nextSessionId(SESSION_ID_BASE), _queued(0), _stored(0), _delivered(0), _stopping(false) {}
+
+OfflineStore::~OfflineStore() {
+    close();
+}
+
+bool OfflineStore::open(const string& dir, size_t segmentBytes, size_t maxPerClient, int sessionTtlSec, int waitMs,
+                        string& err) {
+    if (isOpen()) return true;
+    _dir = dir;
+    _segmentBytes = segmentBytes;
+    _maxPerClient = maxPerClient;
+    _sessionTtlSec = sessionTtlSec;
+    if (!lockDir(waitMs, err)) return false;
+
+    lock_guard<mutex> lock(_mtx);
+    _nextSeq = 1;
+    _nextSessionId = SESSION_ID_BASE;
+    _queued = _stored = _delivered = 0;
+    if (!replay(err)) {
+        for (map<uint32_t, Segment>::iterator it = _segments.begin(); it != _segments.end();) {
+            Segment& seg = it->second;
+            munmap(seg.base, seg.cap);
+            ::close(seg.fd);
+            it = _segments.erase(it);
+        }
+        _sessions.clear();
+        _tokens.clear();
+        ::close(_lockFd);
+        _lockFd = -1;
+        return false;
+    }
+
+    _stopping = false;
+    _open.store(true, memory_order_release);
+    _compactor = thread(&OfflineStore::compactLoop, this);
+    return true;
+}
+
+void OfflineStore::close() {
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (!_open.load(memory_order_relaxed)) return;
+        _open.store(false, memory_order_release);
+    }
+    {
+        lock_guard<mutex> lock(_stopMtx);
+        _stopping = true;
+    }
+    _stopCv.notify_all();
+    if (_compactor.joinable()) _compactor.join();
+
+    lock_guard<mutex> lock(_mtx);
+    for (map<uint32_t, Segment>::iterator it = _segments.begin(); it != _segments.end(); ++it) {
+        Segment& seg = it->second;
+        if (seg.used > seg.synced) msync(seg.base, seg.used, MS_SYNC);
+        munmap(seg.base, seg.cap);
+        ::close(seg.fd);
+    }
+    _segments.clear();
+    _sessions.clear();
+    _tokens.clear();
+    _queued = 0;
+    ::close(_lockFd); // 放开 flock，热重启的新进程可以打开了
+    _lockFd = -1;
+}
+
+// --- 打开与重放 ---
+
+bool OfflineStore::lockDir(int waitMs, string& err) {
+    if (mkdir(_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        err = _dir + ": " + strerror(errno);
+        return false;
+    }
+    string path = _dir + "/LOCK";
+    _lockFd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_lockFd < 0) {
+        err = path + ": " + strerror(errno);
+        return false;
+    }
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(waitMs);
+    while (flock(_lockFd, LOCK_EX | LOCK_NB) < 0) {
+        if (errno != EWOULDBLOCK || chrono::steady_clock::now() >= deadline) {
+            err = path + ": " + (errno == EWOULDBLOCK ? string("locked by another process") : string(strerror(errno)));
+            ::close(_lockFd);
+            _lockFd = -1;
+            return false;
+        }
+        usleep(10000);
+    }
+    return true;
+}
+
+OfflineStore::Segment* OfflineStore::openSegment(uint32_t no, size_t cap, string& err) {
+    string path = segmentPath(_dir, no);
+    int fd;
+    if (cap > 0) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0 && ftruncate(fd, (off_t)cap) < 0) {
+            err = path + ": " + strerror(errno);
+            ::close(fd);
+            unlink(path.c_str());
+            return nullptr;
+        }
+    } else {
+        fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0) cap = (size_t)st.st_size;
+    }
+    if (fd < 0) {
+        err = path + ": " + strerror(errno);
+        return nullptr;
+    }
+
+    void* base = cap > 0 ? mmap(nullptr, cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (base == MAP_FAILED) {
+        err = path + ": " + (cap > 0 ? strerror(errno) : "empty segment");
+        ::close(fd);
+        return nullptr;
+    }
+
+    Segment& seg = _segments[no];
+    seg.no = no;
+    seg.fd = fd;
+    seg.base = (char*)base;
+    seg.cap = cap;
+    return &seg;
+}
+
+void OfflineStore::dropSegment(map<uint32_t, Segment>::iterator it) {
+    Segment& seg = it->second;
+    munmap(seg.base, seg.cap);
+    ::close(seg.fd);
+    unlink(segmentPath(_dir, seg.no).c_str());
+    _segments.erase(it);
+}
+
+bool OfflineStore::replay(string& err) {
+    DIR* d = opendir(_dir.c_str());
+    if (!d) {
+        err = _dir + ": " + strerror(errno);
+        return false;
+    }
+    vector<uint32_t> numbers;
+    while (struct dirent* e = readdir(d)) {
+        uint32_t no;
+        char tail[8];
+        if (sscanf(e->d_name, "offline.%u.%7s", &no, tail) == 2 && strcmp(tail, "log") == 0) numbers.push_back(no);
+    }
+    closedir(d);
+    sort(numbers.begin(), numbers.end());
+
+    for (size_t i = 0; i < numbers.size(); i++) {
+        Segment* seg = openSegment(numbers[i], 0, err);
+        if (!seg) return false;
+        scanSegment(*seg);
+    }
+
+    // 会话记录可能在消息之后（压缩把它搬到了新段），所以全部读完再整理：
+    // 去掉已确认的消息，按序号排序，压缩中途退出留下的重复副本只保留新段里的那份。
+    // 离线时间不知道，过期从现在算起
+    uint64_t now = steadyMs();
+    for (unordered_map<int, Session>::iterator it = _sessions.begin(); it != _sessions.end();) {
+        Session& s = it->second;
+        if (s.token.empty()) {
+            it = _sessions.erase(it);
+            continue;
+        }
+        deque<MsgRef> live;
+        for (size_t i = 0; i < s.msgs.size(); i++) {
+            if (s.msgs[i].seq > s.acked) live.push_back(s.msgs[i]);
+        }
+        sort(live.begin(), live.end(), [](const MsgRef& a, const MsgRef& b) {
+            return a.seq != b.seq ? a.seq < b.seq : a.seg < b.seg;
+        });
+        s.msgs.clear();
+        for (size_t i = 0; i < live.size(); i++) {
+            if (!s.msgs.empty() && s.msgs.back().seq == live[i].seq) s.msgs.back() = live[i];
+            else s.msgs.push_back(live[i]);
+        }
+        for (size_t i = 0; i < s.msgs.size(); i++) _segments[s.msgs[i].seg].liveBytes += s.msgs[i].len;
+        _segments[s.seg].liveBytes += s.len;
+        _queued += s.msgs.size();
+        _tokens[s.token] = it->first;
+        s.offlineSince = now;
+        ++it;
+    }
+
+    if (_segments.empty() && !openSegment(1, _segmentBytes, err)) return false;
+    return true;
+}
+
+// 从头读一个段，遇到无效的记录（没写完或者没写过）就停下，之后从这里追加
+bool OfflineStore::scanSegment(Segment& seg) {
+    size_t off = 0;
+    while (off + sizeof(RecordHeader) <= seg.cap) {
+        RecordHeader h;
+        memcpy(&h, seg.base + off, sizeof(h));
+        if (h.magic != STORE_MAGIC || h.length > seg.cap - off - sizeof(h)) break;
+        const char* body = seg.base + off + sizeof(h);
+        if (recordChecksum(h, body) != h.checksum) break;
+        uint32_t len = (uint32_t)recordLen(h.length);
+        if (h.target >= _nextSessionId) _nextSessionId = h.target + 1;
+
+        if (h.kind == REC_END) {
+            // 之前读到的记录都作废；之后不会再有这个 ID 的记录
+            _sessions.erase(h.target);
+            off += len;
+            continue;
+        }
+        Session& s = _sessions[h.target];
+        if (h.kind == REC_MSG) {
+            MsgRef ref = {h.seq, seg.no, (uint32_t)off, len};
+            s.msgs.push_back(ref);
+            if (h.seq >= _nextSeq) _nextSeq = h.seq + 1;
+        } else if (h.kind == REC_ACK) {
+            if (h.seq > s.acked) s.acked = h.seq;
+        } else if (h.kind == REC_SESSION) {
+            s.token.assign(body, h.length);
+            s.seg = seg.no;
+            s.off = (uint32_t)off;
+            s.len = len;
+        }
+        off += len;
+    }
+    seg.used = seg.synced = off;
+    return off > 0;
+}
+
+// --- 追加 ---
+
+bool OfflineStore::appendRecord(uint8_t kind, int target, int sender, uint64_t seq, StrView body,
+                                uint32_t& segNo, uint32_t& off, uint32_t& len) {
+    size_t total = recordLen(body.len);
+    Segment* seg = _segments.empty() ? nullptr : &_segments.rbegin()->second;
+    if (!seg || seg->used + total > seg->cap) {
+        // 当前段写满了，开一个新段（比段还大的消息单独占一个段）
+        string err;
+        seg = openSegment(seg ? seg->no + 1 : 1, max(_segmentBytes, total), err);
+        if (!seg) {
+            LOG_ERROR(LOG_CAT_SERVER, "[Store] Failed to create a log segment: %s", err.c_str());
+            return false;
+        }
+        int dfd = ::open(_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dfd >= 0) {
+            fsync(dfd); // 新文件的目录项落盘
+            ::close(dfd);
+        }
+    }
+
+    RecordHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = STORE_MAGIC;
+    h.kind = kind;
+    h.length = (uint32_t)body.len;
+    h.target = target;
+    h.sender = sender;
+    h.seq = seq;
+    h.checksum = recordChecksum(h, body.data);
+
+    char* p = seg->base + seg->used;
+    memcpy(p + sizeof(h), body.data, body.len);
+    memcpy(p, &h, sizeof(h));
+
+    segNo = seg->no;
+    off = (uint32_t)seg->used;
+    len = (uint32_t)total;
+    seg->used += total;
+    return true;
+}
+
+// --- 会话 ---
+
+int OfflineStore::createSession(string& token) {
+    unsigned char raw[SESSION_TOKEN_LEN / 2];
+    if (getrandom(raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) return 0;
+    static const char HEX[] = "0123456789abcdef";
+    token.resize(SESSION_TOKEN_LEN);
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        token[i * 2] = HEX[raw[i] >> 4];
+        token[i * 2 + 1] = HEX[raw[i] & 15];
+    }
+
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return 0;
+    int id = _nextSessionId;
+    uint32_t segNo, off, len;
+    if (!appendRecord(REC_SESSION, id, 0, 0, StrView(token), segNo, off, len)) return 0;
+    _nextSessionId++;
+
+    Session& s = _sessions[id];
+    s.token = token;
+    s.seg = segNo;
+    s.off = off;
+    s.len = len;
+    s.offlineSince = steadyMs();
+    _segments[segNo].liveBytes += len;
+    _tokens[token] = id;
+    return id;
+}
+
+bool OfflineStore::endSession(int id) {
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return false;
+    unordered_map<int, Session>::iterator it = _sessions.find(id);
+    if (it == _sessions.end()) return false;
+    endLocked(it);
+    return true;
+}
+
+void OfflineStore::endLocked(unordered_map<int, Session>::iterator it) {
+    Session& s = it->second;
+    uint32_t segNo, off, len;
+    appendRecord(REC_END, it->first, 0, 0, StrView(), segNo, off, len);
+
+    for (size_t i = 0; i < s.msgs.size(); i++) _segments[s.msgs[i].seg].liveBytes -= s.msgs[i].len;
+    _segments[s.seg].liveBytes -= s.len;
+    _queued -= s.msgs.size();
+    _tokens.erase(s.token);
+    _sessions.erase(it);
+}
+
+int OfflineStore::findSession(StrView token) {
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return 0;
+    unordered_map<string, int>::iterator it = _tokens.find(token.str());
+    return it == _tokens.end() ? 0 : it->second;
+}
+
+string OfflineStore::tokenOf(int id) {
+    lock_guard<mutex> lock(_mtx);
+    unordered_map<int, Session>::iterator it = _sessions.find(id);
+    return it == _sessions.end() ? string() : it->second.token;
+}
+
+void OfflineStore::attach(int id) {
+    lock_guard<mutex> lock(_mtx);
+    unordered_map<int, Session>::iterator it = _sessions.find(id);
+    if (it != _sessions.end()) it->second.online = true;
+}
+
+void OfflineStore::detach(int id) {
+    lock_guard<mutex> lock(_mtx);
+    unordered_map<int, Session>::iterator it = _sessions.find(id);
+    if (it != _sessions.end()) {
+        it->second.online = false;
+        it->second.offlineSince = steadyMs();
+    }
+}
+
+// --- 离线消息 ---
+
+StoreResult OfflineStore::append(int target, int sender, StrView content) {
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return STORE_CLOSED;
+    unordered_map<int, Session>::iterator it = _sessions.find(target);
+    if (it == _sessions.end()) return STORE_UNKNOWN;
+    Session& s = it->second;
+    if (s.online) return STORE_ONLINE;
+    if (s.msgs.size() >= _maxPerClient) return STORE_FULL;
+
+    MsgRef ref;
+    ref.seq = _nextSeq;
+    if (!appendRecord(REC_MSG, target, sender, ref.seq, content, ref.seg, ref.off, ref.len)) return STORE_CLOSED;
+    _nextSeq++;
+    s.msgs.push_back(ref);
+    _segments[ref.seg].liveBytes += ref.len;
+    _queued++;
+    _stored++;
+    return STORE_OK;
+}
+
+size_t OfflineStore::take(int target, size_t max, vector<StoredMsg>& out) {
+    out.clear();
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return 0;
+    unordered_map<int, Session>::iterator it = _sessions.find(target);
+    if (it == _sessions.end()) return 0;
+    const deque<MsgRef>& msgs = it->second.msgs;
+    size_t n = std::min(max, msgs.size());
+    out.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        const char* p = _segments[msgs[i].seg].base + msgs[i].off;
+        RecordHeader h;
+        memcpy(&h, p, sizeof(h));
+        out[i].seq = h.seq;
+        out[i].sender = h.sender;
+        out[i].content.assign(p + sizeof(h), h.length);
+    }
+    return n;
+}
+
+void OfflineStore::ack(int target, uint64_t seq) {
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return;
+    unordered_map<int, Session>::iterator it = _sessions.find(target);
+    if (it == _sessions.end() || seq <= it->second.acked) return;
+    Session& s = it->second;
+    while (!s.msgs.empty() && s.msgs.front().seq <= seq) {
+        _segments[s.msgs.front().seg].liveBytes -= s.msgs.front().len;
+        s.msgs.pop_front();
+        _queued--;
+        _delivered++;
+    }
+    s.acked = seq;
+    uint32_t segNo, off, len;
+    appendRecord(REC_ACK, target, 0, seq, StrView(), segNo, off, len);
+}
+
+void OfflineStore::stats(StoreStats& out) {
+    memset(&out, 0, sizeof(out));
+    lock_guard<mutex> lock(_mtx);
+    out.sessions = _sessions.size();
+    out.queued = _queued;
+    out.segments = _segments.size();
+    for (map<uint32_t, Segment>::iterator it = _segments.begin(); it != _segments.end(); ++it) {
+        out.diskBytes += it->second.used;
+    }
+    out.stored = _stored;
+    out.delivered = _delivered;
+}
+
+// --- 后台同步与压缩 ---
+
+void OfflineStore::compactLoop() {
+    unique_lock<mutex> lock(_stopMtx);
+    while (!_stopping) {
+        _stopCv.wait_for(lock, chrono::milliseconds(STORE_COMPACT_MS));
+        if (_stopping) break;
+        lock.unlock();
+        syncSegments();
+        expireSessions();
+        while (compactOldest()) {}
+        lock.lock();
+    }
+}
+
+// 把各段新写的部分刷到磁盘。msync 不持锁：只有本线程会删除段，映射在这期间一直有效
+void OfflineStore::syncSegments() {
+    struct Dirty {
+        uint32_t no;
+        char* base;
+        size_t from;
+        size_t to;
+    };
+    vector<Dirty> dirty;
+    {
+        lock_guard<mutex> lock(_mtx);
+        for (map<uint32_t, Segment>::iterator it = _segments.begin(); it != _segments.end(); ++it) {
+            Segment& seg = it->second;
+            if (seg.used > seg.synced) {
+                Dirty d = {seg.no, seg.base, seg.synced, seg.used};
+                dirty.push_back(d);
+            }
+        }
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < dirty.size(); i++) {
+        size_t from = dirty[i].from & ~(page - 1);
+        msync(dirty[i].base + from, dirty[i].to - from, MS_SYNC);
+    }
+    lock_guard<mutex> lock(_mtx);
+    for (size_t i = 0; i < dirty.size(); i++) {
+        map<uint32_t, Segment>::iterator it = _segments.find(dirty[i].no);
+        if (it != _segments.end() && it->second.synced < dirty[i].to) it->second.synced = dirty[i].to;
+    }
+}
+
+// 结束离线超过 TTL 的会话。它们的记录由随后的压缩清理
+void OfflineStore::expireSessions() {
+    if (_sessionTtlSec <= 0) return;
+    uint64_t now = steadyMs(), ttlMs = (uint64_t)_sessionTtlSec * 1000;
+    size_t expired = 0;
+    lock_guard<mutex> lock(_mtx);
+    if (!_open.load(memory_order_relaxed)) return;
+    for (unordered_map<int, Session>::iterator it = _sessions.begin(); it != _sessions.end();) {
+        unordered_map<int, Session>::iterator cur = it++;
+        if (!cur->second.online && now - cur->second.offlineSince >= ttlMs) {
+            endLocked(cur);
+            expired++;
+        }
+    }
+    if (expired > 0) {
+        LOG_INFO(LOG_CAT_SERVER, "[Store] Expired %zu session(s) offline for more than %d s.", expired, _sessionTtlSec);
+    }
+}
+
+// 压缩最老的段：它的有效数据不到一半，或者整个日志里无效数据超过一半（长期不上线的会话占着最老的段时，
+// 仍然要把它搬走，后面已经失效的段才能轮到）。仍然有效的消息和会话记录追加到最新的段，然后删掉这个段。
+// 确认记录不搬：它确认的消息都在它之前，最老的段删掉之后那些消息也不存在了，更新的段里还有更新的确认。
+// 返回 true 表示删掉了一个段，可以接着检查下一个
+bool OfflineStore::compactOldest() {
+    uint32_t no;
+    {
+        lock_guard<mutex> lock(_mtx);
+        if (!_open.load(memory_order_relaxed) || _segments.size() < 2) return false;
+        size_t used = 0, live = 0;
+        for (map<uint32_t, Segment>::iterator it = _segments.begin(); it != _segments.end(); ++it) {
+            used += it->second.used;
+            live += it->second.liveBytes;
+        }
+        Segment& old = _segments.begin()->second;
+        if (old.liveBytes * 2 > old.used && live * 2 > used) return false;
+        no = old.no;
+    }
+
+    size_t off = 0;
+    size_t moved = 0;
+    for (;;) {
+        lock_guard<mutex> lock(_mtx);
+        if (!_open.load(memory_order_relaxed)) return false;
+        map<uint32_t, Segment>::iterator oldIt = _segments.begin();
+        Segment& old = oldIt->second;
+        for (int n = 0; n < COMPACT_CHUNK && off < old.used; n++) {
+            RecordHeader h;
+            memcpy(&h, old.base + off, sizeof(h));
+            uint32_t len = (uint32_t)recordLen(h.length);
+            StrView body(old.base + off + sizeof(h), h.length);
+            unordered_map<int, Session>::iterator sit = _sessions.find(h.target);
+            if (h.kind == REC_END && h.target == _nextSessionId - 1) {
+                // 最新分配的 ID 已经结束：结束记录要留着，重启后才不会把这个 ID 再分配出去
+                uint32_t segNo, at, newLen;
+                if (!appendRecord(REC_END, h.target, 0, 0, StrView(), segNo, at, newLen)) return false;
+                moved++;
+            } else if (sit != _sessions.end()) {
+                Session& s = sit->second;
+                uint32_t segNo, at, newLen;
+                if (h.kind == REC_SESSION && s.seg == no && s.off == off) {
+                    if (!appendRecord(REC_SESSION, h.target, 0, 0, body, segNo, at, newLen)) return false;
+                    old.liveBytes -= s.len;
+                    s.seg = segNo;
+                    s.off = at;
+                    _segments[segNo].liveBytes += newLen;
+                    moved++;
+                } else if (h.kind == REC_MSG && h.seq > s.acked) {
+                    deque<MsgRef>::iterator m = lower_bound(s.msgs.begin(), s.msgs.end(), h.seq,
+                        [](const MsgRef& r, uint64_t seq) { return r.seq < seq; });
+                    if (m != s.msgs.end() && m->seq == h.seq && m->seg == no && m->off == off) {
+                        if (!appendRecord(REC_MSG, h.target, h.sender, h.seq, body, segNo, at, newLen)) return false;
+                        old.liveBytes -= m->len;
+                        m->seg = segNo;
+                        m->off = at;
+                        _segments[segNo].liveBytes += newLen;
+                        moved++;
+                    }
+                }
+            }
+            off += len;
+        }
+        if (off >= old.used) {
+            LOG_DEBUG(LOG_CAT_SERVER, "[Store] Compacted segment %u: moved %zu live record(s), freed %zu bytes",
+                      no, moved, old.used);
+            dropSegment(oldIt);
+            return true;
+        }
+    }
+}
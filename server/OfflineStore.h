@@ -0,0 +1,189 @@
+#ifndef OFFLINE_STORE_H
+#define OFFLINE_STORE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <stdint.h>
+#include "../common/StrView.h"
+
+#define STORE_SEGMENT_BYTES (64 * 1024 * 1024) // 每个日志段文件的大小（默认值）
+#define STORE_MAX_PER_CLIENT 10000             // 每个会话最多排队的离线消息数（默认值）
+#define STORE_COMPACT_MS 1000                  // 后台线程同步和压缩的间隔
+#define STORE_SESSION_TTL_SEC (7 * 24 * 3600)  // 会话离线超过这么久就过期（默认值），0 表示永不过期
+#define SESSION_ID_BASE 1000000000             // 会话 ID 从这里开始分配，不会和连接 ID 重叠
+#define SESSION_TOKEN_LEN 32                   // 会话令牌：16 个随机字节的十六进制
+
+// append 的结果
+enum StoreResult {
+    STORE_OK = 0,           // 已经写进日志，等对方重连时投递
+    STORE_ONLINE = 1,       // 对方在线（刚刚恢复会话），应该直接转发
+    STORE_FULL = 2,         // 对方的离线队列已满
+    STORE_UNKNOWN = 3,      // 不是会话 ID
+    STORE_CLOSED = 4        // 存储没有打开（未配置或热重启交接中）
+};
+
+// 取出的一条离线消息
+struct StoredMsg {
+    uint64_t seq;           // 全局递增的序号，投递后按它确认
+    int sender;             // 发送方 ID
+    std::string content;    // 正文（不含 "[From x]: " 前缀）
+};
+
+// 统计
+struct StoreStats {
+    size_t sessions;        // 会话数
+    size_t queued;          // 排队中的离线消息
+    size_t segments;        // 日志段文件数
+    uint64_t diskBytes;     // 日志段已用的字节
+    uint64_t stored;        // 累计写入的离线消息
+    uint64_t delivered;     // 累计投递的离线消息
+};
+
+// 会话和离线消息的持久化存储：追加写的日志，按段 mmap
+//
+// 日志由若干个定长的段文件组成（offline.00000001.log ...），只往最新的段末尾追加，写满了再开一个新段。
+// 记录有四种：SESSION（会话 ID 和令牌）、MSG（发给某个会话的一条消息）、ACK（某个会话的消息已经投递到第几号）、
+// END（会话已经结束：客户端主动退出，或者离线超过 TTL 被后台线程清理）。
+// 追加就是在映射的内存里 memcpy，不走 write 系统调用；后台线程每秒 msync 一次新写的部分。
+// 内存里只保存索引：每个会话一个按序号排列的队列，指向消息在段里的位置，取消息时才从映射里拷贝正文。
+//
+// 启动时按顺序重放所有段：每条记录带校验和，遇到写了一半的记录就停在那里，之后从这个位置继续追加。
+// 确认记录只会出现在它所确认的消息之后（同一段或更新的段），所以从最老的段开始压缩总是安全的：
+// 后台线程在最老的段里的有效数据不到一半时，把其中还没投递的消息和会话记录追加到最新的段，然后删除这个段。
+// 结束的会话不再搬，它的记录随段一起删掉；只有最新分配的 ID 的结束记录会被搬走，重启后会话 ID 不会重复分配。
+//
+// 所有方法线程安全，一把锁保护索引和追加位置；在线转发不经过这里，只有目标不在线时才追加。
+// 同一个目录同时只能被一个进程打开（目录下的 LOCK 文件加 flock），热重启时新进程等旧进程放开。
+class OfflineStore {
+public:
+    OfflineStore();
+    ~OfflineStore();
+
+    // 打开目录并重放日志。其他进程持有锁时最多等待 waitMs。sessionTtlSec 为 0 时会话不过期
+    bool open(const std::string& dir, size_t segmentBytes, size_t maxPerClient, int sessionTtlSec, int waitMs,
+              std::string& err);
+
+    // 停止后台线程，同步并关闭所有段，放开锁。之后的调用都按未打开处理
+    void close();
+
+    bool isOpen() const { return _open.load(std::memory_order_acquire); }
+
+    // --- 会话 ---
+
+    // 新建会话，返回会话 ID 和令牌；存储未打开或写日志失败时返回 0
+    int createSession(std::string& token);
+
+    // 结束会话：写一条结束记录，丢弃排队的离线消息，令牌随之失效。之后发给这个 ID 的消息按目标不存在处理。
+    // 不是会话时返回 false
+    bool endSession(int id);
+
+    // 按令牌查找会话，未知返回 0
+    int findSession(StrView token);
+
+    // 会话的令牌，不是会话时返回空串
+    std::string tokenOf(int id);
+
+    // 标记会话在线/离线。恢复会话时先登记连接再 attach，断开时先 detach 再移除连接，
+    // 这样 append 看到 "在线" 时对方一定查得到（见 STORE_ONLINE）。离线超过 TTL 的会话由后台线程结束
+    void attach(int id);
+    void detach(int id);
+
+    // --- 离线消息 ---
+
+    // 把发给离线会话 target 的消息写进日志
+    StoreResult append(int target, int sender, StrView content);
+
+    // 拷贝出 target 最早的最多 max 条消息（不删除），投递后用 ack 确认
+    size_t take(int target, size_t max, std::vector<StoredMsg>& out);
+
+    // 序号不超过 seq 的消息已经投递：从队列删除并写一条确认记录
+    void ack(int target, uint64_t seq);
+
+    void stats(StoreStats& out);
+
+private:
+    // 一个段文件
+    struct Segment {
+        uint32_t no;        // 文件编号
+        int fd;
+        char* base;         // 映射的起点
+        size_t cap;         // 文件大小
+        size_t used;        // 已写到的位置
+        size_t synced;      // 已 msync 到的位置
+        size_t liveBytes;   // 仍然有效的记录（未投递的消息和会话）占的字节
+
+        Segment() : no(0), fd(-1), base(nullptr), cap(0), used(0), synced(0), liveBytes(0) {}
+    };
+
+    // 消息在日志里的位置
+    struct MsgRef {
+        uint64_t seq;
+        uint32_t seg;       // 段编号
+        uint32_t off;       // 记录在段里的偏移
+        uint32_t len;       // 记录长度（含头部和对齐）
+    };
+
+    struct Session {
+        std::string token;
+        uint32_t seg;       // 会话记录所在的段
+        uint32_t off;
+        uint32_t len;
+        bool online;
+        uint64_t offlineSince; // 离线的起始时间（steady clock 毫秒），重放时从打开的时间算起
+        uint64_t acked;     // 已投递到的序号
+        std::deque<MsgRef> msgs; // 未投递的消息，按序号升序
+
+        Session() : seg(0), off(0), len(0), online(false), offlineSince(0), acked(0) {}
+    };
+
+    bool lockDir(int waitMs, std::string& err);
+    bool replay(std::string& err);
+    bool scanSegment(Segment& seg);
+    // cap 不为 0 时新建这么大的段文件，为 0 时打开已有的段
+    Segment* openSegment(uint32_t no, size_t cap, std::string& err);
+    void dropSegment(std::map<uint32_t, Segment>::iterator it);
+
+    // 追加一条记录（持有 _mtx），返回记录的位置；失败返回 false
+    bool appendRecord(uint8_t kind, int target, int sender, uint64_t seq, StrView body,
+                      uint32_t& segNo, uint32_t& off, uint32_t& len);
+
+    // 结束会话（持有 _mtx）：写结束记录，从索引中删除，它的记录不再算有效数据
+    void endLocked(std::unordered_map<int, Session>::iterator it);
+
+    void compactLoop();
+    void syncSegments();
+    void expireSessions();
+    bool compactOldest();
+
+    std::string _dir;
+    size_t _segmentBytes;
+    size_t _maxPerClient;
+    int _sessionTtlSec;
+    int _lockFd;
+    std::atomic<bool> _open;
+
+    std::mutex _mtx;                            // 保护以下所有成员
+    std::map<uint32_t, Segment> _segments;      // 按编号升序，最后一个是正在追加的段
+    std::unordered_map<int, Session> _sessions;
+    std::unordered_map<std::string, int> _tokens;
+    uint64_t _nextSeq;
+    int _nextSessionId;
+    size_t _queued;
+    uint64_t _stored;
+    uint64_t _delivered;
+
+    // 后台同步和压缩
+    std::thread _compactor;
+    std::mutex _stopMtx;
+    std::condition_variable _stopCv;
+    bool _stopping;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "OutQueue.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#define OUTQ_INIT_SLOTS 8
+#define OUTQ_COALESCE_MAX (64 * 1024)   // 小包合并进同一段的上限
+#define OUTQ_MAX_IOV 64                 // 一次 sendmsg 最多聚合的段数
+#define OUTQ_SHARE_MIN 512              // 共享缓冲区小于它时直接拷贝合并，比单独占一段更省
+#define OUTQ_SEG_INIT 1024              // 新的独占段至少预留的容量，后面的小包合并进来时不必马上扩容
+
+struct OutQueue::AsyncSend {
+    struct msghdr msg;
+    struct iovec iov[OUTQ_MAX_IOV];
+};
+
+OutQueue::OutQueue() : _head(0), _count(0), _bytes(0), _zcNextId(0), _async(nullptr), _sealed(0) {}
+
+OutQueue::~OutQueue() {
+    if (_async) BufferPool::free(_async, BufferPool::roundUp(sizeof(AsyncSend)));
+}
+
+// 取一个新的队尾槽位，满了就按 2 倍扩容（只在队列变长时发生）；第一次发送时才分配，从没收到过消息的连接不占
+OutQueue::Segment& OutQueue::pushSlot() {
+    if (_count == _ring.size()) {
+        std::vector<Segment> bigger(std::max(_ring.size() * 2, (size_t)OUTQ_INIT_SLOTS));
+        for (size_t i = 0; i < _count; i++) {
+            Segment& s = _ring[(_head + i) & (_ring.size() - 1)];
+            bigger[i].own.swap(s.own);
+            bigger[i].shared.swap(s.shared);
+            bigger[i].off = s.off;
+        }
+        _ring.swap(bigger);
+        _head = 0;
+    }
+    _count++;
+    Segment& seg = back();
+    seg.off = 0;
+    return seg;
+}
+
+void OutQueue::popFront() {
+    Segment& seg = front();
+    seg.own.release();  // 还给内存池，空闲的连接不占缓冲区
+    seg.shared.reset();
+    seg.off = 0;
+    _head = (_head + 1) & (_ring.size() - 1);
+    _count--;
+}
+
+void OutQueue::append(StrView data) {
+    if (data.len == 0) return;
+    if (_count > _sealed) {
+        Segment& tail = back();
+        if (!tail.shared && tail.own.size() + data.len <= OUTQ_COALESCE_MAX) {
+            tail.own.append(data);
+            _bytes.fetch_add(data.len, std::memory_order_relaxed);
+            return;
+        }
+    }
+    Segment& seg = pushSlot();
+    seg.own.reserve(std::max(data.len, (size_t)OUTQ_SEG_INIT));
+    seg.own.assign(data);
+    _bytes.fetch_add(data.len, std::memory_order_relaxed);
+}
+
+void OutQueue::appendShared(const SharedBuf& buf) {
+    if (!buf || buf->empty()) return;
+    if (buf->size() < OUTQ_SHARE_MIN) {
+        append(buf->view());
+        return;
+    }
+    Segment& seg = pushSlot();
+    seg.shared = buf;
+    _bytes.fetch_add(buf->size(), std::memory_order_relaxed);
+}
+
+// 已发送 n 字节：弹出写完的段，最后一段记录偏移
+void OutQueue::consume(size_t n) {
+    _bytes.fetch_sub(n, std::memory_order_relaxed);
+    while (n > 0 && _count > 0) {
+        Segment& seg = front();
+        size_t left = seg.size() - seg.off;
+        if (n < left) {
+            seg.off += n;
+            return;
+        }
+        n -= left;
+        popFront();
+    }
+}
+
+bool OutQueue::flush(int fd, size_t zeroCopyThreshold, bool& blocked) {
+    blocked = false;
+    while (_count > 0) {
+        Segment& head = front();
+        ssize_t n;
+
+        if (zeroCopyThreshold > 0 && head.size() - head.off >= zeroCopyThreshold) {
+            // 大段：单独零拷贝发送。独占段先转成共享（只移交内存块，不拷贝），好在完成通知之前一直持有
+            if (!head.shared) head.shared = makeSharedBuf(std::move(head.own));
+            n = send(fd, head.data() + head.off, head.size() - head.off,
+                     MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n >= 0) {
+                ZeroCopyPending p;
+                p.id = _zcNextId++;
+                p.buf = head.shared;
+                _zcPending.push_back(p);
+            } else if (errno == ENOBUFS) {
+                // 超出 optmem 限制，这一段退回普通发送
+                n = send(fd, head.data() + head.off, head.size() - head.off, MSG_NOSIGNAL | MSG_DONTWAIT);
+            }
+        } else {
+            // 聚合连续的普通段，一次 sendmsg 写出（sendmsg 可以带 MSG_NOSIGNAL，writev 不行）
+            struct iovec iov[OUTQ_MAX_IOV];
+            int iovCnt = 0;
+            for (size_t i = 0; i < _count && iovCnt < OUTQ_MAX_IOV; i++) {
+                Segment& seg = _ring[(_head + i) & (_ring.size() - 1)];
+                size_t len = seg.size() - seg.off;
+                if (i > 0 && zeroCopyThreshold > 0 && len >= zeroCopyThreshold) break;
+                iov[iovCnt].iov_base = (void*)(seg.data() + seg.off);
+                iov[iovCnt].iov_len = len;
+                iovCnt++;
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iovCnt;
+            n = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+
+        if (n > 0) {
+            consume((size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            blocked = true;
+            return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+void OutQueue::reapZeroCopy(int fd) {
+    char control[128];
+    while (!_zcPending.empty()) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+        for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            // [ee_info, ee_data] 区间内的发送都已完成；序号按发送顺序分配，可以从队头依次释放
+            uint32_t hi = serr->ee_data;
+            while (!_zcPending.empty() && (int32_t)(_zcPending.front().id - hi) <= 0) {
+                _zcPending.pop_front();
+            }
+        }
+    }
+}
+
+const struct msghdr* OutQueue::prepareSend() {
+    if (_count == 0) return nullptr;
+    if (!_async) _async = (AsyncSend*)BufferPool::alloc(BufferPool::roundUp(sizeof(AsyncSend)));
+    int iovCnt = 0;
+    for (size_t i = 0; i < _count && iovCnt < OUTQ_MAX_IOV; i++) {
+        Segment& seg = _ring[(_head + i) & (_ring.size() - 1)];
+        _async->iov[iovCnt].iov_base = (void*)(seg.data() + seg.off);
+        _async->iov[iovCnt].iov_len = seg.size() - seg.off;
+        iovCnt++;
+    }
+    // 段的内存块在扩容槽位时只交换指针，地址不变；只要不再往这些段里合并，iovec 就一直有效
+    _sealed = iovCnt;
+    memset(&_async->msg, 0, sizeof(_async->msg));
+    _async->msg.msg_iov = _async->iov;
+    _async->msg.msg_iovlen = iovCnt;
+    return &_async->msg;
+}
+
+void OutQueue::completeSend(size_t n) {
+    _sealed = 0;
+    consume(n);
+    if (_count == 0 && _async) {
+        BufferPool::free(_async, BufferPool::roundUp(sizeof(AsyncSend)));
+        _async = nullptr;
+    }
+}
+
+void OutQueue::clear() {
+    // 异步发送中的段内核还在读，留到 completeSend 之后再清
+    size_t keep = 0;
+    while (_count > _sealed) {
+        Segment& seg = back();
+        seg.own.release();
+        seg.shared.reset();
+        seg.off = 0;
+        _count--;
+    }
+    for (size_t i = 0; i < _count; i++) {
+        Segment& seg = _ring[(_head + i) & (_ring.size() - 1)];
+        keep += seg.size() - seg.off;
+    }
+    _bytes.store(keep, std::memory_order_relaxed);
+    // _zcPending 不动：没收到完成通知的零拷贝发送内核可能还在读这些页，提前还给内存池会被复用改写。
+    // 套接字还开着时由 reapZeroCopy 照常释放，关闭之后随队列一起析构
+    if (_count == 0 && _async) {
+        BufferPool::free(_async, BufferPool::roundUp(sizeof(AsyncSend)));
+        _async = nullptr;
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef OUT_QUEUE_H
+#define OUT_QUEUE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <stdint.h>
+#include "../common/StrView.h"
+#include "../common/BufferPool.h"
+
+// 每个连接的发送队列
+//
+// 队列由若干段组成：小包拷贝进连接独占的段并合并，共享的只读缓冲区（多个连接发送同一份数据）
+// 只保存引用。flush 用 sendmsg 把多段聚合成一次系统调用；超过阈值的大段单独用 MSG_ZEROCOPY 发送，
+// 缓冲区在内核确认完成之前一直保留。
+// 段保存在环形数组里，独占段的内存来自 BufferPool：段发完就把块还回去（本线程的缓存，不加锁），
+// 下次入队再取，稳定状态下不调用 malloc，空闲的连接也不占着缓冲区。
+class OutQueue {
+public:
+    OutQueue();
+    ~OutQueue();
+
+    // 排队中的字节数（其他线程读它做水位判断，是近似值）
+    size_t bytes() const { return _bytes.load(std::memory_order_relaxed); }
+    bool empty() const { return _count == 0; }
+
+    // 拷贝到队尾，能合并就并进最后一个独占段
+    void append(StrView data);
+
+    // 追加共享的只读缓冲区，不拷贝（很小的缓冲区仍拷贝进独占段合并）
+    void appendShared(const SharedBuf& buf);
+
+    // 非阻塞地尽量写出。写到 EAGAIN 时 blocked 置为 true；连接出错返回 false
+    // zeroCopyThreshold 为 0 表示不使用 MSG_ZEROCOPY
+    bool flush(int fd, size_t zeroCopyThreshold, bool& blocked);
+
+    // 读取 MSG_ZEROCOPY 完成通知（EPOLLERR），释放内核已经用完的缓冲区
+    void reapZeroCopy(int fd);
+
+    // 【io_uring】准备一次异步 sendmsg：队头的若干段在 completeSend 之前固定不动，之后入队的数据另起新段。
+    // 返回的 msghdr 一直有效到 completeSend；队列为空时返回 nullptr
+    const struct msghdr* prepareSend();
+
+    // 异步发送完成，写出了 n 字节（出错时为 0）
+    void completeSend(size_t n);
+
+    // 有已提交、还没完成的异步发送
+    bool sending() const { return _sealed > 0; }
+
+    // 丢弃全部数据（连接关闭时）；异步发送中的段保留到 completeSend，之后要再调用一次。
+    // 零拷贝发送的缓冲区保留到收到完成通知或者队列析构
+    void clear();
+
+private:
+    struct Segment {
+        PooledBuf own;                              // 本连接独占的数据
+        SharedBuf shared;                           // 共享数据，非空时优先使用
+        size_t off;                                 // 已发送的字节数
+
+        Segment() : off(0) {}
+        const char* data() const { return shared ? shared->data() : own.data(); }
+        size_t size() const { return shared ? shared->size() : own.size(); }
+    };
+
+    // 等待内核完成通知的零拷贝发送
+    struct ZeroCopyPending {
+        uint32_t id;                                // 内核为每次零拷贝发送分配的递增序号
+        SharedBuf buf;                              // 保证缓冲区在完成前不被释放
+    };
+
+    struct AsyncSend;                               // 异步发送的 msghdr 和 iovec，见 prepareSend
+
+    Segment& front() { return _ring[_head]; }
+    Segment& back() { return _ring[(_head + _count - 1) & (_ring.size() - 1)]; }
+    Segment& pushSlot();
+    void popFront();
+    void consume(size_t n);
+
+    std::vector<Segment> _ring;     // 容量为 2 的幂
+    size_t _head;
+    size_t _count;
+    std::atomic<size_t> _bytes;
+
+    std::deque<ZeroCopyPending> _zcPending;
+    uint32_t _zcNextId;
+
+    AsyncSend* _async;              // 从内存池分配，队列写空时还回去
+    size_t _sealed;                 // 队头被异步发送固定的段数
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef REPLY_CACHE_H
+#define REPLY_CACHE_H
+
+#include <string>
+#include "../common/NetMsg.h"
+
+// 预先编码好的应答
+//
+// 内容很少变化的应答（时间、主机名）在内容变化时编码一次，之后每个请求只拷贝现成的帧：
+// 不带关联 ID 的请求直接用文本帧或二进制帧；带关联 ID 的二进制请求拷贝模板后改写 4 字节 ID；
+// 文本帧的关联 ID 在类型字段里、长度不定，只能从缓存的内容重新编码（仍省去了生成内容的开销）。
+class CachedReply {
+public:
+    CachedReply() : _type(0) {}
+
+    // 内容变化时重新编码
+    void set(char type, StrView payload) {
+        _type = type;
+        _payload.assign(payload.data, payload.len);
+        _text.clear();
+        NetMsg::encodeTo(_text, type, 0, _payload, false);
+        _binary.clear();
+        NetMsg::encodeTo(_binary, type, 0, _payload, true);
+        _binaryCorr.clear();
+        NetMsg::encodeTo(_binaryCorr, type, 0, _payload, true, 1); // ID 占位，发送时改写
+    }
+
+    StrView payload() const { return _payload; }
+
+    // 取应答帧，需要改写时写进 scratch（调用方传入已清空的复用缓冲区）
+    StrView frame(bool binary, uint32_t corrId, std::string& scratch) const {
+        if (corrId == 0) return binary ? StrView(_binary) : StrView(_text);
+        if (binary) {
+            scratch.append(_binaryCorr);
+            NetMsg::patchCorrId(&scratch[scratch.size() - _binaryCorr.size()], corrId);
+        } else {
+            NetMsg::encodeTo(scratch, _type, 0, _payload, false, corrId);
+        }
+        return scratch;
+    }
+
+private:
+    char _type;
+    std::string _payload;
+    std::string _text;          // 文本帧，不带关联 ID
+    std::string _binary;        // 二进制帧，不带关联 ID
+    std::string _binaryCorr;    // 二进制帧，带关联 ID
+};
+
+#endif
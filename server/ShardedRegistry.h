@@ -0,0 +1,274 @@
+#ifndef SHARDED_REGISTRY_H
+#define SHARDED_REGISTRY_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#define REGISTRY_SHARD_BITS 4           // 分片数 = 2^REGISTRY_SHARD_BITS
+#define REGISTRY_SHARDS (1 << REGISTRY_SHARD_BITS)
+#define REGISTRY_INIT_BUCKETS 256       // 每个分片初始的桶数，必须是 2 的幂
+#define REGISTRY_MAX_LOAD 2             // 平均每个桶超过这么多个元素时桶数翻倍
+#define REGISTRY_SNAPSHOT_RETRIES 8     // 无锁快照重试次数，超过后锁住所有分片再取
+
+// 按 ID 分片的并发注册表（逐个元素的 RCU）
+//
+// 每个分片是一个桶数组，每个桶是一条单链表，节点创建后内容不再改变。读者不加锁：先在分片上登记读者计数，
+// 再沿链表按 ID 查找。写者（登记/注销连接，远少于查找）在分片锁下只改一个指针：登记把新节点挂到桶头，
+// 注销把节点从链表上摘下，都是 O(1)，不复制整个分片，connect 风暴时也不会变成平方复杂度。
+// 摘下的节点要等所有可能还在读它的读者离开（宽限期）才能释放：这一步在分片锁之外进行，
+// 不挡住其他写者；同一分片上的等待合并进同一个宽限期，断开风暴时不必每个连接各等一次。
+// 读者计数分两个相位，等待前先把新读者引到另一边，等待总会结束，不会被源源不断的读者饿死。
+// 元素多到桶太挤时把桶数翻倍：复制出新的桶数组和节点后原子地替换，旧的同样过了宽限期再释放，均摊仍是 O(1)。
+//
+// snapshot 用全局版本号做乐观的一致性检查：取快照期间没有任何写者完成或正在修改，
+// 结果就是某一时刻所有分片的内容；否则重试，多次失败后锁住所有分片再取。
+template <typename T>
+class ShardedRegistry {
+public:
+    typedef std::shared_ptr<T> Ptr;
+
+    ShardedRegistry() : _version(0), _writers(0) {
+        for (int i = 0; i < REGISTRY_SHARDS; i++) {
+            _shards[i].table.store(new Table(REGISTRY_INIT_BUCKETS));
+        }
+    }
+
+    ~ShardedRegistry() {
+        for (int i = 0; i < REGISTRY_SHARDS; i++) {
+            delete _shards[i].table.load();
+        }
+    }
+
+    // 【热路径】按 ID 查找，不加锁。找不到返回空指针
+    Ptr find(int id) const {
+        Shard& shard = shardOf(id);
+        ReadGuard guard(shard);
+        const Table* table = shard.table.load();
+        for (const Node* n = table->buckets[slotOf(id, table->mask)].load(); n; n = n->next.load()) {
+            if (n->id == id) return n->value;
+        }
+        return Ptr();
+    }
+
+    // 登记，ID 已存在时返回 false
+    bool insert(int id, const Ptr& value) {
+        Shard& shard = shardOf(id);
+        Node* node = new Node(id, value); // 在锁外分配
+        Table* retired = nullptr;
+        {
+            lock_guard_t lock(shard.writeMtx);
+            Table* table = shard.table.load();
+            std::atomic<Node*>& head = table->buckets[slotOf(id, table->mask)];
+            for (Node* n = head.load(); n; n = n->next.load()) {
+                if (n->id == id) {
+                    delete node;
+                    return false;
+                }
+            }
+
+            beginWrite();
+            node->next.store(head.load());
+            head.store(node); // 读者要么看到新节点，要么看不到，链表始终完整
+            if (++shard.count > (table->mask + 1) * REGISTRY_MAX_LOAD) retired = grow(shard, table);
+            endWrite();
+        }
+        if (retired) {
+            synchronize(shard);
+            delete retired;
+        }
+        return true;
+    }
+
+    // 注销，只有当前登记的正是 expected 时才移除（防止同一个连接被关闭两次）
+    bool remove(int id, const Ptr& expected) {
+        Shard& shard = shardOf(id);
+        Node* node;
+        {
+            lock_guard_t lock(shard.writeMtx);
+            Table* table = shard.table.load();
+            std::atomic<Node*>* link = &table->buckets[slotOf(id, table->mask)];
+            for (node = link->load(); node && node->id != id; node = node->next.load()) {
+                link = &node->next;
+            }
+            if (node == nullptr || node->value != expected) return false;
+
+            beginWrite();
+            link->store(node->next.load()); // 正停在这个节点上的读者沿 next 照常走完
+            shard.count--;
+            endWrite();
+        }
+        synchronize(shard);
+        delete node;
+        return true;
+    }
+
+    // 一致的快照，按 ID 升序。只持有元素的引用，调用方遍历时不影响其他线程
+    void snapshot(std::vector<Ptr>& out) const {
+        static thread_local std::vector<std::pair<int, Ptr> > items; // 复用容量，广播时不必每次扩容
+        for (int attempt = 0; ; attempt++) {
+            items.clear();
+            if (attempt >= REGISTRY_SNAPSHOT_RETRIES) {
+                // 写者太频繁：按固定顺序锁住所有分片（写者一次只锁一个分片，不会死锁）
+                for (int i = 0; i < REGISTRY_SHARDS; i++) _shards[i].writeMtx.lock();
+                collect(items);
+                for (int i = REGISTRY_SHARDS - 1; i >= 0; i--) _shards[i].writeMtx.unlock();
+                break;
+            }
+
+            unsigned long version = _version.load();
+            if (_writers.load() != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            collect(items);
+            if (_writers.load() == 0 && _version.load() == version) break;
+        }
+
+        std::sort(items.begin(), items.end(), lessById);
+        out.clear();
+        out.reserve(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            out.push_back(std::move(items[i].second));
+        }
+    }
+
+private:
+    typedef std::lock_guard<std::mutex> lock_guard_t;
+
+    // 链表节点：id 和 value 在挂上链表之前写好，之后只有 next 会被写者改动
+    struct Node {
+        int id;
+        Ptr value;
+        std::atomic<Node*> next;
+
+        Node(int i, const Ptr& v) : id(i), value(v), next(nullptr) {}
+    };
+
+    // 桶数组，析构时连同链表上的节点一起释放
+    struct Table {
+        size_t mask;
+        std::atomic<Node*>* buckets;
+
+        explicit Table(size_t n) : mask(n - 1), buckets(new std::atomic<Node*>[n]) {
+            for (size_t i = 0; i < n; i++) buckets[i].store(nullptr, std::memory_order_relaxed);
+        }
+        ~Table() {
+            for (size_t i = 0; i <= mask; i++) {
+                Node* n = buckets[i].load(std::memory_order_relaxed);
+                while (n) {
+                    Node* next = n->next.load(std::memory_order_relaxed);
+                    delete n;
+                    n = next;
+                }
+            }
+            delete[] buckets;
+        }
+    };
+
+    // 每个分片独占缓存行，不同分片上的读者计数互不干扰
+    struct alignas(64) Shard {
+        std::atomic<Table*> table;          // 当前的桶数组
+        std::atomic<unsigned> phase;        // 读者登记到 readers[phase & 1]
+        std::atomic<long> readers[2];       // 两个相位上正在读的读者数
+        std::mutex writeMtx;                // 串行化本分片的写者，只在改指针时持有
+        size_t count;                       // 元素个数，由 writeMtx 保护
+
+        std::mutex graceMtx;                // 串行化本分片的宽限期等待，不挡写者
+        std::atomic<unsigned long> graceStarted; // 开始过的宽限期数
+        unsigned long graceDone;            // 已经结束的最后一个宽限期的序号，由 graceMtx 保护
+
+        Shard() : table(nullptr), phase(0), count(0), graceStarted(0), graceDone(0) {
+            readers[0].store(0);
+            readers[1].store(0);
+        }
+    };
+
+    // 读者登记：必须先计数再读 table，写者摘除节点之后的等待才能看到它
+    struct ReadGuard {
+        Shard& shard;
+        unsigned idx;
+
+        explicit ReadGuard(Shard& s) : shard(s), idx(s.phase.load() & 1) {
+            shard.readers[idx].fetch_add(1);
+        }
+        ~ReadGuard() { shard.readers[idx].fetch_sub(1); }
+    };
+
+    Shard& shardOf(int id) const {
+        return _shards[(unsigned)id & (REGISTRY_SHARDS - 1)];
+    }
+
+    // ID 基本是连续分配的，去掉分片用掉的低位后直接取模就很均匀
+    static size_t slotOf(int id, size_t mask) {
+        return ((unsigned)id >> REGISTRY_SHARD_BITS) & mask;
+    }
+
+    // 快照的一致性检查：修改链表前后各记一次
+    void beginWrite() { _writers.fetch_add(1); }
+    void endWrite() {
+        _version.fetch_add(1);
+        _writers.fetch_sub(1);
+    }
+
+    // 桶数翻倍：复制出新的桶数组和节点后替换，返回旧的，由调用方过了宽限期后释放。调用方持有 shard.writeMtx
+    Table* grow(Shard& shard, Table* table) {
+        Table* next = new Table((table->mask + 1) * 2);
+        for (size_t i = 0; i <= table->mask; i++) {
+            for (Node* n = table->buckets[i].load(); n; n = n->next.load()) {
+                Node* copy = new Node(n->id, n->value);
+                std::atomic<Node*>& head = next->buckets[slotOf(n->id, next->mask)];
+                copy->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                head.store(copy, std::memory_order_relaxed);
+            }
+        }
+        shard.table.store(next); // 发布：之前的写入对读到 next 的读者都可见
+        return table;
+    }
+
+    // 宽限期：等调用前已经开始的读者全部离开。调用前摘下的节点在这之后没有读者持有，可以释放。
+    // 两边的读者数在摘除之后各归零过一次，之前登记的读者就都已离开（之后登记的读者看不到摘下的节点）；
+    // 先把新读者引到另一边，正在等的这一边只减不增。不持有 writeMtx。
+    // 摘除之后开始的宽限期已经由别的写者等完时直接返回，同一分片上并发的注销共用一次等待
+    void synchronize(Shard& shard) {
+        unsigned long ticket = shard.graceStarted.load();
+        lock_guard_t lock(shard.graceMtx);
+        if (shard.graceDone > ticket) return;
+
+        unsigned long gp = shard.graceStarted.fetch_add(1) + 1;
+        for (unsigned idx = 0; idx < 2; idx++) {
+            shard.phase.store(idx ^ 1);
+            while (shard.readers[idx].load() != 0) std::this_thread::yield();
+        }
+        shard.graceDone = gp;
+    }
+
+    void collect(std::vector<std::pair<int, Ptr> >& items) const {
+        for (int i = 0; i < REGISTRY_SHARDS; i++) {
+            ReadGuard guard(_shards[i]);
+            const Table* table = _shards[i].table.load();
+            for (size_t b = 0; b <= table->mask; b++) {
+                for (const Node* n = table->buckets[b].load(); n; n = n->next.load()) {
+                    items.push_back(std::make_pair(n->id, n->value));
+                }
+            }
+        }
+    }
+
+    static bool lessById(const std::pair<int, Ptr>& a, const std::pair<int, Ptr>& b) {
+        return a.first < b.first;
+    }
+
+    mutable Shard _shards[REGISTRY_SHARDS];
+    std::atomic<unsigned long> _version;    // 每次修改加一
+    std::atomic<int> _writers;              // 正在修改的写者数
+
+    ShardedRegistry(const ShardedRegistry&);
+    ShardedRegistry& operator=(const ShardedRegistry&);
+};
+
+#endif
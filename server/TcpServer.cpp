@@ -1,268 +1,2175 @@
 #include "TcpServer.h"
-#include <iostream>
+#include "Logger.h"
+#include "Metrics.h"
+#include "Handoff.h"
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
+#include <algorithm>
 
 using namespace std;
 
-// 构造函数：初始化 Socket
-TcpServer::TcpServer() : _running(false), _idCounter(100) {
+// epoll data 中的特殊标记，客户端 ID 从 100 开始递增，不会与之冲突
+static const uint64_t TAG_LISTEN = ~0ULL;
+static const uint64_t TAG_WAKE = ~0ULL - 1;
+
+// io_uring 请求的 user_data：连接节点的地址 | 操作类型（节点至少按 8 字节对齐，低 3 位空闲）
+// 监听和唤醒沿用上面两个标记，0 是不关心结果的取消请求
+static const uint64_t URING_OP_RECV = 1;
+static const uint64_t URING_OP_SEND = 2;
+static const uint64_t URING_OP_MASK = 7;
+static const uint16_t URING_BUF_GROUP = 0;
+
+#define LOG_CONTENT_MAX 64  // 日志里消息正文最多记录的字节数
+#define MAX_RETAINED_INFLATE (1024 * 1024) // 解压缓冲区超过这个容量时用完就释放
+
+// 每个线程一个复用的编码缓冲区：clear 不释放容量，稳定状态下编码不再分配内存
+static std::string& scratchBuffer() {
+    static thread_local std::string buf;
+    buf.clear();
+    return buf;
+}
+
+// 每个线程一个复用的压缩输出缓冲区（输入常常就在 scratchBuffer 里）
+static std::string& compressBuffer() {
+    static thread_local std::string buf;
+    buf.clear();
+    return buf;
+}
+
+// 把套接字设为非阻塞
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// 创建监听套接字：socket -> bind -> listen
+int TcpServer::createListenSocket(bool reusePort) {
     // 1. 创建 Socket
-    _listenSock = socket(AF_INET, SOCK_STREAM, 0);
-    if (_listenSock == -1) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == -1) {
         perror("Socket create failed");
         exit(1);
     }
 
     // 2. 设置端口复用 (防止重启时端口被占用)
     int opt = 1;
-    setsockopt(_listenSock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // 多个 Reactor 各自监听同一端口，内核按四元组哈希分配新连接
+    if (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("SO_REUSEPORT failed");
+        exit(1);
+    }
 
     // 3. 绑定端口
     sockaddr_in serverAddr;
     memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY; // 监听所有网卡
-    serverAddr.sin_port = htons(SERVER_PORT);
+    serverAddr.sin_port = htons(_cfg.port);
+    if (inet_pton(AF_INET, _cfg.bindAddr.c_str(), &serverAddr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid bind address: %s\n", _cfg.bindAddr.c_str());
+        exit(1);
+    }
 
-    if (bind(_listenSock, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
+    if (bind(sock, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
         perror("Bind failed");
         exit(1);
     }
 
-    // 4. 开始监听
-    if (listen(_listenSock, 10) < 0) {
-        perror("Listen failed");
-        exit(1);
+    // 4. 设置选项并开始监听（收发缓冲区要在 listen 之前设置，窗口缩放因子在握手时确定）
+    applyListenOptions(sock);
+    return sock;
+}
+
+void TcpServer::applyListenOptions(int fd) {
+    applySocketOptions(fd);
+    if (_cfg.deferAcceptSec > 0 &&
+        setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &_cfg.deferAcceptSec, sizeof(_cfg.deferAcceptSec)) < 0) {
+        LOG_WARN(LOG_CAT_SERVER, "[Server] TCP_DEFER_ACCEPT failed: %s", strerror(errno));
+    }
+    if (listen(fd, _cfg.backlog) < 0) {
+        perror("Listen failed");
+        exit(1);
+    }
+}
+
+// 监听套接字上设置的选项 Linux 会复制给 accept 出来的连接，这里对连接再设一次，
+// 保证从旧进程接管的监听套接字（可能是按旧配置创建的）上 accept 的连接也按当前配置
+void TcpServer::applySocketOptions(int fd) {
+    int one = 1;
+    if (_cfg.tcpNoDelay) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (_cfg.rcvBuf > 0) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &_cfg.rcvBuf, sizeof(_cfg.rcvBuf));
+    if (_cfg.sndBuf > 0) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &_cfg.sndBuf, sizeof(_cfg.sndBuf));
+    if (_cfg.keepAlive) {
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+        if (_cfg.keepIdleSec > 0) setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &_cfg.keepIdleSec, sizeof(int));
+        if (_cfg.keepIntervalSec > 0) setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &_cfg.keepIntervalSec, sizeof(int));
+        if (_cfg.keepCount > 0) setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &_cfg.keepCount, sizeof(int));
+    }
+}
+
+// 构造函数：初始化 Socket
+TcpServer::TcpServer(const ServerConfig& cfg)
+    : _wakeFd(-1), _spareFd(-1), _running(true), _cfg(cfg), _drainDeadline(0), _quiesced(0),
+      _handoffFd(-1), _takeoverFd(-1), _handedOff(false),
+      _timeouts(cfg.heartbeatMs > 0 || cfg.idleTimeoutMs > 0 || cfg.readTimeoutMs > 0),
+      _idCounter(100), _statsFd(-1) {
+    // 主机名运行期间不变，取一次
+    char hostname[128];
+    if (gethostname(hostname, sizeof(hostname)) != 0) {
+        strcpy(hostname, "Server-Unknown");
+    }
+    hostname[sizeof(hostname) - 1] = '\0';
+    _nameReply.set('N', hostname);
+    _connLimiter.configure(_cfg.connRatePerIp, _cfg.connBurstPerIp);
+
+    // 热重启：有旧进程在运行就接管它的监听套接字，不再自己 bind
+    std::vector<int> inherited;
+    if (!_cfg.handoffPath.empty()) takeOver(inherited);
+    for (size_t i = 0; i < inherited.size(); i++) {
+        applyListenOptions(inherited[i]); // 按新进程的配置更新 backlog 等选项
+    }
+
+    if (_cfg.mode == MODE_EPOLL) {
+        initLoops(inherited);
+    } else {
+        // accept 循环用 poll 同时等待监听套接字和唤醒事件；交接期间新旧进程同时 accept，必须非阻塞
+        _listenFds = inherited.empty() ? std::vector<int>(1, createListenSocket(false)) : inherited;
+        for (size_t i = 0; i < _listenFds.size(); i++) setNonBlocking(_listenFds[i]);
+        _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        _spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (_wakeFd < 0) {
+            perror("eventfd failed");
+            exit(1);
+        }
+    }
+}
+
+TcpServer::~TcpServer() {
+    stop();
+
+    if (_handoffFd >= 0) {
+        shutdown(_handoffFd, SHUT_RDWR); // 唤醒阻塞在 accept 上的交接线程
+        if (_handoffThread.joinable()) _handoffThread.join();
+        close(_handoffFd);
+        if (!_handedOff) unlink(_cfg.handoffPath.c_str()); // 交接后路径已属于新进程
+    }
+    stopStats();
+
+    // Reactor 线程的 epoll_wait 带超时，置位后最多一个周期就会退出
+    for (size_t i = 0; i < _loops.size(); i++) {
+        if (_loops[i]->thread.joinable()) {
+            _loops[i]->thread.join();
+        }
+        if (_loops[i]->listenFd >= 0) close(_loops[i]->listenFd);
+        close(_loops[i]->wakeFd);
+        close(_loops[i]->epfd);
+        if (_loops[i]->spareFd >= 0) close(_loops[i]->spareFd);
+    }
+    for (size_t i = 0; i < _listenFds.size(); i++) close(_listenFds[i]);
+    if (_wakeFd >= 0) close(_wakeFd);
+    if (_spareFd >= 0) close(_spareFd);
+}
+
+// 主循环：线程模式只负责 Accept 新连接；epoll 模式由各 Reactor 自己 accept
+void TcpServer::start() {
+    if (_cfg.statsPort > 0) startStats();
+
+    // 离线消息存储：接管时旧进程停止处理请求后才放开，在后台等它，不耽误开始 accept
+    std::thread storeOpener;
+    if (_takeoverFd < 0) {
+        openStore(0);
+    } else {
+        storeOpener = std::thread(&TcpServer::openStore, this, _cfg.drainTimeoutMs + 1000);
+    }
+
+    if (_cfg.mode == MODE_EPOLL) {
+        LOG_INFO(LOG_CAT_SERVER, "[Server] Listening on %s:%d (%s mode, %zu reactor(s) with SO_REUSEPORT)...",
+                 _cfg.bindAddr.c_str(), _cfg.port, _cfg.ioUring ? "io_uring" : "epoll", _loops.size());
+        for (size_t i = 0; i < _loops.size(); i++) {
+            _loops[i]->thread = std::thread(&TcpServer::loopThread, this, _loops[i].get());
+        }
+        finishTakeover();
+        if (!_cfg.handoffPath.empty()) startHandoff();
+        for (size_t i = 0; i < _loops.size(); i++) {
+            _loops[i]->thread.join();
+        }
+        if (storeOpener.joinable()) storeOpener.join();
+        LOG_INFO(LOG_CAT_SERVER, "[Server] All reactors stopped.");
+        return;
+    }
+
+    LOG_INFO(LOG_CAT_SERVER, "[Server] Listening on %s:%d (thread-per-connection mode)...",
+             _cfg.bindAddr.c_str(), _cfg.port);
+    finishTakeover();
+    if (!_cfg.handoffPath.empty()) startHandoff();
+    acceptLoop();
+    drainWorkers();
+    if (storeOpener.joinable()) storeOpener.join();
+    _store.close(); // 不再处理请求，放开存储给热重启的新进程
+    LOG_INFO(LOG_CAT_SERVER, "[Server] All workers stopped.");
+}
+
+// 优雅关闭：第一次调用设置截止时间并唤醒各线程，之后的调用把截止时间提前到现在
+void TcpServer::stop() {
+    bool expected = true;
+    if (!_running.compare_exchange_strong(expected, false)) {
+        _drainDeadline.store(0);
+        return;
+    }
+    _drainDeadline.store(metricsNowNs() + (uint64_t)_cfg.drainTimeoutMs * 1000000ULL);
+    LOG_INFO(LOG_CAT_SERVER, "[Server] Shutting down, draining connections for up to %d ms...", _cfg.drainTimeoutMs);
+
+    uint64_t one = 1;
+    for (size_t i = 0; i < _loops.size(); i++) {
+        ssize_t ret = write(_loops[i]->wakeFd, &one, sizeof(one));
+        (void)ret;
+    }
+    if (_wakeFd >= 0) {
+        ssize_t ret = write(_wakeFd, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+// 线程模式的 accept 循环
+void TcpServer::acceptLoop() {
+    std::vector<pollfd> fds(_listenFds.size() + 1);
+    for (size_t i = 0; i < _listenFds.size(); i++) {
+        fds[i].fd = _listenFds[i];
+        fds[i].events = POLLIN;
+    }
+    fds.back().fd = _wakeFd;
+    fds.back().events = POLLIN;
+
+    std::vector<AcceptedConn> batch;
+    std::vector<std::shared_ptr<ClientNode> > nodes;
+
+    while (_running) {
+        // 开启超时时每个 tick 醒来推进时间轮
+        int n = poll(fds.data(), fds.size(), _timeouts ? (int)_threadTimers.tickMs() : -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR(LOG_CAT_SERVER, "[Server] poll failed: %s", strerror(errno));
+            break;
+        }
+        if (_timeouts) runTimers(_threadTimers);
+
+        // 每次唤醒把队列取空：一批批 accept，每批登记完再一起启动工作线程
+        // 工作线程用阻塞读，所以连接不设 SOCK_NONBLOCK
+        for (size_t i = 0; i + 1 < fds.size() && _running; i++) {
+            if (!(fds[i].revents & POLLIN)) continue;
+            bool drained = false;
+            while (!drained && _running) {
+                batch.clear();
+                nodes.clear();
+                drained = acceptBatch(fds[i].fd, _spareFd, SOCK_CLOEXEC, _cfg.acceptBatch, batch);
+                for (size_t k = 0; k < batch.size(); k++) {
+                    std::shared_ptr<ClientNode> node = registerClient(batch[k].fd, batch[k].addr, nullptr);
+                    if (node) nodes.push_back(node);
+                }
+                startWorkers(nodes);
+            }
+        }
+    }
+
+    // 停止 accept：只关闭自己的描述符，交接后监听套接字仍由新进程使用
+    lock_guard<mutex> lock(_listenMtx);
+    for (size_t i = 0; i < _listenFds.size(); i++) close(_listenFds[i]);
+    _listenFds.clear();
+}
+
+// 登记新连接
+std::shared_ptr<ClientNode> TcpServer::registerClient(int clientSock, const sockaddr_in& clientAddr, EventLoop* loop) {
+    // 分配 ID 并记录
+    int newId = _idCounter++; // ID 自增
+
+    std::shared_ptr<ClientNode> node = std::make_shared<ClientNode>();
+    node->socket = clientSock;
+    node->addr = clientAddr;
+    node->id = newId;
+    node->loop = loop;
+    node->nonBlocking = (loop != nullptr);
+    applySocketOptions(clientSock);
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &clientAddr.sin_addr, ip, sizeof(ip));
+    char info[64];
+    snprintf(info, sizeof(info), "[ID:%d %s:%d]", newId, ip, ntohs(clientAddr.sin_port));
+    node->info = info;
+    if (_timeouts) {
+        uint64_t now = timerNowMs();
+        node->lastRecvMs = now;
+        node->lastRequestMs = now;
+        // 线程模式下 registerClient 和 runTimers 都在 accept 线程上，epoll 模式都在所属 Reactor 上
+        (loop ? loop->timers : _threadTimers).add(newId, firstTimeout(now));
+    }
+    if (loop && !loop->ring && _cfg.zeroCopyThreshold > 0) {
+        // 大消息用 MSG_ZEROCOPY 发送，内核不支持时退回普通发送
+        int one = 1;
+        node->zeroCopy = (setsockopt(clientSock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+    }
+
+    _clients.insert(newId, node);
+    Metrics::local().addAccepted();
+
+    LOG_INFO(LOG_CAT_CONN, "[Server] New Client connected. ID: %d IP: %s", newId, ip);
+
+    publishRosterChange(*node, _roster.add(newId, node->info), true);
+
+    if (loop && loop->ring) {
+        armRecv(*node);
+    } else if (loop) {
+        // 边缘触发：读写事件都只在状态变化时通知一次，必须读/写到 EAGAIN
+        // data 里存 ID 而不是指针，Reactor 收到事件后再到 _clients 里查，连接已移除就忽略
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = (uint64_t)newId;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, clientSock, &ev) < 0) {
+            LOG_ERROR(LOG_CAT_CONN, "[Server] epoll_ctl add failed: %s", strerror(errno));
+            closeClient(node);
+            return std::shared_ptr<ClientNode>();
+        }
+    }
+    return node;
+}
+
+// 启动子线程处理这批客户端
+// 【注意】使用 std::thread 替代 pthread，这是 C++11 特性，也是加分项
+// 不再 detach：登记下来，关闭时等它处理完手上的请求再 join
+void TcpServer::startWorkers(const std::vector<std::shared_ptr<ClientNode> >& nodes) {
+    if (nodes.empty()) return;
+    reapWorkers();
+    lock_guard<mutex> lock(_workerMtx);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        int id = nodes[i]->id; // 登记用连接最初的 ID，恢复会话换了 ID 也按它 join
+        _workers[id] = std::thread(&TcpServer::workerThread, this, nodes[i]);
+    }
+}
+
+bool TcpServer::acceptBatch(int listenFd, int& spareFd, int flags, size_t max, std::vector<AcceptedConn>& out) {
+    ThreadMetrics& metrics = Metrics::local();
+    uint64_t now = _connLimiter.enabled() ? timerNowMs() : 0;
+    size_t rejected = 0;
+    while (out.size() < max) {
+        AcceptedConn conn;
+        socklen_t len = sizeof(conn.addr);
+        conn.fd = accept4(listenFd, (struct sockaddr*)&conn.addr, &len, flags);
+        if (conn.fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if ((errno == EMFILE || errno == ENFILE) && spareFd >= 0) {
+                shedConnection(listenFd, spareFd);
+                return true;
+            }
+            // EAGAIN：取完了，或者被交接中的另一个进程取走了
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR(LOG_CAT_SERVER, "[Server] Accept failed: %s", strerror(errno));
+            }
+            break;
+        }
+        if (_connLimiter.enabled() && !_connLimiter.allow(conn.addr.sin_addr.s_addr, now)) {
+            close(conn.fd); // 对方立即收到 FIN，不占用连接和线程
+            metrics.addRejected();
+            rejected++;
+            continue;
+        }
+        out.push_back(conn);
+    }
+    if (rejected > 0) {
+        LOG_DEBUG(LOG_CAT_CONN, "[Server] Rejected %zu connection(s) over the per-IP rate limit", rejected);
+    }
+    return out.size() < max;
+}
+
+// 腾出预留的 fd，把排在最前面的连接接下来立即关闭，对方收到 FIN 而不是一直等待
+void TcpServer::shedConnection(int listenFd, int& spareFd) {
+    if (spareFd >= 0) close(spareFd);
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd >= 0) close(fd);
+    spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    static std::atomic<uint64_t> lastWarnMs(0); // 风暴中每秒最多提醒一次，具体数量看统计
+    uint64_t nowMs = timerNowMs();
+    if (nowMs - lastWarnMs.load(std::memory_order_relaxed) >= 1000) {
+        lastWarnMs.store(nowMs, std::memory_order_relaxed);
+        LOG_WARN(LOG_CAT_CONN, "[Server] Out of file descriptors, shedding new connections");
+    }
+    Metrics::local().addRejected();
+}
+
+// 工作线程：接收数据并解析
+// 在 server/TcpServer.cpp 中替换 workerThread 函数
+
+void TcpServer::workerThread(std::shared_ptr<ClientNode> client) {
+    BufferPool::disableThreadCache(); // 工作线程和连接一样多，不各自缓存空闲块
+    const int workerId = client->id;
+    while (true) {
+        // 阻塞接收，直接收进连接的持久化缓冲区（用于处理粘包）
+        ssize_t bytesRead = client->inBuf.readFd(client->socket, _cfg.recvChunk);
+
+        // 客户端断开或出错
+        if (bytesRead <= 0) {
+            closeClient(client);
+            break;
+        }
+        Metrics::local().addBytesIn(bytesRead);
+
+        // 循环处理缓冲区中所有完整的包
+        if (!processBuffer(*client)) {
+            closeClient(client);
+            break;
+        }
+        // 大包把缓冲区撑大过：处理完就还回去，阻塞等待下一个请求时只占一个 recv 块
+        if (client->inBuf.capacity() > BufferPool::roundUp(_cfg.recvChunk)) client->inBuf.release();
+    }
+
+    // 登记为已退出，由 reapWorkers 或 drainWorkers join
+    lock_guard<mutex> lock(_workerMtx);
+    _finishedWorkers.push_back(workerId);
+    _workerCv.notify_all();
+}
+
+// 创建各个 Reactor
+void TcpServer::initLoops(const std::vector<int>& inherited) {
+    int n = _cfg.loopThreads > 0 ? _cfg.loopThreads : 1;
+    if (!inherited.empty() && (int)inherited.size() != n) {
+        // 每个监听套接字都有自己的 accept 队列，必须都有 Reactor 在 accept
+        LOG_WARN(LOG_CAT_SERVER, "[Server] Inherited %zu listening socket(s), using %zu reactor(s) instead of %d",
+                 inherited.size(), inherited.size(), n);
+        n = (int)inherited.size();
+    }
+    if (_cfg.ioUring) {
+        // 先试一次：内核太老或被 seccomp/sysctl 禁用时整体退回 epoll，不用等每个 Reactor 各自失败
+        std::string why;
+        if (!IoUring::supported(why)) {
+            LOG_WARN(LOG_CAT_SERVER, "[Server] io_uring unavailable (%s), using epoll", why.c_str());
+            _cfg.ioUring = false;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        std::unique_ptr<EventLoop> loop(new EventLoop());
+        loop->index = i;
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (loop->epfd < 0 || loop->wakeFd < 0) {
+            perror("epoll_create1/eventfd failed");
+            exit(1);
+        }
+
+        // 每个 Reactor 一个监听套接字，非阻塞，水平触发
+        loop->listenFd = inherited.empty() ? createListenSocket(true) : inherited[i];
+        setNonBlocking(loop->listenFd);
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = TAG_LISTEN;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listenFd, &ev);
+
+        ev.events = EPOLLIN;
+        ev.data.u64 = TAG_WAKE;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakeFd, &ev);
+
+        _loops.push_back(std::move(loop));
+    }
+}
+
+// Reactor 主循环
+void TcpServer::loopThread(EventLoop* loop) {
+    if (_cfg.pinCpu) {
+        // 绑定 CPU，连接的数据结构始终留在同一个核的缓存里
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(loop->index % (ncpu > 0 ? ncpu : 1), &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            LOG_WARN(LOG_CAT_SERVER, "[Server] Failed to pin reactor %d to a CPU", loop->index);
+        }
+    }
+    if (_cfg.ioUring && uringLoop(loop)) return;
+
+    epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        // stop() 之后：停止 accept 和处理请求，只写出发送队列，排空后退出
+        if (!_running && !loop->draining) beginDrain(loop);
+        if (loop->draining && drained(loop)) break;
+
+        // 带超时，便于检查 _running、排空的截止时间和推进时间轮
+        int timeout = loop->draining ? 20 : (_timeouts ? (int)loop->timers.tickMs() : 500);
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            LOG_ERROR(LOG_CAT_SERVER, "[Server] epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == TAG_LISTEN) {
+                if (!loop->draining) acceptOnLoop(loop);
+                continue;
+            }
+            if (tag == TAG_WAKE) {
+                drainInbox(loop);
+                continue;
+            }
+
+            std::shared_ptr<ClientNode> client = findClient((int)tag);
+            if (!client) continue; // 已经断开
+
+            uint32_t ev = events[i].events;
+            if ((ev & EPOLLERR) && client->zeroCopy) {
+                // 零拷贝完成通知通过错误队列送达
+                lock_guard<mutex> lock(client->outMtx);
+                client->out.reapZeroCopy(client->socket);
+            }
+            // 先读：对端关闭 (RDHUP/HUP) 时缓冲区里可能还有最后几个包
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                if (loop->draining) {
+                    discardInput(*client);
+                } else {
+                    handleReadable(client);
+                }
+            }
+            if (ev & EPOLLOUT) {
+                flushOut(*client);
+            }
+        }
+
+        // 排空时不再发心跳，由排空流程负责断开
+        if (_timeouts && !loop->draining) runTimers(loop->timers);
+
+        // 本轮产生的所有应答/转发（包括心跳），每个连接合并成一次 sendmsg
+        flushDirty(loop);
+    }
+
+    for (size_t i = 0; i < loop->drainList.size(); i++) {
+        closeOnShutdown(loop->drainList[i]);
+    }
+    loop->drainList.clear();
+}
+
+// 接受新连接，连接归属于接受它的 Reactor
+// 一次最多取 acceptBatch 个（accept4 直接得到非阻塞套接字），剩下的连接监听套接字是水平触发，
+// 处理完本轮其他事件后 epoll_wait 会立即再报告，连接风暴不会饿死已有连接的读写
+void TcpServer::acceptOnLoop(EventLoop* loop) {
+    static thread_local std::vector<AcceptedConn> batch;
+    batch.clear();
+    acceptBatch(loop->listenFd, loop->spareFd, SOCK_NONBLOCK | SOCK_CLOEXEC, _cfg.acceptBatch, batch);
+    for (size_t i = 0; i < batch.size(); i++) {
+        registerClient(batch[i].fd, batch[i].addr, loop);
+    }
+}
+
+// 执行其他 Reactor 投递过来的发送任务
+void TcpServer::drainInbox(EventLoop* loop) {
+    uint64_t cnt;
+    while (read(loop->wakeFd, &cnt, sizeof(cnt)) > 0) {}
+
+    LoopTask task;
+    while (loop->inbox.pop(task)) {
+        if (task.kind == TASK_FANOUT) {
+            size_t len = task.shared->size();
+            for (size_t i = 0; i < task.targets.size(); i++) {
+                std::shared_ptr<ClientNode> target = findClient(task.targets[i]);
+                if (!target) continue;
+                sendRaw(*target, task.shared->view(), task.shared);
+                target->inflight.fetch_sub(len, std::memory_order_relaxed);
+            }
+            continue;
+        }
+
+        std::shared_ptr<ClientNode> target = findClient(task.targetId);
+        if (!target) continue;
+        if (task.kind == TASK_RESUME) {
+            resumeClient(target);
+        } else {
+            sendRaw(*target, task.packet.view());
+            target->inflight.fetch_sub(task.packet.size(), std::memory_order_relaxed);
+        }
+    }
+}
+
+// 投递给目标 Reactor：入队后写 eventfd 唤醒它
+void TcpServer::postToLoop(EventLoop* loop, LoopTask&& task) {
+    loop->inbox.push(std::move(task));
+
+    uint64_t one = 1;
+    ssize_t ret = write(loop->wakeFd, &one, sizeof(one));
+    (void)ret; // 计数器溢出时返回 EAGAIN，但此时对方必然已被唤醒
+}
+
+// 读事件：ET 模式下必须一直读到 EAGAIN，否则剩余数据不会再通知
+void TcpServer::handleReadable(const std::shared_ptr<ClientNode>& client) {
+    while (true) {
+        if (client->killed) {
+            closeClient(client); // 已按慢消费者策略 shutdown
+            return;
+        }
+        if (client->paused) return; // 背压：先不读，resumeClient 时再读到 EAGAIN
+        ssize_t bytesRead = client->inBuf.readFd(client->socket, _cfg.recvChunk);
+        if (bytesRead > 0) {
+            Metrics::local().addBytesIn(bytesRead);
+            if (!processBuffer(*client)) {
+                closeClient(client); // 协议错误，无法再同步帧边界
+                return;
+            }
+            continue;
+        }
+        if (bytesRead < 0 && errno == EINTR) continue;
+        if (bytesRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            client->inBuf.release(); // 本轮数据读完；没有半包时缓冲区还给内存池，空闲连接不占内存
+            return;
+        }
+        // 0 表示对端关闭，其余为错误
+        closeClient(client);
+        return;
+    }
+}
+
+// 写事件：发送缓冲区腾出空间后把积压的数据写出
+void TcpServer::flushOut(ClientNode& client) {
+    std::vector<int> wake;
+    {
+        std::unique_lock<mutex> lock(client.outMtx, std::defer_lock);
+        lockMeasured(lock);
+        if (client.closed) return;
+
+        bool ok = true;
+        if (client.loop && client.loop->ring) {
+            // io_uring：同时只有一个 sendmsg，完成时（onUringSend）再回到这里发剩下的
+            if (!client.killed) submitSend(client);
+        } else {
+            bool blocked; // EAGAIN：剩下的等下一次 EPOLLOUT
+            size_t zc = client.zeroCopy ? _cfg.zeroCopyThreshold : 0;
+            size_t before = client.out.bytes();
+            ok = client.out.flush(client.socket, zc, blocked);
+            Metrics::local().addBytesOut(before - client.out.bytes());
+        }
+        if (!ok) {
+            // 写出错：丢弃队列，shutdown 让读端收到事件后走正常的关闭流程
+            client.out.clear();
+            if (!client.killed) {
+                client.killed = true;
+                shutdown(client.socket, SHUT_RDWR);
+            }
+        }
+        if (!client.waiters.empty() && client.queuedBytes() <= _cfg.outLowWater) {
+            wake.swap(client.waiters);
+        }
+    }
+    wakeWaiters(wake);
+
+    // 离线消息因为队列太长停下了：降到低水位以下接着发
+    if (client.offlinePending && !client.closed && client.out.bytes() <= _cfg.outLowWater) deliverOffline(client);
+}
+
+// 统一 flush 本轮有新数据的连接
+void TcpServer::flushDirty(EventLoop* loop) {
+    for (size_t i = 0; i < loop->dirty.size(); i++) {
+        ClientNode& client = *loop->dirty[i];
+        client.flushQueued = false;
+        flushOut(client);
+    }
+    loop->dirty.clear(); // 保留容量
+}
+
+// 背压：target 的队列超过高水位，暂停读取 sender
+// 在 target.outMtx 下登记，与 flushOut 的检查互斥，不会错过唤醒
+void TcpServer::pauseSender(ClientNode& sender, ClientNode& target) {
+    if (sender.paused) return;
+    lock_guard<mutex> lock(target.outMtx);
+    if (target.closed || target.queuedBytes() < _cfg.outHighWater) return;
+    sender.paused = true;
+    target.waiters.push_back(sender.id);
+}
+
+// 恢复读取：先处理缓冲区里剩下的包，再读到 EAGAIN
+void TcpServer::resumeClient(const std::shared_ptr<ClientNode>& client) {
+    if (!client->paused || client->loop->draining) return; // 排空期间不再处理请求
+    client->paused = false;
+    if (!processBuffer(*client)) {
+        closeClient(client);
+        return;
+    }
+    if (client->loop->ring) {
+        // recv 的取消还没完成时由它的最后一个完成事件重新挂上
+        if (!client->recvArmed) armRecv(*client);
+        return;
+    }
+    handleReadable(client);
+}
+
+// 唤醒等待者：恢复操作投递到各自所属的 Reactor 上执行
+void TcpServer::wakeWaiters(std::vector<int>& waiters) {
+    for (size_t i = 0; i < waiters.size(); i++) {
+        std::shared_ptr<ClientNode> waiter = findClient(waiters[i]);
+        if (!waiter || !waiter->loop) continue;
+        LoopTask task;
+        task.kind = TASK_RESUME;
+        task.targetId = waiters[i];
+        postToLoop(waiter->loop, std::move(task));
+    }
+}
+
+// io_uring 主循环：结构和 loopThread 相同，每轮只有一次 io_uring_enter，
+// 同时提交上一轮准备好的请求（新挂的 recv、flushDirty 产生的 sendmsg）并等待完成事件
+bool TcpServer::uringLoop(EventLoop* loop) {
+    std::string err;
+    std::unique_ptr<IoUring> ring(new IoUring());
+    if (!ring->init(URING_ENTRIES, err) || !ring->setupBuffers(URING_BUF_GROUP, URING_BUFS, _cfg.recvChunk, err)) {
+        LOG_WARN(LOG_CAT_SERVER, "[Server] Reactor %d: %s, falling back to epoll", loop->index, err.c_str());
+        return false;
+    }
+    loop->ring = std::move(ring);
+    IoUring& uring = *loop->ring;
+
+    // 监听套接字和连接都不设非阻塞：io_uring 在没有数据时自己挂等待，不会返回 EAGAIN
+    uring.prepAcceptMultishot(loop->listenFd, SOCK_CLOEXEC, TAG_LISTEN);
+    uring.prepPollMultishot(loop->wakeFd, POLLIN, TAG_WAKE);
+
+    while (true) {
+        if (!_running && !loop->draining) beginDrain(loop);
+        if (loop->draining && drained(loop)) break;
+
+        int timeout = loop->draining ? 20 : (_timeouts ? (int)loop->timers.tickMs() : 500);
+        int ret = uring.submitAndWait(1, timeout);
+        if (ret < 0 && ret != -ETIME && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            LOG_ERROR(LOG_CAT_SERVER, "[Server] io_uring_enter failed: %s", strerror(-ret));
+            break;
+        }
+        uring.forEachCqe([this, loop](const struct io_uring_cqe& cqe) { handleCompletion(loop, cqe); });
+
+        if (_timeouts && !loop->draining) runTimers(loop->timers);
+        flushDirty(loop);
+    }
+
+    // 取消所有请求（正常排空后只剩挂着的 recv），等内核确认完，之后才能关闭连接、释放缓冲区
+    loop->closing = true;
+    uring.prepCancelAll(0);
+    uint64_t deadline = metricsNowNs() + 1000000000ULL;
+    while (uring.inflight() > 0 && metricsNowNs() < deadline) {
+        uring.submitAndWait(1, 20);
+        uring.forEachCqe([this, loop](const struct io_uring_cqe& cqe) { handleCompletion(loop, cqe); });
+    }
+
+    for (size_t i = 0; i < loop->drainList.size(); i++) {
+        closeOnShutdown(loop->drainList[i]);
+    }
+    loop->drainList.clear();
+    loop->ring.reset();
+    return true;
+}
+
+// 分发完成事件：请求的最后一个完成事件到达后放开对节点的持有
+void TcpServer::handleCompletion(EventLoop* loop, const struct io_uring_cqe& cqe) {
+    uint64_t tag = cqe.user_data;
+    if (tag == 0) return; // 取消请求自己的结果
+    if (tag == TAG_LISTEN) {
+        onUringAccept(loop, cqe);
+        return;
+    }
+    if (tag == TAG_WAKE) {
+        drainInbox(loop);
+        if (!(cqe.flags & IORING_CQE_F_MORE) && !loop->closing) {
+            loop->ring->prepPollMultishot(loop->wakeFd, POLLIN, TAG_WAKE);
+        }
+        return;
+    }
+
+    ClientNode* node = (ClientNode*)(uintptr_t)(tag & ~URING_OP_MASK);
+    std::shared_ptr<ClientNode> client = node->uringSelf; // 处理期间连接被关闭也不会释放
+    if ((tag & URING_OP_MASK) == URING_OP_RECV) {
+        onUringRecv(client, cqe);
+    } else {
+        onUringSend(client, cqe.res);
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE) && --client->uringOps == 0) client->uringSelf.reset();
+}
+
+// 多次接收的 accept 每接下一个连接产生一个完成事件，拿不到对端地址，按速率限制需要时再 getpeername
+void TcpServer::onUringAccept(EventLoop* loop, const struct io_uring_cqe& cqe) {
+    int fd = cqe.res;
+    if (fd >= 0) {
+        if (loop->draining) {
+            close(fd); // 取消 accept 之前刚接下的连接，对方会重连到新进程
+        } else {
+            sockaddr_in addr;
+            socklen_t len = sizeof(addr);
+            if (getpeername(fd, (struct sockaddr*)&addr, &len) < 0) memset(&addr, 0, sizeof(addr));
+            if (_connLimiter.enabled() && !_connLimiter.allow(addr.sin_addr.s_addr, timerNowMs())) {
+                close(fd);
+                Metrics::local().addRejected();
+            } else {
+                registerClient(fd, addr, loop);
+            }
+        }
+    } else if ((fd == -EMFILE || fd == -ENFILE) && loop->listenFd >= 0) {
+        shedConnection(loop->listenFd, loop->spareFd);
+    } else if (fd != -ECANCELED && fd != -EINTR && fd != -EAGAIN && fd != -ECONNABORTED) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Accept failed: %s", strerror(-fd));
+    }
+
+    // 出错时内核结束这个多次接收的 accept，重新挂上（排空时已经取消，不再挂）
+    if (!(cqe.flags & IORING_CQE_F_MORE) && !loop->draining && !loop->closing) {
+        loop->ring->prepAcceptMultishot(loop->listenFd, SOCK_CLOEXEC, TAG_LISTEN);
+    }
+}
+
+void TcpServer::onUringRecv(const std::shared_ptr<ClientNode>& client, const struct io_uring_cqe& cqe) {
+    EventLoop* loop = client->loop;
+    bool last = !(cqe.flags & IORING_CQE_F_MORE);
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        // 排空期间不再处理请求，数据直接丢弃
+        if (cqe.res > 0 && !client->closed && !loop->draining) {
+            client->inBuf.append(loop->ring->buffer(bid), (size_t)cqe.res);
+        }
+        loop->ring->recycleBuffer(bid);
+    }
+    if (last) {
+        client->recvArmed = false;
+        client->recvStopping = false;
+    }
+    if (client->closed || loop->closing) return;
+    if (client->killed) {
+        closeClient(client); // 已按慢消费者策略 shutdown
+        return;
+    }
+
+    if (cqe.res > 0 && !loop->draining) {
+        Metrics::local().addBytesIn(cqe.res);
+        if (!client->paused && !processBuffer(*client)) {
+            closeClient(client); // 协议错误，无法再同步帧边界
+            return;
+        }
+        if (client->paused) {
+            // 背压：取消 recv，之后到的数据留在内核的接收缓冲区里，resumeClient 时再挂上
+            if (client->recvArmed && !client->recvStopping) {
+                client->recvStopping = true;
+                loop->ring->prepCancel((uint64_t)(uintptr_t)client.get() | URING_OP_RECV, 0);
+            }
+        } else if (client->inBuf.readable() == 0) {
+            client->inBuf.release(); // 没有半包：缓冲区还给内存池，空闲连接不占内存
+        }
+    }
+    if (!last) return;
+
+    // 0 表示对端关闭；ENOBUFS 是缓冲区环暂时用完，ECANCELED 是背压取消的
+    if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+        if (!loop->draining) closeClient(client);
+        return;
+    }
+    if (!client->paused) armRecv(*client);
+}
+
+void TcpServer::onUringSend(const std::shared_ptr<ClientNode>& client, int res) {
+    {
+        std::unique_lock<mutex> lock(client->outMtx, std::defer_lock);
+        lockMeasured(lock);
+        size_t n = res > 0 ? (size_t)res : 0;
+        client->out.completeSend(n);
+        Metrics::local().addBytesOut(n);
+        if (res < 0 && res != -EAGAIN && res != -EINTR && !client->closed && !client->killed) {
+            // 写出错：丢弃队列，shutdown 让 recv 收到 0 后走正常的关闭流程
+            client->killed = true;
+            shutdown(client->socket, SHUT_RDWR);
+        }
+        if (client->closed || client->killed) client->out.clear();
+    }
+    // 剩下的接着发，并处理水位唤醒和离线消息
+    if (!client->loop->closing) flushOut(*client);
+}
+
+void TcpServer::armRecv(ClientNode& client) {
+    if (client.recvArmed || client.closed || client.loop->closing) return;
+    client.recvArmed = true;
+    uringHold(client);
+    client.loop->ring->prepRecvMultishot(client.socket, URING_BUF_GROUP, (uint64_t)(uintptr_t)&client | URING_OP_RECV);
+}
+
+void TcpServer::submitSend(ClientNode& client) {
+    if (client.out.sending() || client.loop->closing) return;
+    const struct msghdr* msg = client.out.prepareSend();
+    if (!msg) return;
+    uringHold(client);
+    client.loop->ring->prepSendmsg(client.socket, msg, MSG_NOSIGNAL, (uint64_t)(uintptr_t)&client | URING_OP_SEND);
+}
+
+void TcpServer::uringHold(ClientNode& client) {
+    if (client.uringOps++ == 0) client.uringSelf = client.shared_from_this();
+}
+
+// 推进时间轮：每个连接只挂一个定时器，收到数据时不碰时间轮，到期时才看是否真的超时
+void TcpServer::runTimers(TimerWheel& timers) {
+    static thread_local std::vector<int> expired;
+    uint64_t now = timerNowMs();
+    timers.advance(now, expired);
+    for (size_t i = 0; i < expired.size(); i++) {
+        int id = expired[i];
+        std::shared_ptr<ClientNode> client = findClient(id);
+        if (!client) {
+            // 恢复会话换了 ID：定时器改挂到新 ID 上；否则已经断开，定时器随之作废
+            lock_guard<mutex> lock(_renamedMtx);
+            std::unordered_map<int, int>::iterator it = _renamed.find(id);
+            if (it == _renamed.end()) continue;
+            id = it->second;
+            _renamed.erase(it);
+            client = findClient(id);
+            if (!client) continue;
+        }
+        uint64_t next = checkTimeouts(client, now);
+        if (next > 0) timers.add(id, next);
+    }
+    expired.clear();
+}
+
+uint64_t TcpServer::firstTimeout(uint64_t now) const {
+    uint64_t next = UINT64_MAX;
+    if (_cfg.heartbeatMs > 0) next = std::min(next, now + _cfg.heartbeatMs);
+    if (_cfg.idleTimeoutMs > 0) next = std::min(next, now + _cfg.idleTimeoutMs);
+    if (_cfg.readTimeoutMs > 0) next = std::min(next, now + _cfg.readTimeoutMs);
+    return next;
+}
+
+uint64_t TcpServer::checkTimeouts(const std::shared_ptr<ClientNode>& client, uint64_t now) {
+    // 被背压暂停的连接是在等别人，它自己的数据还在内核里没读，不算静默
+    if (client->paused) return firstTimeout(now);
+
+    uint64_t next = UINT64_MAX;
+    const char* reason = NULL;
+    uint64_t lastRecv = client->lastRecvMs.load(std::memory_order_relaxed);
+
+    if (_cfg.readTimeoutMs > 0) {
+        // 没有半包时隔一个周期再看，半包最晚在两个周期后被发现
+        uint64_t since = client->partialSinceMs.load(std::memory_order_relaxed);
+        uint64_t deadline = (since > 0 ? since : now) + _cfg.readTimeoutMs;
+        if (since > 0 && now >= deadline) reason = "read timeout";
+        next = std::min(next, deadline);
+    }
+    if (_cfg.idleTimeoutMs > 0) {
+        uint64_t deadline = client->lastRequestMs.load(std::memory_order_relaxed) + _cfg.idleTimeoutMs;
+        if (now >= deadline) reason = "idle timeout";
+        next = std::min(next, deadline);
+    }
+    if (_cfg.heartbeatMs > 0) {
+        if (client->pingSentMs > 0 && lastRecv < client->pingSentMs) {
+            // 心跳发出后一直没有收到任何数据
+            uint64_t deadline = client->pingSentMs + _cfg.heartbeatMs;
+            if (now >= deadline) reason = "heartbeat timeout";
+            next = std::min(next, deadline);
+        } else if (now >= lastRecv + _cfg.heartbeatMs) {
+            sendPing(*client);
+            client->pingSentMs = now;
+            next = std::min(next, now + _cfg.heartbeatMs);
+        } else {
+            client->pingSentMs = 0;
+            next = std::min(next, lastRecv + _cfg.heartbeatMs);
+        }
+    }
+
+    if (reason == NULL) return next;
+
+    LOG_INFO(LOG_CAT_CONN, "[Server] Client %d closed: %s.", client->id.load(), reason);
+    if (client->nonBlocking) {
+        closeClient(client); // 就在所属 Reactor 上
+    } else {
+        shutdown(client->socket, SHUT_RDWR); // 工作线程的 recv 返回 0 后走正常的关闭流程
+    }
+    return 0;
+}
+
+void TcpServer::sendPing(ClientNode& client) {
+    if (client.nonBlocking) {
+        sendMsg(client, 0, 'H', HEARTBEAT_PING); // 进发送队列，本轮结束时 flush
+        return;
+    }
+
+    // 线程模式：在 accept 线程上发，不能阻塞。锁被占着说明有线程正在向它写，这次就不发了，
+    // 对方若一直不读也不发，心跳照样超时
+    std::unique_lock<mutex> lock(client.outMtx, std::try_to_lock);
+    if (!lock.owns_lock() || client.closed) return;
+    std::string& packet = scratchBuffer();
+    NetMsg::encodeTo(packet, 'H', 0, HEARTBEAT_PING, client.binary);
+    ssize_t n = send(client.socket, packet.data(), packet.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n > 0 && (size_t)n < packet.size()) {
+        // 只写进去半个帧，后面的数据都会错位
+        shutdown(client.socket, SHUT_RDWR);
+    }
+}
+
+// 开始排空：本 Reactor 不再 accept，也不再处理请求
+void TcpServer::beginDrain(EventLoop* loop) {
+    loop->draining = true;
+    if (loop->ring) {
+        // 先取消 accept 并立即提交：它持有监听套接字，不取消的话关闭描述符后仍会接下新连接
+        loop->ring->prepCancel(TAG_LISTEN, 0);
+        loop->ring->submit();
+    }
+    {
+        lock_guard<mutex> lock(_listenMtx);
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, loop->listenFd, nullptr);
+        close(loop->listenFd); // 只关闭自己的描述符，交接后新进程仍在使用这个监听套接字
+        loop->listenFd = -1;
+    }
+
+    std::vector<std::shared_ptr<ClientNode> > snapshot;
+    _clients.snapshot(snapshot);
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        if (snapshot[i]->loop == loop) loop->drainList.push_back(std::move(snapshot[i]));
+    }
+    // 最后一个停止处理请求的 Reactor 关闭存储，热重启的新进程等着打开它
+    if (++_quiesced == _loops.size()) _store.close();
+}
+
+// 所有 Reactor 都停止处理请求后不会再有新的转发任务，此时 inbox 和发送队列都空了才算排空
+bool TcpServer::drained(EventLoop* loop) {
+    size_t pending = 0;
+    size_t pendingBytes = 0;
+    for (size_t i = 0; i < loop->drainList.size(); i++) {
+        ClientNode& client = *loop->drainList[i];
+        size_t queued = client.queuedBytes();
+        if (client.closed || client.killed || queued == 0) continue;
+        pending++;
+        pendingBytes += queued;
+    }
+
+    if (metricsNowNs() >= _drainDeadline.load()) {
+        if (pending > 0) {
+            LOG_WARN(LOG_CAT_SERVER, "[Server] Reactor %d: drain deadline reached, dropping %zu bytes for %zu client(s)",
+                     loop->index, pendingBytes, pending);
+        }
+        return true;
+    }
+    return pending == 0 && _quiesced.load() == _loops.size() && loop->inbox.empty();
+}
+
+// 读到 EAGAIN 为止，数据直接丢弃
+void TcpServer::discardInput(ClientNode& client) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = recv(client.socket, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) continue;
+        if (n < 0 && errno == EINTR) continue;
+        return;
+    }
+}
+
+// 关闭时断开：先 shutdown 写端，让已经交给内核的数据后面跟着 FIN 发完
+void TcpServer::closeOnShutdown(const std::shared_ptr<ClientNode>& client) {
+    _clients.remove(client->id, client);
+    if (client->loop && !client->loop->ring) {
+        epoll_ctl(client->loop->epfd, EPOLL_CTL_DEL, client->socket, nullptr);
     }
-}
 
-TcpServer::~TcpServer() {
-    close(_listenSock);
+    lock_guard<mutex> lock(client->outMtx);
+    if (client->closed) return;
+    client->closed = true;
+    client->out.clear();
+    shutdown(client->socket, SHUT_WR);
+    discardInput(*client); // 接收缓冲区里有未读数据时 close 会直接发 RST
+    close(client->socket);
 }
 
-// 主循环：只负责 Accept 新连接
-void TcpServer::start() {
-    _running = true;
-    cout << "[Server] Listening on port " << SERVER_PORT << "..." << endl;
+// 线程模式：关闭读端，工作线程的 recv 返回 0 后走正常的关闭流程；正在进行的转发会先写完
+// 不拿 outMtx：向慢接收方发送的线程一直持有它。snapshot 持有节点，描述符不会被关闭或复用
+void TcpServer::drainWorkers() {
+    std::vector<std::shared_ptr<ClientNode> > snapshot;
+    _clients.snapshot(snapshot);
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        shutdown(snapshot[i]->socket, SHUT_RD);
+    }
 
-    while (_running) {
-        sockaddr_in clientAddr;
-        socklen_t len = sizeof(clientAddr);
-        
-        // 阻塞等待连接
-        int clientSock = accept(_listenSock, (struct sockaddr*)&clientAddr, &len);
-        if (clientSock < 0) {
-            perror("Accept failed");
-            continue;
+    std::unordered_map<int, std::thread> workers;
+    {
+        std::unique_lock<mutex> lock(_workerMtx);
+        while (_finishedWorkers.size() < _workers.size() && metricsNowNs() < _drainDeadline.load()) {
+            _workerCv.wait_for(lock, std::chrono::milliseconds(20));
         }
-
-        // 分配 ID 并记录
-        int newId = _idCounter++; // ID 自增
-        
-        // 加锁操作 Map
-        {
-            lock_guard<mutex> lock(_mtx);
-            ClientNode node;
-            node.socket = clientSock;
-            node.addr = clientAddr;
-            node.id = newId;
-            _clients[newId] = node;
+        if (_finishedWorkers.size() < _workers.size()) {
+            // 到了截止时间还有线程阻塞在向慢接收方发送：强制断开
+            LOG_WARN(LOG_CAT_SERVER, "[Server] Drain deadline reached, closing %zu busy connection(s)",
+                     _workers.size() - _finishedWorkers.size());
+            for (size_t i = 0; i < snapshot.size(); i++) {
+                shutdown(snapshot[i]->socket, SHUT_RDWR);
+            }
         }
+        workers.swap(_workers);
+        _finishedWorkers.clear();
+    }
+    for (std::unordered_map<int, std::thread>::iterator it = workers.begin(); it != workers.end(); ++it) {
+        it->second.join();
+    }
+}
 
-        cout << "[Server] New Client connected. ID: " << newId 
-             << " IP: " << inet_ntoa(clientAddr.sin_addr) << endl;
-
-        // 启动子线程处理该客户端
-        // 【注意】使用 std::thread 替代 pthread，这是 C++11 特性，也是加分项
-        std::thread t(&TcpServer::workerThread, this, clientSock, clientAddr, newId);
-        t.detach(); // 分离线程，让它独立运行
+// join 已经退出的工作线程（它们已经走出了登记的临界区，join 不会等待）
+void TcpServer::reapWorkers() {
+    lock_guard<mutex> lock(_workerMtx);
+    for (size_t i = 0; i < _finishedWorkers.size(); i++) {
+        std::unordered_map<int, std::thread>::iterator it = _workers.find(_finishedWorkers[i]);
+        if (it == _workers.end()) continue;
+        it->second.join();
+        _workers.erase(it);
     }
+    _finishedWorkers.clear();
 }
 
-// 工作线程：接收数据并解析
-// 在 server/TcpServer.cpp 中替换 workerThread 函数
 
-void TcpServer::workerThread(int clientSock, sockaddr_in addr, int clientId) {
-    char buffer[BUF_SIZE];
-    std::string msgBuffer = ""; // 持久化缓冲区，用于处理粘包
+// 从列表移除并关闭连接（两种模式共用）
+void TcpServer::closeClient(const std::shared_ptr<ClientNode>& client) {
+    // 会话先标记离线再移除：发送方查不到它时，存储里一定已经是离线状态，消息会进离线队列
+    if (client->session && findClient(client->id) == client) _store.detach(client->id);
+    if (!_clients.remove(client->id, client)) return; // 已经被关闭过
 
-    while (true) {
-        memset(buffer, 0, BUF_SIZE);
-        // 阻塞接收
-        int bytesRead = recv(clientSock, buffer, BUF_SIZE - 1, 0);
-        
-        // 客户端断开或出错
-        if (bytesRead <= 0) {
-            cout << "[Server] Client " << clientId << " disconnected." << endl;
-            close(clientSock);
-            
-            // 从列表中移除
-            lock_guard<mutex> lock(_mtx);
-            _clients.erase(clientId);
-            break;
-        }
+    // 退订所有主题（topics 只由本连接的线程访问，closeClient 也在这个线程上调用）
+    for (size_t i = 0; i < client->topics.size(); i++) {
+        _topics.leave(client->topics[i], client->id);
+    }
+    client->topics.clear();
 
-        // 将收到的数据追加到缓冲区
-        msgBuffer += buffer;
+    if (client->watching) _roster.unwatch(client->id);
+    publishRosterChange(*client, _roster.remove(client->id), false);
 
-        // 循环处理缓冲区中所有完整的包（以 \n 结尾）
-        size_t pos;
-        while ((pos = msgBuffer.find('\n')) != std::string::npos) {
-            // 提取第一条完整消息（不含 \n）
-            std::string singlePacket = msgBuffer.substr(0, pos);
-            // 从缓冲区移除已处理的部分（含 \n）
-            msgBuffer.erase(0, pos + 1);
+    LOG_INFO(LOG_CAT_CONN, "[Server] Client %d disconnected.", client->id.load());
+
+    if (client->loop && !client->loop->ring) {
+        epoll_ctl(client->loop->epfd, EPOLL_CTL_DEL, client->socket, nullptr);
+    }
+
+    // 持有 outMtx 再关闭，避免其他线程向已被复用的 fd 写数据
+    // 线程模式只 shutdown，描述符由 ~ClientNode 关闭
+    std::vector<int> wake;
+    {
+        lock_guard<mutex> lock(client->outMtx);
+        client->closed = true;
+        client->out.clear();
+        wake.swap(client->waiters);
+        if (client->nonBlocking) {
+            // io_uring 的 recv/sendmsg 持有套接字，只 close 不会结束它们；shutdown 让它们立即完成
+            if (client->loop->ring) shutdown(client->socket, SHUT_RDWR);
+            close(client->socket);
+        } else {
+            shutdown(client->socket, SHUT_RDWR);
+        }
+    }
+    // 等它的发送方不用再等了
+    wakeWaiters(wake);
+}
+
+// 按 ID 查找在线客户端（不加锁）
+std::shared_ptr<ClientNode> TcpServer::findClient(int clientId) {
+    return _clients.find(clientId);
+}
 
-            // 解析并分发
-            NetMsg msg;
-            if (NetMsg::decode(singlePacket, msg)) {
-                dispatchMessage(clientSock, msg, clientId);
+// 循环处理缓冲区中所有完整的包（文本帧以 \n 结尾，二进制帧按长度）
+bool TcpServer::processBuffer(ClientNode& client) {
+    // frame 直接指向 inBuf 内部，切包时不拷贝也不搬移数据
+    // 被背压暂停时停在当前位置，剩下的包留在 inBuf 里等恢复
+    ThreadMetrics& metrics = Metrics::local();
+    bool request = false; // 收到了心跳以外的请求
+    StrView frame;
+    while (!client.paused && client.inBuf.nextFrame(frame)) {
+        // 解析成视图并分发，负载仍指向 inBuf，整个过程不分配内存
+        NetMsgView msg;
+        if (!NetMsg::decodeView(frame, msg)) {
+            // 非法帧跳过
+        } else if (msg.type == MSG_COMPRESSED && client.compress) {
+            // 压缩的一批请求（负载借用 inBuf，解压到单独的缓冲区）
+            // 非法时断开：每个坏帧都要解压一次，不能让对端用它们反复占住 Reactor（也不会每帧打一行日志）
+            if (!dispatchCompressed(client, msg.payload)) {
+                LOG_WARN(LOG_CAT_REQUEST, "[Server] Client %d sent a corrupt compressed frame, disconnecting.",
+                         client.id.load());
+                return false;
             }
+            request = true;
+        } else {
+            uint64_t start = metricsNowNs();
+            dispatchMessage(client, msg);
+            metrics.countMessage(msg.type, metricsNowNs() - start);
+            if (msg.type != 'H') request = true;
+        }
+        // 自己不读应答导致队列过长，也暂停读它的请求
+        if (client.nonBlocking && _cfg.slowPolicy == SLOW_BACKPRESSURE &&
+            client.out.bytes() >= _cfg.outHighWater) {
+            pauseSender(client, client);
+        }
+    }
+
+    if (_timeouts) {
+        // 只记时间戳，不碰时间轮：到期检查时再按这些时间决定是否真的超时
+        uint64_t now = timerNowMs();
+        client.lastRecvMs.store(now, std::memory_order_relaxed);
+        if (request) client.lastRequestMs.store(now, std::memory_order_relaxed);
+        if (client.paused || client.inBuf.readable() == 0) {
+            client.partialSinceMs.store(0, std::memory_order_relaxed);
+        } else if (client.partialSinceMs.load(std::memory_order_relaxed) == 0) {
+            client.partialSinceMs.store(now, std::memory_order_relaxed);
         }
     }
+    return !client.inBuf.bad();
 }
 
 // 消息分发器
-void TcpServer::dispatchMessage(int sock, NetMsg& msg, int clientId) {
-    char type = msg.getType();
-    
+void TcpServer::dispatchMessage(ClientNode& client, const NetMsgView& msg) {
+    char type = msg.type;
+
     switch (type) {
         case 'T': // Time Request
-            handleTimeReq(sock, clientId); // 传入 clientId
+            handleTimeReq(client, msg.corrId);
             break;
         case 'N': // Name Request
-            handleNameReq(sock, clientId); // 传入 clientId
+            handleNameReq(client, msg.corrId);
             break;
         case 'L': // List Request
-            handleListReq(sock, clientId); // 【修改】传入 clientId
+            handleListReq(client, msg.payload, msg.corrId);
+            break;
+        case 'W': // Watch Client List
+            handleWatchReq(client, msg.payload, msg.corrId);
             break;
         case 'S': // Send Message (Forward)
-            handleForwardReq(sock, clientId, msg.getTargetId(), msg.getContent());
+            handleForwardReq(client, msg.targetId, msg.payload, msg.corrId);
+            break;
+        case 'A': // Broadcast
+            handleBroadcastReq(client, msg.payload);
+            break;
+        case 'J': // Join Topic
+            handleJoinReq(client, msg.payload, msg.corrId);
+            break;
+        case 'Q': // Quit Topic
+            handleLeaveReq(client, msg.payload, msg.corrId);
+            break;
+        case 'P': // Publish to Topic
+            handlePublishReq(client, msg.payload, msg.corrId);
+            break;
+        case 'B': // 帧格式协商
+            handleProtoReq(client, msg);
+            break;
+        case 'I': // Session
+            handleSessionReq(client, msg.payload, msg.corrId);
+            break;
+        case 'H': // Heartbeat
+            handleHeartbeat(client, msg.payload, msg.corrId);
             break;
         case 'D': // Disconnect
-            // 实际上 recv 返回 0 会自动处理断开，这里可以是主动退出的命令
+            // 连接本身由随后的 recv 返回 0 断开，这里只结束会话
+            handleQuitReq(client);
             break;
         default:
-            cout << "[Server] Unknown request type: " << type << endl;
+            LOG_WARN(LOG_CAT_REQUEST, "[Server] Unknown request type: %c", type);
             break;
     }
 }
 
-// 1. 处理时间
-void TcpServer::handleTimeReq(int sock, int clientId) {
-    time_t now = time(0);
-    tm* ltm = localtime(&now);
-    char buf[64];
-    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", ltm);
-    
-    // 【新增日志】
-    cout << "[Server] Client " << clientId << " requested Time. Sending: " << buf << endl;
-    
-    sendMsg(sock, 'T', std::string(buf));
+// 解压后的请求在本线程的缓冲区里，分发完之前不能复用，所以不和编码用的 scratchBuffer 共用
+// 被背压暂停时也把这一批分发完，下一个帧才停下
+bool TcpServer::dispatchCompressed(ClientNode& client, StrView payload) {
+    // 声明的长度先和压缩数据的长度对照，再从内存池取缓冲区（不清零），谎报的长度不会先让 Reactor 分配、填充几 MB
+    long rawLen = NetMsg::inflatedSize(payload);
+    if (rawLen < 0) return false;
+    static thread_local PooledBuf frames;
+    frames.clear();
+    frames.resize(rawLen);
+
+    ThreadMetrics& metrics = Metrics::local();
+    bool ok = NetMsg::decompressInto(payload, frames.data(), rawLen) &&
+              NetMsg::forEachFrame(frames.view(), [&](const NetMsgView& msg) {
+                  uint64_t start = metricsNowNs();
+                  dispatchMessage(client, msg);
+                  metrics.countMessage(msg.type, metricsNowNs() - start);
+              });
+    if (frames.capacity() > MAX_RETAINED_INFLATE) frames.release(); // 偶尔的大包不常驻
+    return ok;
 }
 
-// 2. 处理名字
-// 2. 处理名字
-void TcpServer::handleNameReq(int sock, int clientId) {
-    char hostname[128];
-    if (gethostname(hostname, sizeof(hostname)) != 0) {
-        strcpy(hostname, "Server-Unknown");
+// 0. 处理帧格式协商：应答仍用文本帧，之后发给该客户端的消息改用二进制帧
+// 应答的 targetId 带上客户端自己的 ID，客户端不用再发 'L' 查询
+// 客户端同时要求压缩、且服务器没有关闭压缩（compress_min 为 0）时回复 "BIN1,LZ4"，否则只回复 "BIN1"
+void TcpServer::handleProtoReq(ClientNode& client, const NetMsgView& msg) {
+    bool lz4 = msg.payload == StrView(PROTO_BINARY_LZ4_CAP);
+    if (!lz4 && msg.payload != StrView(PROTO_BINARY_CAP)) {
+        sendMsg(client, msg.corrId, 'B', "", client.id); // 不认识的格式：空应答表示继续使用文本帧
+        return;
+    }
+    bool compress = lz4 && _cfg.compressMin > 0;
+    sendMsg(client, msg.corrId, 'B', compress ? PROTO_BINARY_LZ4_CAP : PROTO_BINARY_CAP, client.id);
+    client.binary = true;
+    client.compress = compress;
+    LOG_DEBUG(LOG_CAT_REQUEST, "[Server] Client %d switched to binary framing%s.", client.id.load(),
+              compress ? " with compression" : "");
+}
+
+// 0.1 处理心跳：服务器发出的 "ping" 由客户端回 "pong"，收到即可（时间戳已在 processBuffer 里更新）
+// 客户端自己发的 "ping"（或空负载）回一个 "pong"，客户端据此判断服务器是否还活着
+void TcpServer::handleHeartbeat(ClientNode& client, StrView payload, uint32_t corrId) {
+    if (payload == StrView(HEARTBEAT_PONG)) return;
+    sendMsg(client, corrId, 'H', HEARTBEAT_PONG);
+}
+
+// 当前这一秒的时间应答，每个线程一份：跨秒后第一次请求才重新格式化和编码，
+// 不用加锁，也不必在线程之间发布
+struct TimeReplyCache {
+    time_t second;
+    CachedReply reply;
+    TimeReplyCache() : second(-1) {}
+};
+
+static const CachedReply& timeReply() {
+    static thread_local TimeReplyCache cache;
+    time_t now = time(0); // vDSO，不进内核
+    if (now != cache.second) {
+        tm ltm;
+        localtime_r(&now, &ltm);
+        char buf[64];
+        size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &ltm);
+        cache.reply.set('T', StrView(buf, n));
+        cache.second = now;
     }
+    return cache.reply;
+}
+
+// 1. 处理时间
+void TcpServer::handleTimeReq(ClientNode& client, uint32_t corrId) {
+    const CachedReply& reply = timeReply();
 
     // 【新增日志】
-    cout << "[Server] Client " << clientId << " requested Name. Sending: " << hostname << endl;
+    LOG_DEBUG(LOG_CAT_REQUEST, "[Server] Client %d requested Time. Sending: %.*s", client.id.load(),
+              (int)reply.payload().len, reply.payload().data);
 
-    sendMsg(sock, 'N', std::string(hostname));
+    sendRaw(client, reply.frame(client.binary, corrId, scratchBuffer()));
+}
+
+// 2. 处理名字：应答在构造时编码好
+void TcpServer::handleNameReq(ClientNode& client, uint32_t corrId) {
+    // 【新增日志】
+    LOG_DEBUG(LOG_CAT_REQUEST, "[Server] Client %d requested Name. Sending: %.*s", client.id.load(),
+              (int)_nameReply.payload().len, _nameReply.payload().data);
+
+    sendRaw(client, _nameReply.frame(client.binary, corrId, scratchBuffer()));
+}
+
+// 解析分页参数 "afterId:limit"
+static bool parsePage(StrView payload, int& afterId, size_t& limit) {
+    char buf[32];
+    if (payload.len == 0 || payload.len >= sizeof(buf)) return false;
+    memcpy(buf, payload.data, payload.len);
+    buf[payload.len] = '\0';
+
+    char* end;
+    long after = strtol(buf, &end, 10);
+    if (end == buf || *end != ':' || after < 0 || after > INT32_MAX) return false;
+    const char* p = end + 1;
+    long n = strtol(p, &end, 10);
+    if (end == p || *end != '\0' || n <= 0) return false;
+    afterId = (int)after;
+    limit = std::min((size_t)n, (size_t)LIST_PAGE_MAX);
+    return true;
+}
+
+// 列表的一行：info 登记时已经格式化好，自己那一行在 ']' 前加上 "(You)"
+static void encodeListRow(std::string& out, const std::string& info, bool self, bool binary, uint32_t corrId) {
+    if (self) {
+        NetMsg::encodeTo(out, 'L', 0, StrView(info.data(), info.size() - 1), "(You)]", binary, corrId);
+    } else {
+        NetMsg::encodeTo(out, 'L', 0, info, binary, corrId);
+    }
 }
 
 // 3. 处理列表
-// 【修改】增加参数 int clientId
-// 3. 处理列表
-// 3. 处理列表
-void TcpServer::handleListReq(int sock, int clientId) {
+void TcpServer::handleListReq(ClientNode& client, StrView payload, uint32_t corrId) {
     // 【日志 1】打印请求头
     // 格式：[1]handle request..
-    cout << "[Server] " <<  "Client [" << clientId << "] Get Client List.." << endl;
-    //cout << "send messsage:" << endl;
+    LOG_DEBUG(LOG_CAT_REQUEST, "[Server] Client [%d] Get Client List..", client.id.load());
 
     std::string totalPackets = "";
-    
-    // 1. 封装列表标题包 (作为第一行)
-    NetMsg titleMsg('L', "=== Online Clients ===");
-    totalPackets += titleMsg.encode();
-
-    lock_guard<mutex> lock(_mtx);
-    for (auto& pair : _clients) {
-        ClientNode& node = pair.second;
-        
+
+    if (payload.len > 0) {
+        // 分页：只在名单的锁内拷贝这一页
+        int afterId;
+        size_t limit;
+        if (!parsePage(payload, afterId, limit)) {
+            sendMsg(client, corrId, 'L', "[System] Error: Expected afterId:limit.");
+            return;
+        }
+        ClientRoster::Rows rows;
+        int next;
+        size_t total;
+        uint64_t version = _roster.page(afterId, limit, rows, next, total);
+
+        // 标题带上版本号、下一页的起点（0 表示没有了）和总数
+        char title[128];
+        int titleLen = snprintf(title, sizeof(title), "=== Online Clients === version:%llu next:%d total:%zu",
+                                (unsigned long long)version, next, total);
+        NetMsg::encodeTo(totalPackets, 'L', (int)rows.size(), StrView(title, titleLen), client.binary, corrId);
+        for (size_t i = 0; i < rows.size(); i++) {
+            encodeListRow(totalPackets, rows[i].second, rows[i].first == client.id, client.binary, corrId);
+        }
+        sendRaw(client, totalPackets);
+        return;
+    }
+
+    // 取一致的快照后再格式化和打日志，不阻塞其他线程登记/注销/转发
+    std::vector<std::shared_ptr<ClientNode> > snapshot;
+    _clients.snapshot(snapshot);
+
+    // 1. 封装列表标题包 (作为第一行)，targetId 填后面的行数，客户端据此知道列表什么时候收完
+    NetMsg::encodeTo(totalPackets, 'L', (int)snapshot.size(), "=== Online Clients ===", client.binary, corrId);
+
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        ClientNode& node = *snapshot[i];
+
         // 【日志 2】打印每个客户端的详细信息
-        // 格式：id1:[127.0.0.1 37626]
-        cout << "id" << node.id << ":[" 
-             << inet_ntoa(node.addr.sin_addr) << " " 
-             << ntohs(node.addr.sin_port) << "]" << endl;
+        // 格式：[ID:100 127.0.0.1:37626]
+        LOG_DEBUG(LOG_CAT_REQUEST, "%s", node.info.c_str());
 
         // 2. 封装单个客户端信息包 (作为后续的行)
         // 格式：[ID:100 127.0.0.1:16376(You)]
-        string clientInfo = "[ID:" + to_string(node.id) + " " + 
-                            inet_ntoa(node.addr.sin_addr) + ":" + 
-                            to_string(ntohs(node.addr.sin_port));
-        
-        if (node.id == clientId) {
-             clientInfo += "(You)";
-        }
-        clientInfo += "]";
-        
-        // 编码并追加到发送缓冲区
-        NetMsg clientMsg('L', clientInfo);
-        totalPackets += clientMsg.encode();
-    }
-    
-    // 3. 一次性发送所有包 (客户端 recvLoop 会自动循环处理这些 \n 分隔的包)
-    send(sock, totalPackets.c_str(), totalPackets.length(), 0);
+        encodeListRow(totalPackets, node.info, node.id == client.id, client.binary, corrId);
+    }
+
+    // 3. 一次性发送所有包 (客户端 recvLoop 会自动循环处理这些粘在一起的包)
+    sendRaw(client, totalPackets);
 }
+
+// 3.1 订阅/退订在线列表的增量：应答内容为当前版本号，之后的变化以 'U' 推送
+void TcpServer::handleWatchReq(ClientNode& client, StrView payload, uint32_t corrId) {
+    uint64_t version;
+    if (payload == StrView("0")) {
+        version = _roster.unwatch(client.id);
+        client.watching = false;
+    } else {
+        version = _roster.watch(client.id);
+        client.watching = true;
+    }
+
+    char reply[32];
+    int replyLen = snprintf(reply, sizeof(reply), "%llu", (unsigned long long)version);
+    sendMsg(client, corrId, 'W', StrView(reply, replyLen));
+}
+
+// 增量：上线 "+版本号 [ID:101 127.0.0.1:5555]"，下线 "-版本号"，targetId 为变化的客户端
+// 各次变化从不同线程推送，订阅者收到的顺序可能和版本号不一致，按版本号处理
+void TcpServer::publishRosterChange(ClientNode& node, uint64_t version, bool online) {
+    if (version == 0) return;
+    ClientRoster::Watchers watchers = _roster.watchers();
+    if (watchers->empty()) return;
+
+    std::vector<std::shared_ptr<ClientNode> > targets;
+    targets.reserve(watchers->size());
+    for (size_t i = 0; i < watchers->size(); i++) {
+        std::shared_ptr<ClientNode> target = findClient((*watchers)[i]);
+        if (target) targets.push_back(std::move(target));
+    }
+
+    char head[32];
+    int headLen = snprintf(head, sizeof(head), online ? "+%llu " : "-%llu", (unsigned long long)version);
+    fanOut(node, targets, 'U', StrView(head, headLen), online ? StrView(node.info) : StrView());
+}
+
+
 // 4. 处理转发
-// 4. 处理转发
-void TcpServer::handleForwardReq(int sock, int sourceId, int targetId, std::string content) {
+// 【热路径】content 借用接收缓冲区，消息直接编码进复用的缓冲区，稳定状态下不分配内存
+// 查找目标不加锁，写目标套接字时只持有目标自己的 outMtx
+void TcpServer::handleForwardReq(ClientNode& client, int targetId, StrView content, uint32_t corrId) {
+    int sourceId = client.id;
+
     // 【日志 1】收到请求
     // 格式：[1]handle request..
-    cout << "[Server] " << "Client [" << sourceId << "] handle sending request.." << endl;
+    LOG_DEBUG(LOG_CAT_FORWARD, "[Server] Client [%d] handle sending request..", sourceId);
 
-    lock_guard<mutex> lock(_mtx);
-    
     // 查找目标是否存在
-    if (_clients.find(targetId) != _clients.end()) {
-        int targetSock = _clients[targetId].socket;
-        
+    std::shared_ptr<ClientNode> target = findClient(targetId);
+    if (target) {
         // 【日志 2】准备发送
         // 格式：send messsage to [2]:From [l]: hello
-        cout << "send messsage to [" << targetId << "]:From [" << sourceId << "]: " << content << endl;
-        
-        // 组装消息: [来自 ID:101] 你好
-        std::string forwardContent = "[From " + to_string(sourceId) + "]: " + content;
-        
+        // 正文只记前 LOG_CONTENT_MAX 字节
+        LOG_DEBUG(LOG_CAT_FORWARD, "send messsage to [%d]:From [%d]: %.*s", targetId, sourceId,
+                  (int)std::min(content.len, (size_t)LOG_CONTENT_MAX), content.data);
+
+        // 组装消息: [来自 ID:101] 你好 —— 前缀格式化在栈上，和正文一起编码，不拼接字符串
+        char prefix[32];
+        int prefixLen = snprintf(prefix, sizeof(prefix), "[From %d]: ", sourceId);
+        StrView head(prefix, prefixLen);
+
         // 复用 'S' 类型，TargetId 填 sourceId 告知接收方是谁发的
-        NetMsg msg('S', forwardContent, sourceId); 
-        std::string packet = msg.encode();
-        send(targetSock, packet.c_str(), packet.length(), 0);
-        
+        if (target->loop && target->loop != client.loop) {
+            // 目标在另一个 Reactor 上：编码后放进任务（内存池的块），交给它自己写，避免跨线程争用同一个连接
+            std::string& packet = scratchBuffer();
+            NetMsg::encodeTo(packet, 'S', sourceId, head, content, target->binary);
+            LoopTask task;
+            task.targetId = targetId;
+            task.packet.assign(packet);
+            target->inflight.fetch_add(task.packet.size(), std::memory_order_relaxed);
+            postToLoop(target->loop, std::move(task));
+        } else {
+            std::string& packet = scratchBuffer();
+            NetMsg::encodeTo(packet, 'S', sourceId, head, content, target->binary);
+            sendRaw(*target, packet);
+        }
+
+        // 接收方积压过多：暂停读取发送方
+        if (client.nonBlocking && _cfg.slowPolicy == SLOW_BACKPRESSURE &&
+            target->queuedBytes() >= _cfg.outHighWater) {
+            pauseSender(client, *target);
+        }
+
         // 【日志 3】发送成功
         // 格式：send messsage:already send the message!
-        cout << "send messsage:already send the message!" << endl;
+        LOG_DEBUG(LOG_CAT_FORWARD, "send messsage:already send the message!");
 
     } else {
+        // 目标不在线：是会话就存进它的离线队列，恢复时补发
+        StoreResult stored = _store.append(targetId, sourceId, content);
+        if (stored == STORE_ONLINE) {
+            // 对方刚刚恢复会话：已经登记，直接转发；这期间又断开了就再存一次
+            if (findClient(targetId)) {
+                handleForwardReq(client, targetId, content, corrId);
+                return;
+            }
+            stored = _store.append(targetId, sourceId, content);
+        }
+        if (stored == STORE_OK) {
+            LOG_DEBUG(LOG_CAT_FORWARD, "[Server] Client [%d] is offline, message from [%d] stored.", targetId, sourceId);
+            return;
+        }
+
         // 目标不存在的日志
-        cout << "[Server] Error: Target " << targetId << " not found." << endl;
-        sendMsg(sock, 'S', "[System] Error: Client " + to_string(targetId) + " not found.");
+        LOG_INFO(LOG_CAT_FORWARD, "[Server] Error: Target %d not found.", targetId);
+        char err[64];
+        int errLen = stored == STORE_FULL
+            ? snprintf(err, sizeof(err), "[System] Error: Client %d has too many offline messages.", targetId)
+            : snprintf(err, sizeof(err), "[System] Error: Client %d not found.", targetId);
+        sendMsg(client, corrId, 'S', StrView(err, errLen));
+    }
+}
+
+// 5. 处理广播
+void TcpServer::handleBroadcastReq(ClientNode& client, StrView content) {
+    static thread_local std::vector<std::shared_ptr<ClientNode> > targets; // 复用容量，用完清空引用
+    _clients.snapshot(targets);
+
+    LOG_DEBUG(LOG_CAT_FORWARD, "[Server] Client [%d] broadcast to %zu client(s): %.*s", client.id.load(), targets.size() - 1,
+              (int)std::min(content.len, (size_t)LOG_CONTENT_MAX), content.data);
+
+    char prefix[32];
+    int prefixLen = snprintf(prefix, sizeof(prefix), "[From %d]: ", client.id.load());
+    fanOut(client, targets, 'A', StrView(prefix, prefixLen), content);
+    targets.clear();
+}
+
+// 主题名：非空、不超过 MAX_TOPIC_LEN，不能含分隔符和换行
+static bool validTopic(StrView topic) {
+    if (topic.len == 0 || topic.len > MAX_TOPIC_LEN) return false;
+    return memchr(topic.data, DELIMITER[0], topic.len) == NULL &&
+           memchr(topic.data, '\n', topic.len) == NULL;
+}
+
+// 6. 处理订阅
+void TcpServer::handleJoinReq(ClientNode& client, StrView topic, uint32_t corrId) {
+    if (!validTopic(topic)) {
+        sendMsg(client, corrId, 'J', "[System] Error: Invalid topic name.");
+        return;
+    }
+    std::string name = topic.str();
+    bool joined = std::find(client.topics.begin(), client.topics.end(), name) != client.topics.end();
+    if (!joined && client.topics.size() >= MAX_TOPICS_PER_CLIENT) {
+        sendMsg(client, corrId, 'J', "[System] Error: Too many topics.");
+        return;
+    }
+
+    size_t count = _topics.join(name, client.id);
+    if (!joined) client.topics.push_back(name);
+
+    LOG_INFO(LOG_CAT_TOPIC, "[Server] Client %d joined topic %s (%zu member(s)).", client.id.load(), name.c_str(), count);
+
+    char reply[MAX_TOPIC_LEN + 64];
+    int replyLen = snprintf(reply, sizeof(reply), "[System] Joined %s (%zu member(s)).", name.c_str(), count);
+    sendMsg(client, corrId, 'J', StrView(reply, replyLen));
+}
+
+// 6. 处理退订
+void TcpServer::handleLeaveReq(ClientNode& client, StrView topic, uint32_t corrId) {
+    std::string name = topic.str();
+    std::vector<std::string>::iterator it = std::find(client.topics.begin(), client.topics.end(), name);
+    if (it == client.topics.end()) {
+        sendMsg(client, corrId, 'Q', "[System] Error: Not a member of this topic.");
+        return;
+    }
+    client.topics.erase(it);
+    _topics.leave(name, client.id);
+
+    LOG_INFO(LOG_CAT_TOPIC, "[Server] Client %d left topic %s.", client.id.load(), name.c_str());
+
+    char reply[MAX_TOPIC_LEN + 32];
+    int replyLen = snprintf(reply, sizeof(reply), "[System] Left %s.", name.c_str());
+    sendMsg(client, corrId, 'Q', StrView(reply, replyLen));
+}
+
+// 7. 处理发布
+void TcpServer::handlePublishReq(ClientNode& client, StrView payload, uint32_t corrId) {
+    const char* sep = (const char*)memchr(payload.data, DELIMITER[0], payload.len);
+    StrView topic(payload.data, sep ? sep - payload.data : payload.len);
+    if (sep == NULL || !validTopic(topic)) {
+        sendMsg(client, corrId, 'P', "[System] Error: Expected topic|message.");
+        return;
+    }
+    StrView content(sep + 1, payload.data + payload.len - sep - 1);
+
+    TopicRegistry::Members members = _topics.members(topic.str());
+    if (!members) {
+        sendMsg(client, corrId, 'P', "[System] Error: Topic has no subscribers.");
+        return;
+    }
+
+    std::vector<std::shared_ptr<ClientNode> > targets;
+    targets.reserve(members->size());
+    for (size_t i = 0; i < members->size(); i++) {
+        std::shared_ptr<ClientNode> node = findClient((*members)[i]);
+        if (node) targets.push_back(std::move(node));
+    }
+
+    LOG_DEBUG(LOG_CAT_FORWARD, "[Server] Client [%d] published to %.*s (%zu subscriber(s)).", client.id.load(),
+              (int)topic.len, topic.data, targets.size());
+
+    // 接收方看到的内容：主题|[From 101]: 正文
+    char prefix[MAX_TOPIC_LEN + 32];
+    int prefixLen = snprintf(prefix, sizeof(prefix), "%.*s%s[From %d]: ",
+                             (int)topic.len, topic.data, DELIMITER, client.id.load());
+    fanOut(client, targets, 'P', StrView(prefix, prefixLen), content);
+}
+
+// 8. 处理会话
+void TcpServer::handleSessionReq(ClientNode& client, StrView token, uint32_t corrId) {
+    if (!_store.isOpen()) {
+        // 没有配置存储，或者热重启时旧进程还没放开
+        sendMsg(client, corrId, 'I', _cfg.storeDir.empty() ? "[System] Error: Sessions are not enabled."
+                                                           : "[System] Error: Session store unavailable, retry later.");
+        return;
+    }
+
+    std::string tok;
+    int id;
+    if (token.len == 0) {
+        if (client.session) {
+            // 已经绑定了会话：原样返回
+            tok = _store.tokenOf(client.id);
+            sendMsg(client, corrId, 'I', StrView(tok), client.id);
+            return;
+        }
+        id = _store.createSession(tok);
+        if (id == 0) {
+            sendMsg(client, corrId, 'I', "[System] Error: Failed to create a session.");
+            return;
+        }
+    } else {
+        id = _store.findSession(token);
+        if (id == 0) {
+            sendMsg(client, corrId, 'I', "[System] Error: Unknown session.");
+            return;
+        }
+        if (id == client.id) {
+            sendMsg(client, corrId, 'I', token, id);
+            return;
+        }
+        if (client.session) {
+            sendMsg(client, corrId, 'I', "[System] Error: Already bound to another session.");
+            return;
+        }
+        tok = token.str();
+    }
+
+    int oldId = client.id;
+    if (!rebindClient(client, id)) {
+        // 会话还在旧连接上（多半是断网了，服务器还没发现）：断开旧连接，客户端稍后重试
+        std::shared_ptr<ClientNode> old = findClient(id);
+        if (old && old->nonBlocking) {
+            lock_guard<mutex> lock(old->outMtx); // epoll 模式关闭时在 outMtx 下 close，不会碰到被复用的 fd
+            if (!old->closed) shutdown(old->socket, SHUT_RDWR);
+        } else if (old) {
+            shutdown(old->socket, SHUT_RDWR); // 线程模式的描述符在节点释放时才关闭
+        }
+        sendMsg(client, corrId, 'I', "[System] Error: Session is busy, retry later.");
+        return;
+    }
+    client.session = true;
+    _store.attach(id); // 在登记之后：append 看到在线时一定查得到这个连接
+
+    LOG_INFO(LOG_CAT_CONN, "[Server] Client %d bound to session %d.", oldId, id);
+    sendMsg(client, corrId, 'I', StrView(tok), id);
+    deliverOffline(client);
+}
+
+// 9. 处理主动退出
+void TcpServer::handleQuitReq(ClientNode& client) {
+    if (!client.session) return;
+    client.session = false; // 先清掉：断开时不再 detach 一个已经不存在的会话
+    _store.endSession(client.id);
+    LOG_INFO(LOG_CAT_CONN, "[Server] Client %d ended its session.", client.id.load());
+}
+
+// 换 ID：先按新 ID 登记（会话已在别的连接上时失败），再按旧 ID 退出在线列表、主题和列表订阅，换好后按新 ID 加回去
+// 只在处理这个连接的线程上调用。其他线程拿着旧 ID 查找会查不到，和连接刚断开一样
+bool TcpServer::rebindClient(ClientNode& client, int newId) {
+    std::shared_ptr<ClientNode> self = client.shared_from_this();
+    if (!_clients.insert(newId, self)) return false;
+
+    int oldId = client.id;
+    for (size_t i = 0; i < client.topics.size(); i++) {
+        _topics.leave(client.topics[i], oldId);
+    }
+    if (client.watching) _roster.unwatch(oldId);
+    _clients.remove(oldId, self);
+    publishRosterChange(client, _roster.remove(oldId), false);
+
+    client.id = newId;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client.addr.sin_addr, ip, sizeof(ip));
+    char info[64];
+    snprintf(info, sizeof(info), "[ID:%d %s:%d]", newId, ip, ntohs(client.addr.sin_port));
+    client.info = info;
+
+    publishRosterChange(client, _roster.add(newId, client.info), true);
+    for (size_t i = 0; i < client.topics.size(); i++) {
+        _topics.join(client.topics[i], newId);
+    }
+    if (client.watching) _roster.watch(newId);
+
+    if (client.loop && !client.loop->ring) {
+        // epoll 事件里存的是 ID，换成新的（io_uring 的请求里是节点地址，不用改）
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = (uint64_t)newId;
+        epoll_ctl(client.loop->epfd, EPOLL_CTL_MOD, client.socket, &ev);
+    }
+    if (_timeouts) {
+        lock_guard<mutex> lock(_renamedMtx);
+        _renamed[oldId] = newId;
+    }
+    return true;
+}
+
+// 每批先发再确认：发到一半断开的消息下次恢复时会再发一遍（至少一次）
+// epoll 模式下队列超过高水位就停下，由 flushOut 在降到低水位以下时接着发，大量积压不会一下子全进内存
+void TcpServer::deliverOffline(ClientNode& client) {
+    static thread_local std::vector<StoredMsg> batch;
+    client.offlinePending = false;
+    uint64_t sent = 0;
+    while (_store.take(client.id, OFFLINE_BATCH, batch) > 0) {
+        bool stop = false;
+        for (size_t i = 0; i < batch.size() && !stop; i++) {
+            if (client.nonBlocking && client.out.bytes() >= _cfg.outHighWater) {
+                client.offlinePending = true;
+                stop = true;
+                break;
+            }
+            char prefix[32];
+            int prefixLen = snprintf(prefix, sizeof(prefix), "[From %d]: ", batch[i].sender);
+            std::string& packet = scratchBuffer();
+            NetMsg::encodeTo(packet, 'S', batch[i].sender, StrView(prefix, prefixLen), StrView(batch[i].content),
+                             client.binary);
+            if (!sendRaw(client, packet)) {
+                stop = true; // 连接已经断开
+                break;
+            }
+            sent = batch[i].seq;
+        }
+        if (sent > 0) _store.ack(client.id, sent);
+        if (stop || batch.size() < OFFLINE_BATCH) break;
+    }
+    batch.clear();
+}
+
+// 打开离线消息存储
+void TcpServer::openStore(int waitMs) {
+    if (_cfg.storeDir.empty()) return;
+    std::string err;
+    if (!_store.open(_cfg.storeDir, _cfg.storeSegmentBytes, _cfg.offlineMax, _cfg.sessionTtlSec, waitMs, err)) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Offline store unavailable, sessions disabled: %s", err.c_str());
+        return;
+    }
+    StoreStats stats;
+    _store.stats(stats);
+    LOG_INFO(LOG_CAT_SERVER, "[Server] Offline store %s: %zu session(s), %zu queued message(s).",
+             _cfg.storeDir.c_str(), stats.sessions, stats.queued);
+}
+
+// 扇出
+// 本 Reactor（或线程模式）的接收方直接入队；其他 Reactor 上的接收方按 Reactor 和帧格式分组，
+// 每组投递一个任务，由目标 Reactor 自己入队
+void TcpServer::fanOut(ClientNode& sender, const std::vector<std::shared_ptr<ClientNode> >& targets,
+                       char type, StrView head, StrView body) {
+    SharedBuf packets[3];                           // [0] 文本帧，[1] 二进制帧，[2] 压缩的二进制帧，用到时才编码
+    static thread_local std::vector<LoopTask> remote; // 复用：投递出去的任务被移走，只剩空壳
+    remote.clear();
+    remote.resize(_loops.size() * 3);
+    ClientNode* congested = nullptr;                // 超过高水位的接收方（背压时暂停 sender）
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        ClientNode& target = *targets[i];
+        if (target.id == sender.id) continue;
+
+        int fmt = target.compress ? 2 : target.binary ? 1 : 0;
+        if (!packets[fmt]) {
+            std::string& encoded = scratchBuffer();
+            NetMsg::encodeTo(encoded, type, sender.id, head, body, fmt != 0);
+            std::string& compressed = compressBuffer();
+            if (fmt < 2) {
+                packets[fmt] = makeSharedBuf(encoded);
+            } else if (compressPacket(encoded, compressed)) {
+                packets[2] = makeSharedBuf(compressed);
+            } else {
+                // 太小或压缩后没有变小：和不压缩的二进制帧共用一份
+                if (!packets[1]) packets[1] = makeSharedBuf(encoded);
+                packets[2] = packets[1];
+            }
+        }
+        const SharedBuf& packet = packets[fmt];
+
+        if (target.loop && target.loop != sender.loop) {
+            LoopTask& task = remote[target.loop->index * 3 + fmt];
+            task.targets.push_back(target.id);
+            task.shared = packet;
+            target.inflight.fetch_add(packet->size(), std::memory_order_relaxed);
+        } else {
+            sendRaw(target, packet->view(), packet);
+        }
+
+        if (!congested && target.queuedBytes() >= _cfg.outHighWater) {
+            congested = &target;
+        }
+    }
+
+    for (size_t i = 0; i < remote.size(); i++) {
+        if (remote[i].targets.empty()) continue;
+        remote[i].kind = TASK_FANOUT;
+        postToLoop(_loops[i / 3].get(), std::move(remote[i]));
+    }
+
+    // 有接收方积压过多：暂停读取发送方（和单播一样，等这个接收方降到低水位）
+    if (congested && sender.nonBlocking && _cfg.slowPolicy == SLOW_BACKPRESSURE) {
+        pauseSender(sender, *congested);
+    }
+}
+
+// 辅助发送：编码进本线程复用的缓冲区，带上请求的关联 ID
+void TcpServer::sendMsg(ClientNode& client, uint32_t corrId, char type, StrView content, int targetId) {
+    std::string& packet = scratchBuffer();
+    NetMsg::encodeTo(packet, type, targetId, content, client.binary, corrId);
+    sendRaw(client, packet);
+}
+
+bool TcpServer::compressPacket(StrView packet, std::string& out) {
+    if (_cfg.compressMin == 0 || packet.size() < _cfg.compressMin) return false;
+    out.clear();
+    if (!NetMsg::compressTo(out, packet)) return false;
+    Metrics::local().addCompressed(packet.size(), out.size());
+    return true;
+}
+
+// 发送已编码的数据
+bool TcpServer::sendRaw(ClientNode& client, StrView packet, const SharedBuf& shared) {
+    // 压缩在锁外做；扇出的共享帧已经由 fanOut 按接收方的格式压缩好
+    if (!shared && client.compress) {
+        std::string& compressed = compressBuffer();
+        if (compressPacket(packet, compressed)) packet = compressed;
+    }
+
+    std::unique_lock<mutex> lock(client.outMtx, std::defer_lock);
+    lockMeasured(lock); // 线程模式下多个工作线程会同时向同一个连接转发
+
+    if (client.closed || client.killed) return false;
+
+    if (!client.nonBlocking) {
+        // 线程模式：阻塞套接字，循环直到写完（send 可能只写一部分）
+        // 只持有目标自己的 outMtx，慢接收方只会阻塞向它发送的线程
+        size_t off = 0;
+        while (off < packet.size()) {
+            ssize_t n = send(client.socket, packet.data + off, packet.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false; // 出错由该连接的工作线程在 recv 时处理
+            off += n;
+        }
+        Metrics::local().addBytesOut(off);
+        return true;
+    }
+
+    // epoll 模式：只在所属 Reactor 上调用。队列超过高水位时按策略处理
+    if (client.out.bytes() >= _cfg.outHighWater) {
+        if (_cfg.slowPolicy == SLOW_DROP) {
+            return false;
+        }
+        if (_cfg.slowPolicy == SLOW_DISCONNECT) {
+            // 不能在这里 closeClient（调用方可能持有锁），shutdown 后由读端完成关闭
+            LOG_WARN(LOG_CAT_CONN, "[Server] Client %d is too slow (%zu bytes queued), disconnecting.",
+                     client.id.load(), client.out.bytes());
+            client.killed = true;
+            client.out.clear();
+            shutdown(client.socket, SHUT_RDWR);
+            return false;
+        }
+        // SLOW_BACKPRESSURE：照常入队，由调用方暂停发送方
+    }
+
+    if (shared) {
+        client.out.appendShared(shared);
+    } else {
+        client.out.append(packet);
+    }
+    if (!client.flushQueued) {
+        client.flushQueued = true;
+        client.loop->dirty.push_back(client.shared_from_this());
+    }
+    return true;
+}
+
+// 统计端口只监听本机，不对外暴露
+void TcpServer::startStats() {
+    _statsFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_statsFd < 0) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Stats socket create failed: %s", strerror(errno));
+        return;
+    }
+    int opt = 1;
+    setsockopt(_statsFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(_cfg.statsPort);
+    if (bind(_statsFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(_statsFd, 16) < 0) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Stats port %d unavailable: %s", _cfg.statsPort, strerror(errno));
+        close(_statsFd);
+        _statsFd = -1;
+        return;
+    }
+    LOG_INFO(LOG_CAT_SERVER, "[Server] Stats on http://127.0.0.1:%d/metrics", _cfg.statsPort);
+    _statsThread = std::thread(&TcpServer::statsThread, this);
+}
+
+// 统计线程：不解析请求，读掉请求头后回一份完整的统计再关闭
+void TcpServer::statsThread() {
+    std::string body;
+    std::string response;
+    while (true) {
+        int fd = accept(_statsFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; // 析构时 shutdown 监听套接字
+        }
+
+        timeval tv;
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        char req[1024];
+        ssize_t ret = recv(fd, req, sizeof(req), 0);
+        (void)ret;
+
+        body.clear();
+        renderStats(body);
+        response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                   to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+        response += body;
+
+        size_t off = 0;
+        while (off < response.size()) {
+            ssize_t n = send(fd, response.data() + off, response.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            off += n;
+        }
+        close(fd);
+    }
+}
+
+// 实时值从注册表快照里算，计数从各线程合并
+void TcpServer::renderStats(std::string& out) {
+    std::vector<std::shared_ptr<ClientNode> > snapshot;
+    _clients.snapshot(snapshot);
+    size_t queued = 0;
+    size_t maxQueued = 0;
+    for (size_t i = 0; i < snapshot.size(); i++) {
+        size_t q = snapshot[i]->queuedBytes();
+        queued += q;
+        maxQueued = std::max(maxQueued, q);
     }
+
+    out += "# HELP chat_connections Clients currently connected.\n";
+    out += "# TYPE chat_connections gauge\n";
+    out += "chat_connections " + to_string(snapshot.size()) + "\n";
+    out += "# HELP chat_send_queue_bytes Bytes waiting in client send queues.\n";
+    out += "# TYPE chat_send_queue_bytes gauge\n";
+    out += "chat_send_queue_bytes " + to_string(queued) + "\n";
+    out += "# HELP chat_send_queue_max_bytes Longest single client send queue.\n";
+    out += "# TYPE chat_send_queue_max_bytes gauge\n";
+    out += "chat_send_queue_max_bytes " + to_string(maxQueued) + "\n";
+
+    PoolStats pool;
+    BufferPool::stats(pool);
+    out += "# HELP chat_buffer_pool_reserved_bytes Memory the buffer pool holds from malloc, in use or cached.\n";
+    out += "# TYPE chat_buffer_pool_reserved_bytes gauge\n";
+    out += "chat_buffer_pool_reserved_bytes " + to_string(pool.reservedBytes) + "\n";
+    out += "# HELP chat_buffer_pool_mallocs_total Times the buffer pool had to call malloc.\n";
+    out += "# TYPE chat_buffer_pool_mallocs_total counter\n";
+    out += "chat_buffer_pool_mallocs_total " + to_string(pool.mallocs) + "\n";
+
+    if (_store.isOpen()) {
+        StoreStats store;
+        _store.stats(store);
+        out += "# HELP chat_sessions Sessions known to the offline store.\n";
+        out += "# TYPE chat_sessions gauge\n";
+        out += "chat_sessions " + to_string(store.sessions) + "\n";
+        out += "# HELP chat_offline_queued_messages Messages waiting for offline sessions.\n";
+        out += "# TYPE chat_offline_queued_messages gauge\n";
+        out += "chat_offline_queued_messages " + to_string(store.queued) + "\n";
+        out += "# HELP chat_offline_store_bytes Bytes used in offline log segments.\n";
+        out += "# TYPE chat_offline_store_bytes gauge\n";
+        out += "chat_offline_store_bytes " + to_string(store.diskBytes) + "\n";
+        out += "# HELP chat_offline_segments Offline log segment files.\n";
+        out += "# TYPE chat_offline_segments gauge\n";
+        out += "chat_offline_segments " + to_string(store.segments) + "\n";
+        out += "# HELP chat_offline_stored_total Messages written to the offline store since it was opened.\n";
+        out += "# TYPE chat_offline_stored_total counter\n";
+        out += "chat_offline_stored_total " + to_string(store.stored) + "\n";
+        out += "# HELP chat_offline_delivered_total Offline messages delivered since the store was opened.\n";
+        out += "# TYPE chat_offline_delivered_total counter\n";
+        out += "chat_offline_delivered_total " + to_string(store.delivered) + "\n";
+    }
+
+    // 常驻内存：/proc/self/statm 的第二项（页数）
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%*d %ld", &pages) != 1) pages = 0;
+        fclose(statm);
+    }
+    timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    char cpuLine[64];
+    snprintf(cpuLine, sizeof(cpuLine), "process_cpu_seconds_total %.6f\n", cpu.tv_sec + cpu.tv_nsec / 1e9);
+    out += "# HELP process_cpu_seconds_total Total user and system CPU time spent in seconds.\n";
+    out += "# TYPE process_cpu_seconds_total counter\n";
+    out += cpuLine;
+    out += "# HELP process_resident_memory_bytes Resident memory size in bytes.\n";
+    out += "# TYPE process_resident_memory_bytes gauge\n";
+    out += "process_resident_memory_bytes " + to_string(pages * sysconf(_SC_PAGESIZE)) + "\n";
+
+    MetricsTotals totals;
+    Metrics::collect(totals);
+    Metrics::render(totals, out);
+}
+
+void TcpServer::stopStats() {
+    if (_statsFd < 0) return;
+    shutdown(_statsFd, SHUT_RDWR); // 唤醒阻塞在 accept 上的统计线程
+    if (_statsThread.joinable()) _statsThread.join();
+    close(_statsFd);
+    _statsFd = -1;
+}
+
+// 连接旧进程，收下它的监听套接字
+void TcpServer::takeOver(std::vector<int>& fds) {
+    int sock = handoffConnect(_cfg.handoffPath);
+    if (sock < 0) return; // 没有旧进程，正常启动
+
+    std::string line;
+    if (!handoffRecvFds(sock, line, fds)) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Handoff from %s failed, starting fresh", _cfg.handoffPath.c_str());
+        close(sock);
+        return;
+    }
+    if (line.compare(0, strlen(HANDOFF_MAGIC), HANDOFF_MAGIC) != 0) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Unexpected handoff message, starting fresh");
+        for (size_t i = 0; i < fds.size(); i++) close(fds[i]);
+        fds.clear();
+        close(sock);
+        return;
+    }
+    LOG_INFO(LOG_CAT_SERVER, "[Server] Took over %zu listening socket(s) (%s)", fds.size(), line.c_str());
+    _takeoverFd = sock;
+}
+
+// 已经在 accept 了：告诉旧进程可以退出
+void TcpServer::finishTakeover() {
+    if (_takeoverFd < 0) return;
+    ssize_t ret = send(_takeoverFd, "OK", 2, MSG_NOSIGNAL);
+    (void)ret;
+    close(_takeoverFd);
+    _takeoverFd = -1;
 }
 
-// 辅助发送
-void TcpServer::sendMsg(int sock, char type, std::string content, int targetId) {
-    NetMsg msg(type, content, targetId);
-    std::string packet = msg.encode();
-    send(sock, packet.c_str(), packet.length(), 0);
+void TcpServer::startHandoff() {
+    _handoffFd = handoffListen(_cfg.handoffPath);
+    if (_handoffFd < 0) {
+        LOG_ERROR(LOG_CAT_SERVER, "[Server] Handoff socket %s unavailable: %s", _cfg.handoffPath.c_str(),
+                  strerror(errno));
+        return;
+    }
+    LOG_INFO(LOG_CAT_SERVER, "[Server] Waiting for hot restart on %s", _cfg.handoffPath.c_str());
+    _handoffThread = std::thread(&TcpServer::handoffThread, this);
+}
+
+// 交接线程：一次只处理一个新进程，新进程确认之后本进程开始优雅关闭
+void TcpServer::handoffThread() {
+    while (_running) {
+        int fd = accept4(_handoffFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break; // 析构时 shutdown 监听套接字
+        }
+
+        bool ok = false;
+        {
+            // 持锁期间 Reactor 不会关闭监听套接字
+            lock_guard<mutex> lock(_listenMtx);
+            std::vector<int> fds;
+            if (_cfg.mode == MODE_EPOLL) {
+                for (size_t i = 0; i < _loops.size(); i++) {
+                    if (_loops[i]->listenFd >= 0) fds.push_back(_loops[i]->listenFd);
+                }
+            } else {
+                fds = _listenFds;
+            }
+            char line[64];
+            snprintf(line, sizeof(line), "%s %s %zu", HANDOFF_MAGIC,
+                     _cfg.mode == MODE_EPOLL ? "epoll" : "thread", fds.size());
+            if (_running && !fds.empty()) {
+                stopStats(); // 统计端口让给新进程
+                ok = handoffSendFds(fd, line, fds);
+            }
+        }
+
+        if (ok) {
+            // 等新进程开始 accept
+            timeval tv;
+            tv.tv_sec = 10;
+            tv.tv_usec = 0;
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char ack[2];
+            ok = recv(fd, ack, sizeof(ack), MSG_WAITALL) == 2 && memcmp(ack, "OK", 2) == 0;
+        }
+        close(fd);
+
+        if (ok) {
+            LOG_INFO(LOG_CAT_SERVER, "[Server] Listening sockets handed over to the new process");
+            _handedOff = true;
+            stop();
+            break;
+        }
+        LOG_WARN(LOG_CAT_SERVER, "[Server] Hot restart aborted, still serving");
+        if (_cfg.statsPort > 0 && _statsFd < 0) startStats();
+    }
 }
-//
\ No newline at end of file
@@ -1,66 +1,533 @@
 #ifndef TCP_SERVER_H
 #define TCP_SERVER_H
 
-#include <map>
 #include <thread>
 #include <mutex>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <condition_variable>
 #include <netinet/in.h>
+#include <unistd.h>
 #include "../common/NetMsg.h"
+#include "../common/MsgBuffer.h"
+#include "../common/BufferPool.h"
+#include "MpscQueue.h"
+#include "OutQueue.h"
+#include "ShardedRegistry.h"
+#include "TopicRegistry.h"
+#include "ReplyCache.h"
+#include "ClientRoster.h"
+#include "TimerWheel.h"
+#include "ConnLimiter.h"
+#include "OfflineStore.h"
+#include "IoUring.h"
 
-// 服务器监听端口
+// 服务器监听端口（默认值，可由配置文件或 -P 修改）
 #define SERVER_PORT 6241 // 监听端口为学号后四位
-#define BUF_SIZE 2048
+#define BUF_SIZE 2048    // 每次 recv 至少预留的缓冲区空间（默认值）
+#define LISTEN_BACKLOG 4096 // accept 队列长度（默认值），内核会再截断到 net.core.somaxconn
+#define MAX_EVENTS 256   // 每次 epoll_wait 最多取回的事件数
+#define OFFLINE_BATCH 256 // 恢复会话时每批投递的离线消息数，每批确认一次
+#define URING_ENTRIES 1024 // io_uring 模式下每个 Reactor 的提交队列长度
+#define URING_BUFS 1024   // io_uring 模式下每个 Reactor 提供给内核的接收缓冲区个数（每个 recv_chunk 字节）
+
+// 线程模型：保留原来的每连接一个线程，便于和 epoll 模式对比
+enum ServerMode {
+    MODE_THREAD = 0,    // 每个连接一个阻塞线程
+    MODE_EPOLL  = 1     // 边缘触发 epoll Reactor，固定线程数（ioUring 时改用 io_uring 收发）
+};
+
+// 慢消费者策略：发送队列超过高水位时如何处理
+enum SlowPolicy {
+    SLOW_DROP = 0,          // 丢弃新消息
+    SLOW_DISCONNECT = 1,    // 断开慢的接收方
+    SLOW_BACKPRESSURE = 2   // 暂停读取发送方，直到接收方降到低水位以下
+};
+
+// 服务器运行参数
+struct ServerConfig {
+    ServerMode mode;        // 线程模型
+    int loopThreads;        // epoll 模式下的 Reactor 线程数
+    bool pinCpu;            // 是否把第 i 个 Reactor 绑定到第 i 个 CPU
+    bool ioUring;           // Reactor 用 io_uring 收发（mode = uring），内核不支持时退回 epoll
+
+    // 【监听与套接字选项】监听套接字和 accept 得到的连接都会设置
+    std::string bindAddr;   // 监听地址，默认所有网卡
+    int port;               // 监听端口
+    int backlog;            // listen 的 accept 队列长度
+    size_t recvChunk;       // 每次 recv 至少预留的缓冲区空间
+    bool tcpNoDelay;        // TCP_NODELAY：应答不等 Nagle 合并
+    int rcvBuf;             // SO_RCVBUF（字节），0 表示使用内核默认值（自动调整）
+    int sndBuf;             // SO_SNDBUF（字节），0 表示使用内核默认值（自动调整）
+    int deferAcceptSec;     // TCP_DEFER_ACCEPT：连接上有数据才交给 accept，0 表示关闭
+    bool keepAlive;         // SO_KEEPALIVE：由内核探测断网的对端
+    int keepIdleSec;        // 空闲多久开始探测，0 表示使用内核默认值
+    int keepIntervalSec;    // 探测间隔，0 表示使用内核默认值
+    int keepCount;          // 探测几次没有回应算断开，0 表示使用内核默认值
+
+    // 【accept】
+    int acceptBatch;        // 每次从监听套接字最多连续 accept 的连接数，之后再处理其他事件
+    int connRatePerIp;      // 每个源 IP 每秒最多新建的连接数，0 表示不限制
+    int connBurstPerIp;     // 每个源 IP 可以突发的连接数，0 表示等于 connRatePerIp
+
+    // 【epoll 模式】发送队列（线程模式是阻塞写，接收方慢时只阻塞向它发送的线程）
+    size_t outHighWater;    // 高水位（字节），也是队列的上限
+    size_t outLowWater;     // 低水位（字节），降到这里以下恢复被暂停的发送方
+    SlowPolicy slowPolicy;  // 超过高水位时的处理策略
+    size_t zeroCopyThreshold; // 单段超过该大小用 MSG_ZEROCOPY 发送，0 表示关闭
+
+    size_t compressMin;     // 协商了压缩的连接，一次发送的数据不小于该长度时压缩成 'Z' 帧，0 表示不支持压缩
+
+    int statsPort;          // 统计端口（只监听 127.0.0.1），0 表示不开启
+
+    // 【关闭与热重启】
+    int drainTimeoutMs;     // 优雅关闭时排空发送队列的最长时间
+    std::string handoffPath; // 热重启用的 Unix 域套接字路径，空表示不开启
+
+    // 【超时与心跳】单位毫秒，0 表示不开启
+    int heartbeatMs;        // 连接静默这么久后发 'H' 心跳，再过这么久仍没有任何数据就断开
+    int idleTimeoutMs;      // 这么久没有心跳以外的请求就断开
+    int readTimeoutMs;      // 一个帧只收到一部分、这么久还没收全就断开
+
+    // 【会话与离线消息】
+    std::string storeDir;   // 离线消息日志的目录，空表示不开启（没有会话，发给不在线的 ID 直接报错）
+    size_t storeSegmentBytes; // 日志段文件的大小
+    size_t offlineMax;      // 每个会话最多排队的离线消息数
+    int sessionTtlSec;      // 会话离线超过这么多秒就过期，0 表示永不过期
+
+    ServerConfig() : mode(MODE_THREAD), loopThreads(4), pinCpu(false), ioUring(false),
+                     bindAddr("0.0.0.0"), port(SERVER_PORT), backlog(LISTEN_BACKLOG), recvChunk(BUF_SIZE),
+                     tcpNoDelay(true), rcvBuf(0), sndBuf(0), deferAcceptSec(0),
+                     keepAlive(false), keepIdleSec(0), keepIntervalSec(0), keepCount(0),
+                     acceptBatch(256), connRatePerIp(0), connBurstPerIp(0),
+                     outHighWater(4 * 1024 * 1024), outLowWater(1024 * 1024),
+                     slowPolicy(SLOW_BACKPRESSURE), zeroCopyThreshold(0), compressMin(COMPRESS_MIN_DEFAULT), statsPort(0),
+                     drainTimeoutMs(5000), heartbeatMs(0), idleTimeoutMs(0), readTimeoutMs(0),
+                     storeSegmentBytes(STORE_SEGMENT_BYTES), offlineMax(STORE_MAX_PER_CLIENT),
+                     sessionTtlSec(STORE_SESSION_TTL_SEC) {}
+};
+
+// 跨 Reactor 投递的任务类型
+enum LoopTaskKind {
+    TASK_SEND = 0,          // 向 targetId 发送 packet
+    TASK_RESUME = 1,        // 恢复读取 targetId（它等待的接收方已降到低水位以下）
+    TASK_FANOUT = 2         // 向 targets 中的每个连接发送同一个共享缓冲区 shared
+};
+
+// 跨 Reactor 投递的任务：由目标连接所属的 Reactor 执行
+struct LoopTask {
+    LoopTaskKind kind;      // 任务类型
+    int targetId;           // 目标客户端 ID
+    PooledBuf packet;       // 已编码的数据
+
+    // 【扇出】同一个 Reactor 上的接收方合并成一个任务，共用一份编码好的数据
+    std::vector<int, PoolAllocator<int> > targets;
+    SharedBuf shared;
+
+    LoopTask() : kind(TASK_SEND), targetId(0) {}
+};
+
+struct ClientNode;
+
+// 一批 accept 到的连接中的一个
+struct AcceptedConn {
+    int fd;
+    sockaddr_in addr;
+};
+
+// Reactor：一个 epoll 实例（或 io_uring 实例）+ 一个线程 + 自己的监听套接字
+// 每个 Reactor 都用 SO_REUSEPORT 绑定同一个端口，由内核把新连接分散到各个 Reactor
+// 连接只在接受它的 Reactor 上读写，其他 Reactor 要写它时通过 inbox 投递
+struct EventLoop {
+    int index;              // 编号
+    int epfd;               // epoll 句柄
+    int listenFd;           // 本 Reactor 的监听套接字
+    int wakeFd;             // eventfd，inbox 有新任务时唤醒 epoll_wait
+    int spareFd;            // 预留的描述符，fd 用尽时腾出来 accept 并关掉新连接
+    MpscQueue<LoopTask> inbox; // 其他 Reactor 投递过来的发送任务
+    std::thread thread;     // 运行 loopThread 的线程
+
+    // 本轮事件中有新数据入队的连接，处理完所有事件后统一 flush，多条消息合并成一次 sendmsg
+    std::vector<std::shared_ptr<ClientNode> > dirty;
+
+    // 【优雅关闭】只由本 Reactor 访问
+    bool draining;          // 已停止 accept 和处理请求，只把发送队列写完
+    std::vector<std::shared_ptr<ClientNode> > drainList; // 开始排空时属于本 Reactor 的连接
+
+    TimerWheel timers;      // 本 Reactor 上连接的超时检查
+
+    // 【io_uring】在 Reactor 线程上创建，只由它访问；为空表示用 epoll
+    std::unique_ptr<IoUring> ring;
+    bool closing;           // 退出前取消了所有请求，不再提交新的
+
+    EventLoop() : index(0), epfd(-1), listenFd(-1), wakeFd(-1), spareFd(-1), draining(false), closing(false) {}
+};
 
 // 定义一个结构体来保存客户端信息
-struct ClientNode {
+struct ClientNode : public std::enable_shared_from_this<ClientNode> {
     int socket;             // 套接字句柄
     sockaddr_in addr;       // 地址信息
-    int id;                 // 分配的唯一ID
+    std::atomic<int> id;    // 分配的唯一ID；恢复会话后换成会话 ID（只由处理该连接的线程修改）
+
+    // 【epoll 模式】每连接的读写缓冲
+    MsgBuffer inBuf;        // 接收缓冲区，保存尚未凑成完整包的输入（只由读这个连接的线程访问）
+    OutQueue out;           // 发送队列
+    std::mutex outMtx;      // 保护 out、waiters、closed（线程模式下其他线程转发消息时也会写）
+    bool nonBlocking;       // true 表示由 Reactor 收发（epoll 模式的非阻塞套接字，或 io_uring 模式）
+    bool closed;            // 套接字已关闭，不能再写
+    bool killed;            // 因慢消费者策略已 shutdown，等待读端关闭
+    EventLoop* loop;        // 所属 Reactor（线程模式为 nullptr）
+    std::atomic<bool> binary; // 已协商二进制帧，发给它的消息用二进制编码
+    std::atomic<bool> compress; // 已协商压缩（一定也是二进制帧），较大的数据压缩成 'Z' 帧再发
+
+    // 【背压】
+    bool paused;            // 暂停读取（等待某个接收方的队列降下来），只由所属 Reactor 访问
+    bool flushQueued;       // 已在所属 Reactor 的 dirty 列表里
+    bool zeroCopy;          // 套接字已开启 SO_ZEROCOPY
+    std::vector<int> waiters; // 因本连接队列过长而被暂停的发送方 ID
+    std::atomic<size_t> inflight; // 其他 Reactor 已投递、还在 inbox 里没入队的字节数
+
+    std::vector<std::string> topics; // 已订阅的主题，只由处理该连接的线程访问
+    bool watching;          // 订阅了在线列表的增量，只由处理该连接的线程访问
+    std::string info;       // 列表里显示的 "[ID:100 127.0.0.1:16376"，登记时格式化一次
+    bool session;           // 已绑定会话（id 是会话 ID），只由处理该连接的线程访问
+    bool offlinePending;    // 【epoll 模式】离线消息没发完，发送队列降到低水位以下时接着发
+
+    // 【io_uring】只由所属 Reactor 访问。内核完成事件里带的是节点地址，
+    // 有未完成的请求时 uringSelf 持有节点自己，连接被移除后地址也不会悬空
+    bool recvArmed;         // 挂着多次接收的 recv
+    bool recvStopping;      // 被背压暂停，已提交取消 recv
+    int uringOps;           // 未完成的请求数
+    std::shared_ptr<ClientNode> uringSelf;
+
+    // 【超时】timerNowMs 的时间，读这个连接的线程写，检查超时的线程读
+    std::atomic<uint64_t> lastRecvMs;     // 最近一次收到数据（包括心跳）
+    std::atomic<uint64_t> lastRequestMs;  // 最近一次收到心跳以外的请求
+    std::atomic<uint64_t> partialSinceMs; // 缓冲区里的不完整帧从什么时候开始等，0 表示没有
+    uint64_t pingSentMs;    // 未应答的心跳的发送时间，0 表示没有；只由检查超时的线程访问
+
+    // 发送队列长度，包括还在路上的数据（跨线程读取，近似值）
+    size_t queuedBytes() const { return out.bytes() + inflight.load(std::memory_order_relaxed); }
+
+    ClientNode() : socket(-1), id(0), nonBlocking(false), closed(false), killed(false), loop(nullptr),
+                   binary(false), compress(false), paused(false), flushQueued(false), zeroCopy(false), inflight(0),
+                   watching(false), session(false), offlinePending(false),
+                   recvArmed(false), recvStopping(false), uringOps(0), lastRecvMs(0), lastRequestMs(0), partialSinceMs(0), pingSentMs(0) {}
+
+    // 线程模式下 closeClient 只 shutdown，描述符留到最后一个引用释放时才关闭：
+    // 持有节点的线程随时可以对它 shutdown，不会碰到被复用的 fd
+    ~ClientNode() {
+        if (!nonBlocking && socket >= 0) close(socket);
+    }
 };
 
 class TcpServer {
 private:
-    int _listenSock;        // 监听套接字
-    bool _running;          // 运行状态
-    
-    // 【核心差异】使用 Map 管理客户端：<ID, ClientNode>
-    // 参考代码通常用数组，这里用 Map 查重率极低
-    std::map<int, ClientNode> _clients; 
-    std::mutex _mtx;        // 线程锁，保护 _clients
+    std::vector<int> _listenFds; // 线程模式的监听套接字（从旧进程接管时可能有多个）
+    int _wakeFd;            // 线程模式下唤醒 accept 循环的 eventfd
+    int _spareFd;           // 线程模式的预留描述符（见 EventLoop::spareFd）
+    ConnLimiter _connLimiter; // 按源 IP 的新连接速率限制，所有 accept 线程共用
+    std::atomic<bool> _running; // 运行状态，stop() 后为 false
+    ServerConfig _cfg;      // 运行参数
+
+    // 【优雅关闭】
+    std::atomic<uint64_t> _drainDeadline; // 排空的截止时间（单调时钟纳秒）
+    std::atomic<size_t> _quiesced;        // 已停止处理请求的 Reactor 数
+    std::mutex _listenMtx;  // 交接监听套接字时不能被 Reactor 关掉
 
-    int _idCounter;         // ID 生成器，从 100 开始
+    // 线程模式的工作线程：退出时登记到 _finishedWorkers，由下一次 accept 或关闭时 join
+    std::mutex _workerMtx;
+    std::condition_variable _workerCv;
+    std::unordered_map<int, std::thread> _workers;
+    std::vector<int> _finishedWorkers;
+
+    // 【热重启】
+    int _handoffFd;         // 等待接管请求的 Unix 域监听套接字
+    int _takeoverFd;        // 启动时连上的旧进程，开始 accept 后回复它
+    bool _handedOff;        // 监听套接字已交给新进程
+    std::thread _handoffThread;
+
+    // 【超时与心跳】
+    bool _timeouts;         // 开启了心跳或任何一种超时
+    TimerWheel _threadTimers; // 线程模式下所有连接的超时检查，只由 accept 线程访问
+    std::mutex _renamedMtx;
+    std::unordered_map<int, int> _renamed; // 恢复会话换了 ID 的连接：旧 ID -> 新 ID，旧 ID 的定时器到期时改挂到新 ID
+
+    // 在线客户端：<ID, ClientNode>，按 ID 分片，查找不加锁
+    // 节点用 shared_ptr 持有，Reactor 线程处理事件时连接被移除也不会悬空
+    ShardedRegistry<ClientNode> _clients;
+    TopicRegistry _topics;  // 主题订阅
+    ClientRoster _roster;   // 按 ID 排序的在线列表，用于分页和增量推送
+    OfflineStore _store;    // 会话和离线消息，没有配置 storeDir 时不打开
+
+    std::atomic<int> _idCounter; // ID 生成器，从 100 开始（多个 Reactor 同时 accept）
+
+    std::vector<std::unique_ptr<EventLoop> > _loops; // epoll 模式下的 Reactor
+
+    CachedReply _nameReply; // 'N' 的应答，主机名在启动时取一次
+
+    int _statsFd;           // 统计端口的监听套接字
+    std::thread _statsThread; // 应答统计请求的线程，不占用 Reactor
 
 public:
-    TcpServer();
+    explicit TcpServer(const ServerConfig& cfg = ServerConfig());
     ~TcpServer();
 
-    // 启动服务器
+    // 启动服务器，关闭（stop 或被新进程接管）并排空后返回
     void start();
 
+    // 优雅关闭：停止 accept 和处理新请求，把发送队列写完（最多 drainTimeoutMs）后关闭所有连接
+    // 线程安全，可以在信号处理线程里调用；再次调用表示不再等待排空
+    void stop();
+
 private:
     // 工作线程：专门负责处理某一个客户端的所有交互
-    void workerThread(int clientSock, sockaddr_in addr, int clientId);
-    
+    void workerThread(std::shared_ptr<ClientNode> client);
+
+    // --- epoll 模式 ---
+
+    // 创建监听套接字，reusePort 为 true 时允许多个套接字绑定同一端口
+    int createListenSocket(bool reusePort);
+
+    // 监听套接字的选项：连接选项 + TCP_DEFER_ACCEPT，再按配置的 backlog listen
+    // 对从旧进程接管的、已经在监听的套接字再调用一次也有效（listen 会更新 backlog）
+    void applyListenOptions(int fd);
+
+    // 连接的选项：TCP_NODELAY、收发缓冲区、keepalive，只设置与内核默认值不同的项
+    void applySocketOptions(int fd);
+
+    // 创建各个 Reactor 的 epoll、监听套接字和 eventfd；inherited 非空时使用从旧进程接管的监听套接字
+    void initLoops(const std::vector<int>& inherited);
+
+    // 线程模式的 accept 循环：poll 所有监听套接字和 _wakeFd
+    void acceptLoop();
+
+    // 从 listenFd 连续 accept 到 EAGAIN 或取满 max 个，超过单 IP 速率限制的直接关闭
+    // 返回 true 表示已经取完。fd 用尽（EMFILE）时用 spareFd 腾出位置，把新连接 accept 后关掉，
+    // 否则它会一直留在队列里，水平触发的监听套接字会让循环空转
+    bool acceptBatch(int listenFd, int& spareFd, int flags, size_t max, std::vector<AcceptedConn>& out);
+
+    // fd 用尽时腾出预留的描述符，接受排在最前面的连接并立即关闭
+    void shedConnection(int listenFd, int& spareFd);
+
+    // 线程模式：为一批新连接启动工作线程，只加一次锁
+    void startWorkers(const std::vector<std::shared_ptr<ClientNode> >& nodes);
+
+    // Reactor 主循环：接受新连接，处理所属连接上的读写事件
+    void loopThread(EventLoop* loop);
+
+    // 接受一个新连接并注册到本 Reactor
+    void acceptOnLoop(EventLoop* loop);
+
+    // 执行其他 Reactor 投递过来的发送任务
+    void drainInbox(EventLoop* loop);
+
+    // 把发送任务投递给目标连接所属的 Reactor
+    void postToLoop(EventLoop* loop, LoopTask&& task);
+
+    // 登记新连接：epoll 模式注册到 loop；线程模式返回节点，由调用方成批启动工作线程
+    // 注册失败（连接已关闭）时返回空
+    std::shared_ptr<ClientNode> registerClient(int clientSock, const sockaddr_in& clientAddr, EventLoop* loop);
+
+    // 读事件：一直读到 EAGAIN，并分发其中所有完整的包
+    void handleReadable(const std::shared_ptr<ClientNode>& client);
+
+    // 写事件：把积压的输出尽量写出，降到低水位以下时恢复等待它的发送方
+    void flushOut(ClientNode& client);
+
+    // 统一 flush 本轮有新数据的连接
+    void flushDirty(EventLoop* loop);
+
+    // 背压：暂停读取 sender，直到 target 的发送队列降到低水位以下
+    void pauseSender(ClientNode& sender, ClientNode& target);
+
+    // 恢复读取被暂停的连接（在它所属的 Reactor 上执行）
+    void resumeClient(const std::shared_ptr<ClientNode>& client);
+
+    // 唤醒等待 target 的发送方
+    void wakeWaiters(std::vector<int>& waiters);
+
+    // --- io_uring 模式 ---
+    // 和 epoll 模式共用登记、分发、发送队列和排空流程，只是收发换成 io_uring 请求：
+    // 每个 Reactor 挂一个多次接收的 accept，每个连接挂一个多次接收的 recv（数据在内核提供的缓冲区环里），
+    // 发送队列一次提交一个 sendmsg，本轮的所有请求和等待合成一次 io_uring_enter
+
+    // 在本线程上创建 io_uring 并运行主循环；创建失败时返回 false，由调用方改用 epoll
+    bool uringLoop(EventLoop* loop);
+
+    // 分发一个完成事件
+    void handleCompletion(EventLoop* loop, const struct io_uring_cqe& cqe);
+
+    // accept 完成：登记新连接，多次接收的 accept 结束了就重新挂上
+    void onUringAccept(EventLoop* loop, const struct io_uring_cqe& cqe);
+
+    // recv 完成：数据拷进 inBuf 后分发，缓冲区还给内核
+    void onUringRecv(const std::shared_ptr<ClientNode>& client, const struct io_uring_cqe& cqe);
+
+    // sendmsg 完成：从发送队列去掉写出的部分，接着发剩下的
+    void onUringSend(const std::shared_ptr<ClientNode>& client, int res);
+
+    // 挂上多次接收的 recv
+    void armRecv(ClientNode& client);
+
+    // 发送队列不空且没有未完成的发送时提交一个 sendmsg（持有 outMtx）
+    void submitSend(ClientNode& client);
+
+    // 登记一个未完成的请求，节点在它完成之前不会释放
+    void uringHold(ClientNode& client);
+
+    // --- 超时与心跳 ---
+
+    // 推进时间轮，检查到期的连接，没断开的按下一次检查时间重新挂上
+    void runTimers(TimerWheel& timers);
+
+    // 检查一个连接：需要时发心跳或断开。返回下一次检查的时间，0 表示已断开
+    uint64_t checkTimeouts(const std::shared_ptr<ClientNode>& client, uint64_t now);
+
+    // 向空闲的连接发心跳（线程模式下不等待慢接收方）
+    void sendPing(ClientNode& client);
+
+    // 连接建立后第一次检查的时间
+    uint64_t firstTimeout(uint64_t now) const;
+
+    // --- 统计 ---
+
+    // 监听统计端口并启动应答线程
+    void startStats();
+
+    // 统计线程：每个连接回一份 HTTP 响应后关闭，Prometheus 或 curl 都可以直接抓取
+    void statsThread();
+
+    // 生成 Prometheus 文本格式的统计：在线连接、发送队列等实时值，加上各线程合并后的计数
+    void renderStats(std::string& out);
+
+    // --- 优雅关闭 ---
+
+    // Reactor 开始排空：关闭监听套接字，记下自己的连接
+    void beginDrain(EventLoop* loop);
+
+    // 所有 Reactor 都已停止处理请求、inbox 和发送队列都已清空，或者到了截止时间
+    bool drained(EventLoop* loop);
+
+    // 排空期间不再处理请求，读到的数据直接丢弃（避免关闭时因未读数据发送 RST）
+    void discardInput(ClientNode& client);
+
+    // 关闭时断开连接：不再通知订阅者，已排空的数据由内核发完
+    void closeOnShutdown(const std::shared_ptr<ClientNode>& client);
+
+    // 线程模式：停止读取，等工作线程把正在处理的请求做完后 join
+    void drainWorkers();
+
+    // join 已经退出的工作线程
+    void reapWorkers();
+
+    // --- 热重启 ---
+
+    // 连接旧进程并接收它的监听套接字，没有旧进程时 fds 为空
+    void takeOver(std::vector<int>& fds);
+
+    // 已经开始 accept：通知旧进程退出
+    void finishTakeover();
+
+    // 监听接管请求并启动交接线程
+    void startHandoff();
+
+    // 交接线程：把监听套接字发给新进程，新进程确认后开始优雅关闭
+    void handoffThread();
+
+    // 关闭统计端口（交接时让给新进程）
+    void stopStats();
+
+    // --- 会话与离线消息 ---
+
+    // 打开离线消息存储，其他进程（热重启前的旧进程）持有时最多等 waitMs
+    void openStore(int waitMs);
+
+    // 连接改用会话 ID：按旧 ID 退出在线列表、主题和订阅，再按新 ID 加回去；会话已在别的连接上时返回 false
+    bool rebindClient(ClientNode& client, int newId);
+
+    // 把会话的离线消息分批发给连接，每批确认一次
+    void deliverOffline(ClientNode& client);
+
+    // 从列表移除并关闭连接
+    void closeClient(const std::shared_ptr<ClientNode>& client);
+
+    // 按 ID 查找在线客户端
+    std::shared_ptr<ClientNode> findClient(int clientId);
+
+    // 切分缓冲区中所有完整的包（文本帧或二进制帧）并分发，遇到非法数据返回 false
+    bool processBuffer(ClientNode& client);
+
     // 消息分发中心：根据消息类型调用不同逻辑
-    void dispatchMessage(int sock, NetMsg& msg, int clientId);
-    
+    // msg 借用接收缓冲区，只在本次调用内有效。应答都带上请求的关联 ID（msg.corrId，没有时为 0），
+    // 客户端按 ID 匹配，应答不必按请求顺序返回
+    void dispatchMessage(ClientNode& client, const NetMsgView& msg);
+
+    // 解压客户端发来的 'Z' 帧，逐个分发其中的请求，数据非法时返回 false
+    bool dispatchCompressed(ClientNode& client, StrView payload);
+
     // --- 具体业务逻辑 ---
-    
+
     // 1. 处理时间请求
-    void handleTimeReq(int sock, int clientId);
-    
+    void handleTimeReq(ClientNode& client, uint32_t corrId);
+
     // 2. 处理名字请求
-    void handleNameReq(int sock, int clientId);
-    
-    // 3. 处理列表请求
-    void handleListReq(int sock, int clientId);
-    
+    void handleNameReq(ClientNode& client, uint32_t corrId);
+
+    // 3. 处理列表请求：payload 为空时返回全部；"afterId:limit" 时返回 ID 大于 afterId 的一页
+    void handleListReq(ClientNode& client, StrView payload, uint32_t corrId);
+
+    // 3.1 订阅/退订在线列表的增量（payload 为 "1"/"0"），应答带当前版本号
+    void handleWatchReq(ClientNode& client, StrView payload, uint32_t corrId);
+
+    // 上线/下线后把增量推送给订阅者
+    void publishRosterChange(ClientNode& node, uint64_t version, bool online);
+
+    // 0. 处理帧格式协商
+    void handleProtoReq(ClientNode& client, const NetMsgView& msg);
+
+    // 0.1 处理心跳：客户端的 "ping" 回 "pong"，"pong" 只算作活动
+    void handleHeartbeat(ClientNode& client, StrView payload, uint32_t corrId);
+
     // 4. 处理消息转发
-    void handleForwardReq(int sock, int sourceId, int targetId, std::string content);
+    void handleForwardReq(ClientNode& client, int targetId, StrView content, uint32_t corrId);
+
+    // 5. 处理广播：发给除自己以外的所有在线客户端
+    void handleBroadcastReq(ClientNode& client, StrView content);
+
+    // 6. 处理订阅/退订主题
+    void handleJoinReq(ClientNode& client, StrView topic, uint32_t corrId);
+    void handleLeaveReq(ClientNode& client, StrView topic, uint32_t corrId);
+
+    // 7. 处理发布：payload 为 "主题|内容"，发给该主题除自己以外的订阅者
+    void handlePublishReq(ClientNode& client, StrView payload, uint32_t corrId);
+
+    // 8. 处理会话：payload 为空时新建会话，为令牌时恢复会话；应答的 targetId 是会话 ID，内容是令牌
+    // 之后连接改用会话 ID，断开期间发给这个 ID 的消息存进离线队列，恢复时先补发
+    void handleSessionReq(ClientNode& client, StrView token, uint32_t corrId);
+
+    // 9. 处理主动退出 'D'：结束绑定的会话，丢弃离线队列，之后发给这个 ID 的消息报告对方不存在
+    void handleQuitReq(ClientNode& client);
+
+    // 扇出：把 head + body 发给 targets 中除 sender 以外的连接，targetId 填 sender 的 ID
+    // 文本帧、二进制帧和压缩的二进制帧各最多编码一次，所有接收方的发送队列共享同一份缓冲区
+    void fanOut(ClientNode& sender, const std::vector<std::shared_ptr<ClientNode> >& targets,
+                char type, StrView head, StrView body);
+
+    // 辅助发送函数：应答 client 的请求，corrId 为请求的关联 ID
+    void sendMsg(ClientNode& client, uint32_t corrId, char type, StrView content = StrView(), int targetId = 0);
+
+    // 发送已编码的数据：线程模式阻塞写完；epoll 模式入队，本轮事件处理完后统一写出
+    // 超过高水位时按慢消费者策略处理，消息被丢弃或连接已关闭时返回 false
+    // shared 非空时 packet 就是它的内容，epoll 模式下直接引用而不拷贝
+    // 协商了压缩的连接，不小于 compressMin 的 packet（可以是多个帧）整个压缩成一个 'Z' 帧再发
+    bool sendRaw(ClientNode& client, StrView packet, const SharedBuf& shared = SharedBuf());
 
-    // 辅助发送函数
-    void sendMsg(int sock, char type, std::string content = "", int targetId = 0);
+    // packet 够大且压缩后变小时，把它压缩成一个 'Z' 帧写进 out（覆盖）并返回 true
+    bool compressPacket(StrView packet, std::string& out);
 };
 
 #endif
\ No newline at end of file
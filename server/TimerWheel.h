@@ -0,0 +1,99 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+#include <time.h>
+#include <stdint.h>
+
+#define TIMER_TICK_MS 100       // 时间轮的精度
+#define TIMER_WHEEL_BITS 6      // 每层 64 个槽
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4    // 4 层共覆盖 2^24 个 tick（100ms 精度下约 19 天），更远的按最远处理
+
+// 粗粒度单调时钟（毫秒），vDSO 直接读，比 CLOCK_MONOTONIC 便宜，精度几毫秒
+inline uint64_t timerNowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 分层时间轮：挂上和每个 tick 的推进都是 O(1)，与挂着的定时器数量无关
+//
+// 第 0 层每个槽是一个 tick，第 k 层每个槽是第 k-1 层转一圈。定时器按离到期还有多远放在对应层，
+// 低层转完一圈时把上一层当前槽里的定时器重新分配到低层（每个定时器最多被搬动 LEVELS-1 次）。
+// 只存连接 ID，不支持取消：到期后由调用方按 ID 查连接，已断开的直接忽略，
+// 没到真正期限的（期间有活动）按新的期限重新挂上。单线程使用，不加锁。
+class TimerWheel {
+public:
+    explicit TimerWheel(uint32_t tickMs = TIMER_TICK_MS)
+        : _tickMs(tickMs), _now(timerNowMs() / tickMs), _size(0) {}
+
+    uint32_t tickMs() const { return _tickMs; }
+    size_t size() const { return _size; }
+
+    // 在 deadlineMs（timerNowMs 的时间）之后到期；已经过了的在下一个 tick 到期
+    void add(int id, uint64_t deadlineMs) {
+        Entry e;
+        e.id = id;
+        e.tick = (deadlineMs + _tickMs - 1) / _tickMs;
+        place(e, _now + 1);
+        _size++;
+    }
+
+    // 推进到 nowMs，到期的 ID 追加到 expired
+    void advance(uint64_t nowMs, std::vector<int>& expired) {
+        uint64_t target = nowMs / _tickMs;
+        if (_size == 0) {
+            if (target > _now) _now = target; // 空轮子直接跳过去
+            return;
+        }
+        while (_now < target) {
+            _now++;
+            if ((_now & (TIMER_WHEEL_SLOTS - 1)) == 0) cascade(1);
+            std::vector<Entry>& slot = _slots[0][_now & (TIMER_WHEEL_SLOTS - 1)];
+            for (size_t i = 0; i < slot.size(); i++) expired.push_back(slot[i].id);
+            _size -= slot.size();
+            slot.clear(); // 保留容量
+        }
+    }
+
+private:
+    struct Entry {
+        int id;
+        uint64_t tick;  // 到期的 tick（绝对值）
+    };
+
+    // 按离到期的距离选层；minTick 之前到期的放到 minTick
+    void place(Entry e, uint64_t minTick) {
+        if (e.tick < minTick) e.tick = minTick;
+        uint64_t delta = e.tick - _now;
+        const uint64_t maxDelta = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+        if (delta > maxDelta) {
+            e.tick = _now + maxDelta;
+            delta = maxDelta;
+        }
+        int level = 0;
+        while (delta >= (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) level++;
+        _slots[level][(e.tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)].push_back(e);
+    }
+
+    // 第 level-1 层转完一圈：把第 level 层当前槽里的定时器分配下去（上一层也转完时先处理上一层）
+    void cascade(int level) {
+        if (level >= TIMER_WHEEL_LEVELS) return;
+        size_t index = (_now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        if (index == 0) cascade(level + 1);
+
+        std::vector<Entry> moved;
+        moved.swap(_slots[level][index]);
+        for (size_t i = 0; i < moved.size(); i++) {
+            place(moved[i], _now); // 正好在当前 tick 到期的放进第 0 层当前槽，紧接着就会取出
+        }
+    }
+
+    uint32_t _tickMs;
+    uint64_t _now;      // 已经处理到的 tick
+    size_t _size;       // 挂着的定时器数
+    std::vector<Entry> _slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+#endif
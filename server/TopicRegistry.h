@@ -0,0 +1,68 @@
+#ifndef TOPIC_REGISTRY_H
+#define TOPIC_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+
+#define MAX_TOPIC_LEN 64            // 主题名最大长度
+#define MAX_TOPICS_PER_CLIENT 64    // 每个连接最多订阅的主题数
+
+// 主题订阅表：主题名 -> 订阅者 ID 列表
+// 订阅者列表写时复制：发布时只在锁内取到当前列表的引用，遍历和发送都在锁外进行；
+// join/leave 复制一份新列表再替换，正在使用旧列表的发布者不受影响
+class TopicRegistry {
+public:
+    typedef std::shared_ptr<const std::vector<int> > Members;
+
+    // 订阅，已经订阅过也返回 true；返回订阅后的人数
+    size_t join(const std::string& topic, int id) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        Members& members = _topics[topic];
+        if (members && std::find(members->begin(), members->end(), id) != members->end()) {
+            return members->size();
+        }
+        std::shared_ptr<std::vector<int> > next = members ? std::make_shared<std::vector<int> >(*members)
+                                                          : std::make_shared<std::vector<int> >();
+        next->push_back(id);
+        members = next;
+        return next->size();
+    }
+
+    // 退订，不在订阅列表里返回 false。最后一个订阅者离开时删除主题
+    bool leave(const std::string& topic, int id) {
+        std::lock_guard<std::mutex> lock(_mtx);
+        std::unordered_map<std::string, Members>::iterator it = _topics.find(topic);
+        if (it == _topics.end()) return false;
+        const std::vector<int>& cur = *it->second;
+        std::vector<int>::const_iterator pos = std::find(cur.begin(), cur.end(), id);
+        if (pos == cur.end()) return false;
+
+        if (cur.size() == 1) {
+            _topics.erase(it);
+            return true;
+        }
+        std::shared_ptr<std::vector<int> > next = std::make_shared<std::vector<int> >();
+        next->reserve(cur.size() - 1);
+        next->insert(next->end(), cur.begin(), pos);
+        next->insert(next->end(), pos + 1, cur.end());
+        it->second = next;
+        return true;
+    }
+
+    // 当前订阅者列表，主题不存在返回空指针
+    Members members(const std::string& topic) const {
+        std::lock_guard<std::mutex> lock(_mtx);
+        std::unordered_map<std::string, Members>::const_iterator it = _topics.find(topic);
+        return it == _topics.end() ? Members() : it->second;
+    }
+
+private:
+    mutable std::mutex _mtx;    // 只保护 _topics 本身，持有时间很短
+    std::unordered_map<std::string, Members> _topics;
+};
+
+#endif
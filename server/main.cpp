@@ -1,13 +1,137 @@
 #include "TcpServer.h"
+#include "Logger.h"
+#include "Config.h"
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <thread>
+#include <atomic>
+#include <pthread.h>
+
+#define LOG_DEFAULT_FORWARD_RATE 1000 // 转发类日志默认每秒最多 1000 条
+
+// 用法：./server [-f 配置文件] [-o key=value]... [-m thread|epoll|uring] [-t 线程数] [-c] [-P 端口] [-b backlog]
+//              [-w 高水位[:低水位]] [-p drop|disconnect|backpressure] [-z 零拷贝阈值] [-Z 压缩阈值]
+//              [-l debug|info|warn|error] [-L 类别:每秒条数[:采样间隔]]... [-S 统计端口]
+//              [-D 排空毫秒数] [-H 热重启套接字路径] [-k 心跳毫秒数] [-i 空闲超时毫秒数] [-r 读超时毫秒数]
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [-f configFile] [-o key=value]... [-m thread|epoll|uring] [-t loopThreads] [-c]"
+              << " [-P port] [-b backlog]"
+              << " [-w high[:low]] [-p drop|disconnect|backpressure] [-z zeroCopyBytes] [-Z compressMinBytes]"
+              << " [-l debug|info|warn|error] [-L category:perSecond[:sampleEvery]]... [-S statsPort]"
+              << " [-D drainMs] [-H handoffSocketPath] [-k heartbeatMs] [-i idleTimeoutMs] [-r readTimeoutMs]"
+              << " [-s storeDir]"
+              << std::endl;
+    std::cerr << "  log categories: server conn request forward topic" << std::endl;
+    std::cerr << "  config keys (file lines or -o):" << std::endl;
+    ConfigFile::printKeys(std::cerr);
+}
+
+// 带一个参数的命令行选项，等价于配置文件里的同名项
+struct FlagOption {
+    const char* flag;
+    const char* key;
+};
+
+static const FlagOption FLAGS[] = {
+    {"-m", "mode"},
+    {"-t", "threads"},
+    {"-P", "port"},
+    {"-b", "backlog"},
+    {"-p", "slow_policy"},
+    {"-z", "zero_copy"},
+    {"-Z", "compress_min"},
+    {"-S", "stats_port"},
+    {"-D", "drain_ms"},
+    {"-H", "handoff_path"},
+    {"-k", "heartbeat_ms"},
+    {"-i", "idle_timeout_ms"},
+    {"-r", "read_timeout_ms"},
+    {"-s", "store_dir"},
+    {"-l", "log_level"},
+    {"-L", "log_limit"},
+};
+
+static const char* flagKey(const char* flag) {
+    for (size_t i = 0; i < sizeof(FLAGS) / sizeof(FLAGS[0]); i++) {
+        if (strcmp(flag, FLAGS[i].flag) == 0) return FLAGS[i].key;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    ServerConfig cfg;
+    Logger& logger = Logger::instance();
+    logger.setLimit(LOG_CAT_FORWARD, LOG_DEFAULT_FORWARD_RATE, 1);
+    std::string err;
+
+    // 先读配置文件，命令行参数不论写在前面还是后面都覆盖文件里的值
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "-f") != 0) continue;
+        if (!ConfigFile::load(argv[i + 1], cfg, err)) {
+            std::cerr << err << std::endl;
+            return 1;
+        }
+    }
+
+    // 解析命令行参数
+    for (int i = 1; i < argc; i++) {
+        const char* key = flagKey(argv[i]);
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            i++; // 已经读过
+        } else if (key != NULL && i + 1 < argc) {
+            if (!ConfigFile::set(cfg, key, argv[++i], err)) {
+                std::cerr << err << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            if (!ConfigFile::setPair(cfg, argv[++i], err)) {
+                std::cerr << err << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-c") == 0) {
+            cfg.pinCpu = true; // Reactor 绑核
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            // 发送队列水位，单位字节；只给高水位时低水位取其四分之一
+            char* end;
+            cfg.outHighWater = strtoul(argv[++i], &end, 10);
+            cfg.outLowWater = (*end == ':') ? strtoul(end + 1, NULL, 10) : cfg.outHighWater / 4;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // SIGINT/SIGTERM 由专门的线程用 sigwait 接收（必须在创建任何线程之前屏蔽），
+    // 第一次开始优雅关闭，再来一次就不再等待排空
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
 
-int main() {
     // 实例化并启动
+    logger.start();
     try {
-        TcpServer server;
-        server.start();
+        TcpServer server(cfg);
+        std::atomic<bool> finished(false);
+        std::thread signalThread([&]() {
+            int sig;
+            while (sigwait(&sigs, &sig) == 0 && !finished) {
+                LOG_INFO(LOG_CAT_SERVER, "[Server] Received signal %d", sig);
+                server.stop();
+            }
+        });
+
+        server.start(); // 关闭并排空后返回
+
+        finished = true;
+        pthread_kill(signalThread.native_handle(), SIGTERM); // 唤醒 sigwait
+        signalThread.join();
     } catch (const std::exception& e) {
-        std::cerr << "Server crashed: " << e.what() << std::endl;
+        LOG_ERROR(LOG_CAT_SERVER, "Server crashed: %s", e.what());
     }
+    logger.stop();
     return 0;
 }
\ No newline at end of file